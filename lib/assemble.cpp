@@ -12,18 +12,159 @@
 #include "util.h"
 
 #include "mlb.h"
+#include "mcall.h"
 #include "object.h"
 #include "listing.h"
 #include "parse.h"
 #include "symbols.h"
 #include "extree.h"
 #include "macros.h"
+#include "profile.h"
+#include "replay.h"
 #include "rept_irpc.h"
 
 #include "rad50.h"
 #include "encoding.h"
 
 
+/* The directives that matter while assembly is suppressed by an
+   unsatisfied conditional.  Every other line is skipped with no more
+   than a scan for its leading '.' (see get_directive). */
+
+static const DIRECTIVE cond_directives[] = {
+    { ".IF", P_IF },
+    { ".IFDF", P_IFDF },
+    { ".IFNDF", P_IFDF },
+    { ".IFF", P_IFF },
+    { ".IFT", P_IFT },
+    { ".IFTF", P_IFTF },
+    { ".ENDC", P_ENDC },
+    { NULL, 0 }
+};
+
+static THREAD_LOCAL long     expanded_lines;        /* Lines expansions produced this pass */
+
+/* is_expansion tells whether a stream is the expansion of a macro,
+   .REPT, .IRP or .IRPC. */
+
+static int is_expansion(
+    STREAM *str)
+{
+    return str->str_type == TYPE_MACRO_STREAM || str->str_type == TYPE_REPT_STREAM ||
+        str->str_type == TYPE_IRP_STREAM || str->str_type == TYPE_IRPC_STREAM;
+}
+
+/* unwind_expansions abandons every expansion in progress, back to
+   the innermost source file. */
+
+static void unwind_expansions(
+    STACK *stack)
+{
+    while (stack->top != NULL && is_expansion(stack->top))
+        stack->pop();
+}
+
+/* expansion_name returns what an expansion stream expands: its name
+   is the call site, "->", and the macro name or directive. */
+
+static const char *expansion_name(
+    STREAM *str)
+{
+    const char     *cp = strrchr(str->name, '>');
+
+    return cp ? cp + 1 : str->name;
+}
+
+/* report_runaway reports an expansion limit reached, at the line of
+   source that started it all, with the chain of expansions in
+   progress, outermost first; a macro calling itself shows once, with
+   a count.  Then it abandons them all. */
+
+static void report_runaway(
+    STACK *stack,
+    const char *what)
+{
+    STREAM         *s;
+    STREAM        **chain;
+    char            names[256];
+    int             n = 0,
+                    len = 0,
+                    i;
+
+    for (s = stack->top; s != NULL && is_expansion(s); s = s->next)
+        n++;
+    chain = (STREAM **)memcheck(malloc((n + 1) * sizeof(STREAM *)));
+    for (i = n, s = stack->top; i > 0; s = s->next)
+        chain[--i] = s;
+
+    names[0] = 0;
+    for (i = 0; i < n; ) {
+        const char     *name = expansion_name(chain[i]);
+        int             run = 1;
+
+        while (i + run < n && strcmp(expansion_name(chain[i + run]), name) == 0)
+            run++;
+        if (len + strlen(name) + 24 >= sizeof(names)) {
+            strcpy(names + len, " ...");
+            break;
+        }
+        len += sprintf(names + len, run > 1 ? "%s%s x%d" : "%s%s", i ? " -> " : "", name, run);
+        i += run;
+    }
+
+    replay_spoil();                    /* Only the streams can tell */
+    report(s, "%s, in %s\n", what, names);
+
+    free(chain);
+    unwind_expansions(stack);
+}
+
+/* push_expansion pushes a new expansion onto the input, unless that
+   would nest expansions deeper than max_expand_depth or hold more
+   than max_expand_bytes of expanded text.  Then it reports it,
+   abandons all the expansions in progress and returns FALSE.  */
+
+static int push_expansion(
+    STACK *stack,
+    STREAM *str)
+{
+    STREAM         *s;
+    char            what[64];
+    int             depth = 1;
+    long            bytes = ((BUFFER_STREAM *) str)->buffer->length;
+
+    for (s = stack->top; s != NULL && is_expansion(s); s = s->next) {
+        depth++;
+        bytes += ((BUFFER_STREAM *) s)->buffer->length;
+    }
+
+    if (max_expand_depth > 0 && depth > max_expand_depth) {
+        sprintf(what, "Expansions nested more than %d deep", max_expand_depth);
+    } else if (max_expand_bytes > 0 && bytes > max_expand_bytes) {
+        sprintf(what, "Expansions hold more than %ld bytes of text", max_expand_bytes);
+    } else {
+        stack->push(str);
+        return TRUE;
+    }
+
+    stack->push(str);                  /* To show in the chain */
+    report_runaway(stack, what);
+    return FALSE;
+}
+
+/* count_expanded_lines counts lines produced by expansions.  It
+   returns FALSE, counting nothing, if that would make more than
+   max_expand_lines in this pass. */
+
+int count_expanded_lines(
+    long count)
+{
+    if (max_expand_lines > 0 && expanded_lines + count > max_expand_lines)
+        return FALSE;
+    expanded_lines += count;
+    return TRUE;
+}
+
 /* assemble - read a line from the input stack, assemble it. */
 
 /* This function is way way too large, because I just coded most of
@@ -46,6 +187,28 @@ static int assemble(
     if (line == NULL)
         return -1;                     /* Return code for EOF. */
 
+    /* A line of a body was read by read_body, not here */
+    if (prof_enabled && !(replaying && replay_body_line()))
+        prof_line(stack->top);
+
+    if (replaying && replay_listed()) {
+        /* A line of a body, listed as reading the body did, or one a
+           conditional passed over */
+        list_source(stack->top, line);
+        return 1;
+    }
+
+    if (is_expansion(stack->top) && !count_expanded_lines(1)) {
+        char            what[64];
+
+        sprintf(what, "Expansions produced more than %ld lines", max_expand_lines);
+        report_runaway(stack, what);
+        return 0;
+    }
+
+    if (replay_recording)
+        replay_record(stack->top, line);
+
     cp = line;
 
     /* Frankly, I don't need to keep "line."  But I found it quite
@@ -59,18 +222,12 @@ static int assemble(
 
     if (suppressed) {
         /* Assembly is suppressed by unsatisfied conditional.  Look
-           for ending and enabling statements. */
+           for ending and enabling statements.  As in MACRO-11, only
+           the conditionals are recognized, even in the text of a
+           .REM, which isn't recognized itself. */
+        int             was_suppressed = suppressed;
 
-        op = get_op(cp, &cp);          /* Look at operation code */
-
-        /* FIXME: this code will blindly look into .REM commentary and
-           find operation codes.  Incidentally, so will read_body. */
-
-        if (op == NULL)
-            return 1;                  /* Not found.  Don't care. */
-        if (op->section->type != SECTION_PSEUDO)
-            return 1;                  /* Not a pseudo-op. */
-        switch (op->value) {
+        switch (get_directive(cp, &cp, cond_directives)) {
         case P_IF:
         case P_IFDF:
             suppressed++;              /* Nested.  Suppressed. */
@@ -97,6 +254,11 @@ static int assemble(
                 pop_cond(last_cond - 1);        /* Re-enabled. */
             break;
         }
+
+        /* A line that left the suppression as it was is passed over
+           in a replay */
+        if (suppressed == was_suppressed)
+            replay_suppressed();
         return 1;
     }
 
@@ -149,7 +311,7 @@ static int assemble(
 
         if (*ncp == '=') {
             unsigned        flags;
-            EX_TREE        *value;
+            EX_VALUE        result;
             SYMBOL         *sym;
 
             cp = ncp;
@@ -169,12 +331,14 @@ static int assemble(
 
             cp = skipwhite(cp);
 
-            value = parse_expr(cp, 0);
+            parse_value(cp, 0, &result);
 
             /* Special code: if the symbol is the program counter,
                this is harder. */
 
             if (strcmp(label, ".") == 0) {
+                EX_TREE        *value = result.make_tree();
+
                 if (current_pc->section->flags & PSECT_REL) {
                     SYMBOL         *sym;
                     unsigned        offset;
@@ -184,10 +348,12 @@ static int assemble(
                        section must = current. */
 
                     if (!express_sym_offset(value, &sym, &offset)) {
+                        replay_spoil();    /* Might be a forward reference */
                         report(stack->top, "Illegal ORG\n");
                     } else if ((sym->flags & (SYMBOLFLAG_GLOBAL | SYMBOLFLAG_DEFINITION)) == SYMBOLFLAG_GLOBAL) {
                         report(stack->top, "Can't ORG to external location\n");
                     } else if (sym->flags & SYMBOLFLAG_UNDEFINED) {
+                        replay_spoil();
                         report(stack->top, "Can't ORG to undefined sym\n");
                     } else if (sym->section != current_pc->section) {
                         report(stack->top, "Can't ORG to alternate section " "(use PSECT)\n");
@@ -200,6 +366,7 @@ static int assemble(
                     /* If the current section is absolute, the value
                        must be a literal */
                     if (value->type != EX_LIT) {
+                        replay_spoil();
                         report(stack->top, "Can't ORG to non-absolute location\n");
                         delete (value);
                         free(label);
@@ -215,10 +382,12 @@ static int assemble(
             }
 
             /* regular symbols */
-            if (value->type == EX_LIT) {
-                sym = Glb_symbol_st.add_sym(label, value->data.lit, flags, &absolute_section);
-            } else if (value->type == EX_SYM || value->type == EX_TEMP_SYM) {
-                sym = Glb_symbol_st.add_sym(label, value->data.symbol->value, flags, value->data.symbol->section);
+            if (result.type == EXV_LIT) {
+                sym = Glb_symbol_st.add_sym(label, result.value, flags, &absolute_section);
+            } else if (result.type == EXV_SYM) {
+                sym = Glb_symbol_st.add_sym(label, result.sym->value, flags, result.sym->section);
+            } else if (result.type == EXV_TEMP) {
+                sym = Glb_symbol_st.add_sym(label, result.value, flags, result.section);
             } else {
                 report(stack->top, "Complex expression cannot be assigned " "to a symbol\n");
 
@@ -226,6 +395,7 @@ static int assemble(
                     /* This may work better in pass 2 - something in
                        RT-11 monitor needs the symbol to apear to be
                        defined even if I can't resolve its value. */
+                    replay_no_onepass();
                     sym = Glb_symbol_st.add_sym(label, 0, SYMBOLFLAG_UNDEFINED, &absolute_section);
                 } else
                     sym = NULL;
@@ -234,26 +404,37 @@ static int assemble(
             if (sym != NULL)
                 list_value(stack->top, sym->value);
 
-            delete (value);
             free(label);
 
             return sym != NULL;
         }
 
+        /* A replay has the first pass's expansions in it already,
+           and passes over the lines that made them; but an .IIF is
+           tried again, for the listing, to pass over what follows */
+        if (replaying && replay_skipped()) {
+            upcase(label);             /* As it's looked up below */
+            if (strcmp(label, ".IIF") != 0) {
+                free(label);
+                return 1;
+            }
+        }
+
         /* Try to resolve macro */
 
-        op = Glb_macro_st.lookup_sym(label);
+        op = replaying ? NULL : Glb_macro_st.lookup_sym(label);
         if (op && op->stmtno < stmtno) {
             STREAM         *macstr;
 
             free(label);
+            replay_skip();
 
             macstr = expandmacro(stack->top, (MACRO *) op, ncp);
+            if (macstr == NULL)
+                return 0;              /* Bad macro call, reported */
 
-            stack->push(macstr); /* Push macro expansion
-                                          onto input stream */
-
-            return 1;
+            /* Push macro expansion onto input stream */
+            return push_expansion(stack, macstr);
         }
 
         /* Try to resolve instruction or pseudo */
@@ -374,18 +555,27 @@ static int assemble(
                             return 0;
                         }
 
+                        if (replaying) {
+                            Glb_symbol_st.add_sym(label, replay_value(), SYMBOLFLAG_DEFINITION | local,
+                                                  &absolute_section);
+                            free(label);
+                            return 1;
+                        }
+
                         /* Walk up the stream stack to find the
                            topmost macro stream */
                         for (str = stack->top; str != NULL && str->str_type != TYPE_MACRO_STREAM;
                              str = str->next) ;
 
                         if (!str) {
+                            replay_spoil();     /* A replay can't tell */
                             report(str, ".NARG not within macro expansion\n");
                             free(label);
                             return 0;
                         }
 
                         mstr = (MACRO_STREAM *) str;
+                        replay_note_value(mstr->nargs);
 
                         Glb_symbol_st.add_sym(label, mstr->nargs, SYMBOLFLAG_DEFINITION | local, &absolute_section);
                         free(label);
@@ -444,6 +634,9 @@ static int assemble(
                     {
                         char           *name = getstring(cp, &cp);
                         FILE_STREAM         *incl;
+                        int             ok;
+
+                        replay_skip();
 
                         if (name == NULL) {
                             report(stack->top, "Bad .INCLUDE file name\n");
@@ -451,8 +644,17 @@ static int assemble(
                         }
 
                         incl = new FILE_STREAM();
-                        if (!incl->init(name)) {
+                        if (source_hook != NULL) {
+                            const char     *text;
+                            int             len;
+
+                            text = source_hook(source_arg, SOURCE_INCLUDE, name, &len);
+                            ok = text != NULL && incl->init_text(name, text, len);
+                        } else
+                            ok = incl->init(name);
+                        if (!ok) {
                             report(stack->top, "Unable to open .INCLUDE file %s\n", name);
+                            delete incl;
                             free(name);
                             return 0;
                         }
@@ -468,6 +670,8 @@ static int assemble(
                     {
                         char            quote[4];
 
+                        replay_skip();
+
                         /* Read and discard lines until one with a
                            closing quote */
 
@@ -491,31 +695,29 @@ static int assemble(
                     {
                         IRP_STREAM         *str = expand_irp(stack, cp);
 
-                        if (str)
-                            stack->push((STREAM *)str);
-                        return str != NULL;
+                        replay_skip();
+
+                        return str != NULL && push_expansion(stack, (STREAM *)str);
                     }
 
                 case P_IRPC:
                     {
                         IRPC_STREAM         *str = expand_irpc(stack, cp);
 
-                        if (str)
-                            stack->push((STREAM *)str);
-                        return str != NULL;
+                        replay_skip();
+
+                        return str != NULL && push_expansion(stack, (STREAM *)str);
                     }
 
                 case P_MCALL:
                     {
                         STREAM         *macstr;
-                        BUFFER         *macbuf;
+                        MCALL_SOURCE   *macsrc;
                         char           *maccp;
                         int             saveline;
                         MACRO          *mac;
-                        int             i;
-                        char            macfile[FILENAME_MAX];
-                        char            hitfile[FILENAME_MAX];
 
+                        replay_skip();
                         for (;;) {
                             cp = skipdelim(cp);
 
@@ -537,25 +739,15 @@ static int assemble(
                                 continue;
                             }
 
-                            /* Find the macro in the list of included
-                               macro libraries */
-                            macbuf = NULL;
+                            /* Find the macro in the included macro
+                               libraries or the MCALL directories */
                             macstr = NULL;
-                            for (i = 0; i < nr_mlbs; i++)
-                                if ((macbuf = mlb_entry(mlbs[i], label)) != NULL)
-                                    break;
-                            if (macbuf != NULL) {
-                                macstr = new BUFFER_STREAM(macbuf, label);
-                                buffer_free(macbuf);
-                            } else {
-                                strncpy(macfile, label, sizeof(macfile));
-                                strncat(macfile, ".MAC", sizeof(macfile) - strlen(macfile) - 1);
-                                my_searchenv(macfile, "MCALL", hitfile, sizeof(hitfile));
-                                if (hitfile[0]) {
-                                    FILE_STREAM * fmacstr = new FILE_STREAM();
-                                    if(fmacstr->init(hitfile))
-                                        macstr = fmacstr;
-                                }
+                            mac = NULL;
+                            if ((macsrc = mcall_find(label)) != NULL) {
+                                /* Maybe it has been parsed before */
+                                if ((mac = mcall_compiled(macsrc)) == NULL &&
+                                    (mac = mcall_cache_load(macsrc)) == NULL)
+                                    macstr = mcall_open(macsrc);
                             }
 
                             if (macstr != NULL) {
@@ -586,16 +778,23 @@ static int assemble(
                                     mac = defmacro(maccp, &macstack, TRUE);
                                     if (mac == NULL) {
                                         report(stack->top, "Failed to define macro " "called %s\n", label);
-                                    }
+                                    } else
+                                        mcall_cache_save(macsrc, mac);
 
                                     stmtno = saveline;
                                     list_level = savelist;
                                 }
 
                                 delete macstr;
-                            } else
+                            } else if (mac == NULL)
                                 report(stack->top, "MACRO %s not found\n", label);
 
+                            if (mac != NULL) {
+                                /* Where it came from, for the profiler */
+                                free(mac->source);
+                                mac->source = (char *)memcheck(strdup(macsrc->mlb ? macsrc->mlb->name : macsrc->file));
+                            }
+
                             free(label);
                         }
                     }
@@ -605,6 +804,7 @@ static int assemble(
                     {
                         MACRO          *mac = defmacro(cp, stack, FALSE);
 
+                        replay_skip();
                         return mac != NULL;
                     }
 
@@ -624,17 +824,32 @@ static int assemble(
 
                         /* and finally, pop the macro */
                         stack->pop();
+                        replay_skip();
 
                         return 1;
                     }
 
                 case P_REPT:
                     {
-                        REPT_STREAM *reptstr = expand_rept(stack, cp);
+                        REPT_STREAM    *reptstr;
+                        BUFFER         *body;
+                        PROF_SITE      *site;
+                        int             count;
+
+                        /* A replay stores a data-only one again, or
+                           else repeats the lines */
+                        if (replaying && (body = replay_rept_body(&count, &site)) != NULL) {
+                            replay_list_body(stack);
+                            reptstr = new_rept_stream(stack->top, body, count, site);
+                            if (site != NULL)
+                                prof_charge(site);
+                        } else
+                            reptstr = expand_rept(stack, cp);
 
-                        if (reptstr)
-                            stack->push((STREAM *)reptstr);
-                        return reptstr != NULL;
+                        if (reptstr && store_rept_data(reptstr, tr))
+                            return 1;  /* Stored all at once */
+                        replay_skip();
+                        return reptstr != NULL && push_expansion(stack, (STREAM *)reptstr);
                     }
 
                 case P_ENABL:
@@ -708,11 +923,13 @@ static int assemble(
                             value = parse_expr(cp, 1);
                             cp = value->cp;
                             ok = eval_defined(value);
+                            replay_note_defined(value);
                             delete (value);
                         } else if (strcmp(label, "NDF") == 0) {
                             value = parse_expr(cp, 1);
                             cp = value->cp;
                             ok = eval_undefined(value);
+                            replay_note_defined(value);
                             delete (value);
                         } else if (strcmp(label, "B") == 0) {
                             char           *thing;
@@ -763,28 +980,29 @@ static int assemble(
                         } else {
                             int             sword;
                             unsigned        uword;
-                            EX_TREE        *value = parse_expr(cp, 0);
+                            EX_VALUE        value;
 
-                            cp = value->cp;
+                            cp = parse_value(cp, 0, &value);
 
-                            if (value->type != EX_LIT) {
+                            if (value.type != EXV_LIT) {
+                                replay_spoil();     /* The second pass may
+                                                       go the other way */
                                 report(stack->top, "Bad .IF expression\n");
                                 list_value(stack->top, 0);
-                                delete (value);
                                 ok = FALSE;     /* Pick something. */
                             } else {
                                 unsigned        word = 0;
 
                                 /* Convert to signed and unsigned words */
-                                sword = value->data.lit & 0x7fff;
+                                sword = value.value & 0x7fff;
 
                                 /* FIXME I don't know if the following
                                    is portable enough.  */
-                                if (value->data.lit & 0x8000)
+                                if (value.value & 0x8000)
                                     sword |= ~0xFFFF;   /* Render negative */
 
                                 /* Reduce unsigned value to 16 bits */
-                                uword = value->data.lit & 0xffff;
+                                uword = value.value & 0xffff;
 
                                 if (strcmp(label, "EQ") == 0 || strcmp(label, "Z") == 0)
                                     ok = (uword == 0), word = uword;
@@ -800,8 +1018,6 @@ static int assemble(
                                     ok = (sword <= 0), word = sword;
 
                                 list_value(stack->top, word);
-
-                                delete (value);
                             }
                         }
 
@@ -969,6 +1185,7 @@ static int assemble(
                             sym = Glb_symbol_st.lookup_sym(label);
                             if (sym) {
                                 sym->flags |= SYMBOLFLAG_GLOBAL | (op->value == P_WEAK ? SYMBOLFLAG_WEAK : 0);
+                                symbol_generation++;
                             } else
                                 sym = Glb_symbol_st.add_sym(label, 0,
                                               SYMBOLFLAG_GLOBAL | (op->value == P_WEAK ? SYMBOLFLAG_WEAK : 0),
@@ -1006,34 +1223,33 @@ static int assemble(
                 case P_BLKW:
                 case P_BLKB:
                     {
-                        EX_TREE        *value = parse_expr(cp, 0);
+                        EX_VALUE        value;
                         int             ok = 1;
 
-                        if (value->type != EX_LIT) {
+                        parse_value(cp, 0, &value);
+                        if (value.type != EXV_LIT) {
+                            replay_spoil();     /* Everything after may move */
                             report(stack->top, "Argument to .BLKB/.BLKW " "must be constant\n");
                             ok = 0;
                         } else {
                             list_value(stack->top, DOT);
-                            DOT += value->data.lit * (op->value == P_BLKW ? 2 : 1);
+                            DOT += value.value * (op->value == P_BLKW ? 2 : 1);
                             change_dot(tr, 0);
                         }
-                        delete (value);
                         return ok;
                     }
 
                 case P_ASCIZ:
                 case P_ASCII:
                     {
-                        EX_TREE        *value;
-
                         do {
                             cp = skipwhite(cp);
                             if (*cp == '<' || *cp == '^') {
                                 /* A byte value */
-                                value = parse_expr(cp+1, 0);
-                                cp = value->cp+1;
-                                store_value(stack, tr, 1, value);
-                                delete (value);
+                                EX_VALUE        value;
+
+                                cp = parse_value(cp+1, 0, &value) + 1;
+                                store_value(stack, tr, 1, &value);
                             } else {
                                 if (true) {
                                     // convert symbols in KOI-8 BK-0010 format
@@ -1122,23 +1338,22 @@ static int assemble(
 
                     case OC_MARK:
                         /* MARK, EMT, TRAP */  {
-                            EX_TREE        *value;
+                            EX_VALUE        value;
                             unsigned        word;
 
                             cp = skipwhite(cp);
                             if (*cp == '#')
                                 cp++;  /* Allow the hash, but
                                           don't require it */
-                            value = parse_expr(cp, 0);
-                            if (value->type != EX_LIT) {
+                            cp = parse_value(cp, 0, &value);
+                            if (value.type != EXV_LIT) {
                                 report(stack->top, "Instruction requires " "simple literal operand\n");
                                 word = op->value;
                             } else {
-                                word = op->value | value->data.lit;
+                                word = op->value | value.value;
                             }
 
                             store_word(stack->top, tr, 2, word);
-                            delete (value);
                         }
                         return 1;
 
@@ -1197,15 +1412,14 @@ static int assemble(
 
                     case OC_BR:
                         /* branches */  {
-                            EX_TREE        *value;
+                            EX_VALUE        value;
                             unsigned        offset;
 
-                            value = parse_expr(cp, 0);
-                            cp = value->cp;
+                            cp = parse_value(cp, 0, &value);
 
                             /* Relative PSECT or absolute? */
                             if (current_pc->section->flags & PSECT_REL) {
-                                SYMBOL         *sym;
+                                SECTION        *sect;
 
                                 /* Can't branch unless I can
                                    calculate the offset. */
@@ -1216,27 +1430,24 @@ static int assemble(
                                    expression to calculate the
                                    offset.  But I won't. */
 
-                                if (!express_sym_offset(value, &sym, &offset)
-                                    || sym->section != current_pc->section) {
+                                if (!express_value_address(&value, &sect, &offset)
+                                    || sect != current_pc->section) {
                                     report(stack->top, "Bad branch target\n");
                                     store_word(stack->top, tr, 2, op->value);
-                                    delete (value);
                                     return 0;
                                 }
 
                                 /* Compute the branch offset and
                                    check for addressability */
-                                offset += sym->value;
                                 offset -= DOT + 2;
                             } else {
-                                if (value->type != EX_LIT) {
+                                if (value.type != EXV_LIT) {
                                     report(stack->top, "Bad branch target\n");
                                     store_word(stack->top, tr, 2, op->value);
-                                    delete (value);
                                     return 0;
                                 }
 
-                                offset = value->data.lit - (DOT + 2);
+                                offset = value.value - (DOT + 2);
                             }
 
                             if (!check_branch(stack, offset, -256, 255))
@@ -1248,22 +1459,19 @@ static int assemble(
                                                    word offset */
 
                             store_word(stack->top, tr, 2, op->value | offset);
-
-                            delete (value);
                         }
                         return 1;
 
                     case OC_SOB:
                         {
-                            EX_TREE        *value;
+                            EX_VALUE        value,
+                                            target;
                             unsigned        reg;
                             unsigned        offset;
 
-                            value = parse_expr(cp, 0);
-                            cp = value->cp;
+                            cp = parse_value(cp, 0, &value);
 
-                            reg = get_register(value);
-                            delete (value);
+                            reg = get_register(&value);
                             if (reg == NO_REG) {
                                 report(stack->top, "Illegal addressing mode\n");
                                 return 0;
@@ -1275,34 +1483,30 @@ static int assemble(
                                 return 0;
                             }
 
-                            value = parse_expr(cp, 0);
-                            cp = value->cp;
+                            cp = parse_value(cp, 0, &target);
 
                             /* Relative PSECT or absolute? */
                             if (current_pc->section->flags & PSECT_REL) {
-                                SYMBOL         *sym;
+                                SECTION        *sect;
 
-                                if (!express_sym_offset(value, &sym, &offset)) {
+                                if (!express_value_address(&target, &sect, &offset)) {
                                     report(stack->top, "Bad branch target\n");
-                                    delete (value);
                                     return 0;
                                 }
                                 /* Must be same section */
-                                if (sym->section != current_pc->section) {
+                                if (sect != current_pc->section) {
                                     report(stack->top, "Bad branch target\n");
-                                    delete (value);
                                     return 0;
                                 } else {
                                     /* Calculate byte offset */
-                                    offset += DOT + 2;
-                                    offset -= sym->value;
+                                    offset = DOT + 2 - offset;
                                 }
                             } else {
-                                if (value->type != EX_LIT) {
+                                if (target.type != EXV_LIT) {
                                     report(stack->top, "Bad branch " "target\n");
                                     offset = 0;
                                 } else {
-                                    offset = DOT + 2 - value->data.lit;
+                                    offset = DOT + 2 - target.value;
                                 }
                             }
 
@@ -1313,14 +1517,13 @@ static int assemble(
                             offset >>= 1;       /* Shift to become word offset */
                             store_word(stack->top, tr, 2, op->value | offset | (reg << 6));
 
-                            delete (value);
                         }
                         return 1;
 
                     case OC_ASH:
                         /* First op is gen, second is register. */  {
                             ADDR_MODE       mode;
-                            EX_TREE        *value;
+                            EX_VALUE        value;
                             unsigned        reg;
                             unsigned        word;
 
@@ -1335,13 +1538,11 @@ static int assemble(
                                 free_addr_mode(&mode);
                                 return 0;
                             }
-                            value = parse_expr(cp, 0);
-                            cp = value->cp;
+                            cp = parse_value(cp, 0, &value);
 
-                            reg = get_register(value);
+                            reg = get_register(&value);
                             if (reg == NO_REG) {
                                 report(stack->top, "Illegal addressing mode\n");
-                                delete (value);
                                 free_addr_mode(&mode);
                                 return 0;
                             }
@@ -1350,24 +1551,21 @@ static int assemble(
                             word = op->value | mode.type | (reg << 6);
                             store_word(stack->top, tr, 2, word);
                             mode_extension(tr, &mode, stack->top);
-                            delete (value);
                         }
                         return 1;
 
                     case OC_JSR:
                         /* First op is register, second is gen. */  {
                             ADDR_MODE       mode;
-                            EX_TREE        *value;
+                            EX_VALUE        value;
                             unsigned        reg;
                             unsigned        word;
 
-                            value = parse_expr(cp, 0);
-                            cp = value->cp;
+                            cp = parse_value(cp, 0, &value);
 
-                            reg = get_register(value);
+                            reg = get_register(&value);
                             if (reg == NO_REG) {
                                 report(stack->top, "Illegal addressing mode\n");
-                                delete (value);
                                 return 0;
                             }
 
@@ -1379,39 +1577,34 @@ static int assemble(
 
                             if (!get_mode(cp, &cp, &mode)) {
                                 report(stack->top, "Illegal addressing mode\n");
-                                delete (value);
                                 return 0;
                             }
                             word = op->value | mode.type | (reg << 6);
                             store_word(stack->top, tr, 2, word);
                             mode_extension(tr, &mode, stack->top);
-                            delete (value);
                         }
                         return 1;
 
                     case OC_1REG:
                         /* One register (RTS) */  {
-                            EX_TREE        *value;
+                            EX_VALUE        value;
                             unsigned        reg;
 
-                            value = parse_expr(cp, 0);
-                            cp = value->cp;
-                            reg = get_register(value);
+                            cp = parse_value(cp, 0, &value);
+                            reg = get_register(&value);
                             if (reg == NO_REG) {
                                 report(stack->top, "Illegal addressing mode\n");
-                                delete (value);
                                 reg = 0;
                             }
 
                             store_word(stack->top, tr, 2, op->value | reg);
-                            delete (value);
                         }
                         return 1;
 
                     case OC_1FIS:
                         /* One one gen and one reg 0-3 */  {
                             ADDR_MODE       mode;
-                            EX_TREE        *value;
+                            EX_VALUE        value;
                             unsigned        reg;
                             unsigned        word;
 
@@ -1427,10 +1620,9 @@ static int assemble(
                                 return 0;
                             }
 
-                            value = parse_expr(cp, 0);
-                            cp = value->cp;
+                            cp = parse_value(cp, 0, &value);
 
-                            reg = get_register(value);
+                            reg = get_register(&value);
                             if (reg == NO_REG || reg > 4) {
                                 report(stack->top, "Invalid destination register\n");
                                 reg = 0;
@@ -1439,21 +1631,19 @@ static int assemble(
                             word = op->value | mode.type | (reg << 6);
                             store_word(stack->top, tr, 2, word);
                             mode_extension(tr, &mode, stack->top);
-                            delete (value);
                         }
                         return 1;
 
                     case OC_2FIS:
                         /* One reg 0-3 and one gen */  {
                             ADDR_MODE       mode;
-                            EX_TREE        *value;
+                            EX_VALUE        value;
                             unsigned        reg;
                             unsigned        word;
 
-                            value = parse_expr(cp, 0);
-                            cp = value->cp;
+                            cp = parse_value(cp, 0, &value);
 
-                            reg = get_register(value);
+                            reg = get_register(&value);
                             if (reg == NO_REG || reg > 4) {
                                 report(stack->top, "Illegal source register\n");
                                 reg = 0;
@@ -1462,20 +1652,17 @@ static int assemble(
                             cp = skipwhite(cp);
                             if (*cp++ != ',') {
                                 report(stack->top, "Illegal addressing mode\n");
-                                delete (value);
                                 return 0;
                             }
 
                             if (!get_mode(cp, &cp, &mode)) {
                                 report(stack->top, "Illegal addressing mode\n");
-                                delete (value);
                                 return 0;
                             }
 
                             word = op->value | mode.type | (reg << 6);
                             store_word(stack->top, tr, 2, word);
                             mode_extension(tr, &mode, stack->top);
-                            delete (value);
                         }
                         return 1;
 
@@ -1506,6 +1693,8 @@ int assemble_stack(
     int             res;
     int             errcount = 0;
 
+    expanded_lines = 0;
+
     while ((res = assemble(stack, tr)) >= 0) {
         list_flush();
         if (res == 0)
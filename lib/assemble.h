@@ -11,5 +11,6 @@
 #define DOT (current_pc->value)        /* Handy reference to the current location */
 
 int assemble_stack(STACK *stack, TEXT_RLD *tr);
+int count_expanded_lines(long count);
 
 #endif
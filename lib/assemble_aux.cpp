@@ -15,8 +15,10 @@
 #include "macros.h"
 #include "assemble.h"
 #include "listing.h"
+#include "profile.h"
 #include "symbols.h"
 #include "parse.h"
+#include "replay.h"
 
 
 /* Allocate a new section */
@@ -54,6 +56,9 @@ void change_dot(TEXT_RLD *tr, int size)
 
         /* Update for next time */
         last_dot_addr += size;
+
+        if (prof_enabled)
+            prof_bytes(size);
     }
 
     if (DOT + size > current_pc->section->size)
@@ -70,6 +75,15 @@ int store_word(STREAM *str, TEXT_RLD *tr, int size, unsigned word)
     return tr->text_word(&DOT, size, word);
 }
 
+/* store_words is store_word for a run of constant words (or bytes) */
+
+int store_words(STREAM *str, TEXT_RLD *tr, int size, const unsigned *words, int count)
+{
+    change_dot(tr, size * count);
+    list_words(str, DOT, words, count, size);
+    return tr->text_words(&DOT, size, words, count);
+}
+
 /* store_word stores a word to the object file and lists it to the
    listing file */
 
@@ -115,6 +129,33 @@ static int store_psect_offset_word(STREAM *str, TEXT_RLD *tr, int size, unsigned
     return tr->text_psect_offset_word(&DOT, size, word, name);
 }
 
+/* store_forward stands in, in the first pass of one-pass mode, for
+   storing a word the pass can't know yet: the line is marked to be
+   assembled again at the end, and a zero stored meanwhile.  Returns
+   FALSE, storing nothing, otherwise. */
+
+static int store_forward(STREAM *str, TEXT_RLD *tr, int size)
+{
+    if (pass || !replay_onepass)
+        return 0;
+
+    replay_fixup();
+    store_word(str, tr, size, 0);
+    return 1;
+}
+
+/* forward_ref tells whether a value express_sym_offset found to be
+   sym plus an offset may yet be defined, or defined otherwise, later
+   in the first pass */
+
+static int forward_ref(EX_TREE *value, SYMBOL *sym)
+{
+    if (value->type == EX_ADD || value->type == EX_SUB)
+        value = value->data.child.left;
+    return value->type == EX_UNDEFINED_SYM ||
+        (sym->flags & (SYMBOLFLAG_GLOBAL | SYMBOLFLAG_DEFINITION)) == SYMBOLFLAG_GLOBAL;
+}
+
 int store_limits(STREAM *str, TEXT_RLD *tr)
 {
     change_dot(tr, 4);
@@ -152,6 +193,17 @@ unsigned get_register(EX_TREE *expr)
     return NO_REG;
 }
 
+unsigned get_register(EX_VALUE *value)
+{
+    if (value->type == EXV_LIT && value->value <= 7)
+        return value->value;
+
+    if (value->type == EXV_SYM && value->sym->section->type == SECTION_REGISTER)
+        return value->sym->value;
+
+    return NO_REG;
+}
+
 
 /*
   implicit_gbl is a self-recursive routine that adds undefined symbols
@@ -258,6 +310,43 @@ int express_sym_offset(EX_TREE *value, SYMBOL **sym, unsigned *offset)
     return 0;
 }
 
+/* express_value_address - given an EX_VALUE, produce the section
+   and the address within it that the value refers to.  Used for
+   branch targets.  Returns FALSE for anything not relocatable. */
+
+int express_value_address(EX_VALUE *value, SECTION **section, unsigned *addr)
+{
+    SYMBOL         *sym;
+    unsigned        offset;
+
+    switch (value->type) {
+    case EXV_SYM:
+        *section = value->sym->section;
+        *addr = value->sym->value;
+        return 1;
+
+    case EXV_SYM_OFFSET:
+        *section = value->sym->section;
+        *addr = value->sym->value + value->value;
+        return 1;
+
+    case EXV_TEMP:
+        *section = value->section;
+        *addr = value->value;
+        return 1;
+
+    case EXV_COMPLEX:
+        if (!express_sym_offset(value->tree, &sym, &offset))
+            return 0;
+        *section = sym->section;
+        *addr = sym->value + offset;
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
 /*
   Translate an EX_TREE into a TEXT_COMPLEX suitable for encoding
   into the object file. */
@@ -353,10 +442,14 @@ static void store_complex(STREAM *refstr, TEXT_RLD *tr, int size, EX_TREE *value
 {
     TEXT_COMPLEX    tx;
 
-    change_dot(tr, size);              /* About to store - update DOT */
-
     implicit_gbl(value);               /* Turn undefined symbols into globals */
 
+    /* The sectors aren't assigned until the first pass is over */
+    if (store_forward(refstr, tr, size))
+        return;
+
+    change_dot(tr, size);              /* About to store - update DOT */
+
     tx.text_complex_begin();           /* Open complex expression */
 
     if (!complex_tree(&tx, value)) {   /* Translate */
@@ -375,10 +468,13 @@ static void store_complex_displaced(STREAM *refstr, TEXT_RLD *tr, int size, EX_T
 {
     TEXT_COMPLEX    tx;
 
-    change_dot(tr, size);
-
     implicit_gbl(value);               /* Turn undefined symbols into globals */
 
+    if (store_forward(refstr, tr, size))
+        return;
+
+    change_dot(tr, size);
+
     tx.text_complex_begin();
 
     if (!complex_tree(&tx, value)) {
@@ -415,7 +511,9 @@ void mode_extension(TEXT_RLD *tr, ADDR_MODE *mode, STREAM *str)
                                                            known
                                                            value. */
     } else if (express_sym_offset(value, &sym, &offset)) {
-        if ((sym->flags & (SYMBOLFLAG_GLOBAL | SYMBOLFLAG_DEFINITION)) == SYMBOLFLAG_GLOBAL) {
+        if (forward_ref(value, sym) && store_forward(str, tr, 2)) {
+            /* To be stored at the end */
+        } else if ((sym->flags & (SYMBOLFLAG_GLOBAL | SYMBOLFLAG_DEFINITION)) == SYMBOLFLAG_GLOBAL) {
             /* Reference to a global symbol. */
             /* Global symbol plus offset */
             if (mode->rel)
@@ -546,6 +644,8 @@ void store_value(STACK *stack, TEXT_RLD *tr, int size, EX_TREE *value)
         store_word(stack->top, tr, size, value->data.lit);
     } else if (!express_sym_offset(value, &sym, &offset)) {
         store_complex(stack->top, tr, size, value);
+    } else if (forward_ref(value, sym) && store_forward(stack->top, tr, size)) {
+        /* To be stored at the end */
     } else {
         if ((sym->flags & (SYMBOLFLAG_GLOBAL | SYMBOLFLAG_DEFINITION)) == SYMBOLFLAG_GLOBAL) {
             store_global_offset_word(stack->top, tr, size, sym->value + offset, sym->label);
@@ -557,6 +657,48 @@ void store_value(STACK *stack, TEXT_RLD *tr, int size, EX_TREE *value)
     }
 }
 
+/* store_value - the same, for an already evaluated EX_VALUE. */
+
+void store_value(STACK *stack, TEXT_RLD *tr, int size, EX_VALUE *value)
+{
+    switch (value->type) {
+    case EXV_LIT:
+        store_word(stack->top, tr, size, value->value);
+        break;
+
+    case EXV_SYM:
+    case EXV_SYM_OFFSET:
+        {
+            SYMBOL         *sym = value->sym;
+            unsigned        offset = value->type == EXV_SYM ? 0 : value->value;
+
+            if ((sym->flags & (SYMBOLFLAG_GLOBAL | SYMBOLFLAG_DEFINITION)) == SYMBOLFLAG_GLOBAL &&
+                store_forward(stack->top, tr, size)) {
+                /* To be stored at the end */
+            } else if ((sym->flags & (SYMBOLFLAG_GLOBAL | SYMBOLFLAG_DEFINITION)) == SYMBOLFLAG_GLOBAL) {
+                store_global_offset_word(stack->top, tr, size, sym->value + offset, sym->label);
+            } else if (sym->section != current_pc->section) {
+                store_psect_offset_word(stack->top, tr, size, sym->value + offset, sym->section->label);
+            } else {
+                store_internal_word(stack->top, tr, size, sym->value + offset);
+            }
+        }
+        break;
+
+    case EXV_TEMP:
+        if (value->section != current_pc->section) {
+            store_psect_offset_word(stack->top, tr, size, value->value, value->section->label);
+        } else {
+            store_internal_word(stack->top, tr, size, value->value);
+        }
+        break;
+
+    default:
+        store_value(stack, tr, size, value->tree);
+        break;
+    }
+}
+
 /* do_word - used by .WORD, .BYTE, and implied .WORD. */
 
 int do_word(STACK *stack, TEXT_RLD *tr, char *cp, int size)
@@ -567,13 +709,29 @@ int do_word(STACK *stack, TEXT_RLD *tr, char *cp, int size)
     }
 
     do {
-        EX_TREE *value = parse_expr(cp, 0);
+        EX_VALUE        value;
+        unsigned        words[64];
+        int             nwords = 0;
+        char           *endcp;
+
+        /* Plain numbers are gathered up and stored as a run */
+        while ((endcp = parse_literal(cp, &words[nwords])) != NULL) {
+            cp = skipdelim(endcp);
+            if (++nwords == 64 || (cp = skipdelim(cp), EOL(*cp)))
+                break;
+        }
+
+        if (nwords > 0) {
+            store_words(stack->top, tr, size, words, nwords);
+            if (endcp != NULL)
+                continue;              /* Nothing else in this run */
+        }
 
-        store_value(stack, tr, size, value);
+        cp = parse_value(cp, 0, &value);
 
-        cp = skipdelim(value->cp);
+        store_value(stack, tr, size, &value);
 
-        delete (value);
+        cp = skipdelim(cp);
     } while (cp = skipdelim(cp), !EOL(*cp));
 
     return 1;
@@ -604,9 +762,10 @@ int check_branch(STACK *stack, unsigned offset, int min, int max)
 }
 
 
-/* write_globals writes out the GSD prior to the second assembly pass */
+/* write_globals writes out the GSD prior to the second assembly
+   pass, to obj or to mem */
 
-void write_globals(FILE *obj)
+void write_globals(FILE *obj, BUFFER *mem)
 {
     GSD             gsd;
     SYMBOL         *sym;
@@ -614,10 +773,10 @@ void write_globals(FILE *obj)
     SYMBOL_ITER     sym_iter;
     int             isect;
 
-    if (obj == NULL)
+    if (obj == NULL && mem == NULL)
         return;                        /* Nothing to do if no OBJ file. */
 
-    gsd.gsd_init(obj);
+    gsd.gsd_init(obj, mem);
 
     gsd.gsd_mod(module_name);
 
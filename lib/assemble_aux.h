@@ -23,12 +23,15 @@ void      push_cond(int ok, STREAM *str);
 void      pop_cond(int to);
 
 int       express_sym_offset(EX_TREE *value, SYMBOL **sym, unsigned *offset);
+int       express_value_address(EX_VALUE *value, SECTION **section, unsigned *addr);
 
 void      change_dot(TEXT_RLD *tr, int size);
 
 int       store_word(STREAM *str, TEXT_RLD *tr, int size, unsigned word);
+int       store_words(STREAM *str, TEXT_RLD *tr, int size, const unsigned *words, int count);
 int       store_limits(STREAM *str, TEXT_RLD *tr);
 void      store_value(STACK *stack, TEXT_RLD *tr, int size, EX_TREE *value);
+void      store_value(STACK *stack, TEXT_RLD *tr, int size, EX_VALUE *value);
 
 int       do_word(STACK *stack, TEXT_RLD *tr, char *cp, int size);
 
@@ -43,8 +46,9 @@ int       eval_undefined(EX_TREE *value);
 void      mode_extension(TEXT_RLD *tr, ADDR_MODE *mode, STREAM *str);
 int       check_branch(STACK *stack, unsigned offset, int min, int max);
 unsigned  get_register(EX_TREE *expr);
+unsigned  get_register(EX_VALUE *value);
 
-void      write_globals(FILE *obj);
+void      write_globals(FILE *obj, BUFFER *mem = NULL);
 void      migrate_implicit(void);
 
 #endif
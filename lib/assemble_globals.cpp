@@ -8,94 +8,110 @@
 
 
 /* GLOBAL VARIABLES */
-int             pass = 0;       /* The current assembly pass.  0 = first pass */
-int             stmtno = 0;     /* The current source line number */
-int             radix = 8;      /* The current input conversion radix */
+THREAD_LOCAL int             pass = 0;       /* The current assembly pass.  0 = first pass */
+THREAD_LOCAL int             stmtno = 0;     /* The current source line number */
+THREAD_LOCAL int             radix = 8;      /* The current input conversion radix */
 
 
-int             lsb = 0;        /* The current local symbol section identifier */
-int             last_lsb = 0;   /* The last block in which a macro
+THREAD_LOCAL int             lsb = 0;        /* The current local symbol section identifier */
+THREAD_LOCAL int             last_lsb = 0;   /* The last block in which a macro
                                    automatic label was created */
 
-int             last_locsym = 32768;    /* The last local symbol number generated */
+THREAD_LOCAL int             last_locsym = 32768;    /* The last local symbol number generated */
 
 
-int             enabl_debug = 0;        /* Whether assembler debugging is enabled */
+THREAD_LOCAL int             enabl_debug = 0;        /* Whether assembler debugging is enabled */
 
-int             enabl_ama = 0;  /* When set, chooses absolute (037) versus
+THREAD_LOCAL int             show_stats = 0; /* Print assembler statistics at the end */
+THREAD_LOCAL int             show_mcall = 0; /* Tell where .MCALLed macros come from */
+
+THREAD_LOCAL int             max_expand_depth = 1000;        /* Most macros, .REPTs etc. nested
+                                                   in each other, or 0 */
+THREAD_LOCAL long            max_expand_lines = 10000000L;   /* Most lines all expansions may
+                                                   produce in a pass, or 0 */
+THREAD_LOCAL long            max_expand_bytes = 64L * 1024 * 1024;   /* Most bytes of expanded
+                                                           text held at once, or 0 */
+
+THREAD_LOCAL int             enabl_ama = 0;  /* When set, chooses absolute (037) versus
                                    PC-relative */
 /* (067) addressing mode */
-int             enabl_lsb = 0;  /* When set, stops non-local symbol
+THREAD_LOCAL int             enabl_lsb = 0;  /* When set, stops non-local symbol
                                    definitions from delimiting local
                                    symbol sections. */
 
-int             enabl_gbl = 1;  /* Implicit definition of global symbols */
+THREAD_LOCAL int             enabl_gbl = 1;  /* Implicit definition of global symbols */
 
-int             disable_rad50_symbols = 1; /* Write full symbol name into .OBJ instead of RAD50 encoding */
+THREAD_LOCAL int             disable_rad50_symbols = 1; /* Write full symbol name into .OBJ instead of RAD50 encoding */
 
-int             enabl_internal_sym = 1;    /* Store internal symbols into .OBJ */
+THREAD_LOCAL int             enabl_internal_sym = 1;    /* Store internal symbols into .OBJ */
 
-int             symbols_to_upper = 0;  /* Convert all symbols to upper case */
+THREAD_LOCAL int             symbols_to_upper = 0;  /* Convert all symbols to upper case */
 
-int             suppressed = 0; /* Assembly suppressed by failed conditional */
+THREAD_LOCAL int             suppressed = 0; /* Assembly suppressed by failed conditional */
 
 
-MLB            *mlbs[MAX_MLBS]; /* macro libraries specified on the
+THREAD_LOCAL MLB            *mlbs[MAX_MLBS]; /* macro libraries specified on the
                                    command line */
-int             nr_mlbs = 0;    /* Number of macro libraries */
+THREAD_LOCAL int             nr_mlbs = 0;    /* Number of macro libraries */
 
-COND            conds[MAX_CONDS];       /* Stack of recent conditions */
-int             last_cond;      /* 0 means no stacked cond. */
+THREAD_LOCAL SOURCE_HOOK     source_hook = NULL;     /* Where sources come from, if set */
+THREAD_LOCAL void           *source_arg = NULL;      /* Passed to it */
 
-SECTION        *sect_stack[32]; /* 32 saved sections */
-int             sect_sp;        /* Stack pointer */
+THREAD_LOCAL COND            conds[MAX_CONDS];       /* Stack of recent conditions */
+THREAD_LOCAL int             last_cond;      /* 0 means no stacked cond. */
 
-char           *module_name = NULL;     /* The module name (taken from the 'TITLE'); */
+THREAD_LOCAL SECTION        *sect_stack[32]; /* 32 saved sections */
+THREAD_LOCAL int             sect_sp;        /* Stack pointer */
 
-char           *ident = NULL;   /* .IDENT name */
+THREAD_LOCAL char           *module_name = NULL;     /* The module name (taken from the 'TITLE'); */
 
-EX_TREE        *xfer_address = NULL;    /* The transfer address */
+THREAD_LOCAL char           *ident = NULL;   /* .IDENT name */
 
-SYMBOL         *current_pc;     /* The current program counter */
+THREAD_LOCAL EX_TREE        *xfer_address = NULL;    /* The transfer address */
 
-unsigned        last_dot_addr;  /* Last coded PC... */
-SECTION        *last_dot_section;       /* ...and it's program section */
+THREAD_LOCAL SYMBOL         *current_pc;     /* The current program counter */
+
+THREAD_LOCAL unsigned        last_dot_addr;  /* Last coded PC... */
+THREAD_LOCAL SECTION        *last_dot_section;       /* ...and it's program section */
 
 /* The following are dummy psects for symbols which have meaning to
 the assembler: */
 
-SECTION         register_section = {
+THREAD_LOCAL SECTION         register_section = {
     "", SECTION_REGISTER, 0, 0
 };                                     /* the section containing the registers */
 
-SECTION         pseudo_section = {
+THREAD_LOCAL SECTION         pseudo_section = {
     "", SECTION_PSEUDO, 0, 0
 };                                     /* the section containing the
                                           pseudo-operations */
 
-SECTION         instruction_section = {
+THREAD_LOCAL SECTION         instruction_section = {
     ". ABS.", SECTION_INSTRUCTION, 0, 0
 };                                     /* the section containing instructions */
 
-SECTION         macro_section = {
+THREAD_LOCAL SECTION         macro_section = {
     "", SECTION_SYSTEM, 0, 0, 0
 };                                     /* Section for macros */
 
 /* These are real psects that get written out to the object file */
 
-SECTION         absolute_section = {
+THREAD_LOCAL SECTION         absolute_section = {
     ". ABS.", SECTION_SYSTEM, PSECT_GBL | PSECT_COM, 0, 0, 0
 };                                     /* The default
                                           absolute section */
 
-SECTION         blank_section = {
+THREAD_LOCAL SECTION         blank_section = {
     "", SECTION_SYSTEM, PSECT_REL, 0, 0, 1
 };                                     /* The default relocatable section */
 
-SECTION        *sections[256] = {
+/* thread_local, as the first two are addresses only known when the
+   thread starts */
+
+thread_local SECTION *sections[256] = {
     /* Array of sections in the order they were
        defined */
     &absolute_section, &blank_section,
 };
 
-int             sector = 2;     /* number of such sections */
+THREAD_LOCAL int             sector = 2;     /* number of such sections */
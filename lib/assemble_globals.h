@@ -20,67 +20,96 @@ typedef struct cond {
     int             line;
 } COND;
 
+/* A source hook stands in for the file system: it gives the text of
+   an .INCLUDE file (kind SOURCE_INCLUDE, name the file name) or of a
+   macro .MCALL didn't find in a library (SOURCE_MCALL, name the
+   macro's).  It returns NULL if there's none; the text is copied
+   before the hook is called again. */
+
+#define SOURCE_INCLUDE 1
+#define SOURCE_MCALL 2
+
+typedef const char *(*SOURCE_HOOK)(void *arg, int kind, const char *name, int *length);
+
+
+/* The assembler's state is these globals, and those of the other
+   modules; it isn't in an object passed around, and each function
+   reads what it needs directly.  They are THREAD_LOCAL, so each
+   thread has its own set and can run one assembly at a time. */
 
 #ifndef ASSEMBLE_GLOBALS__C
 /* GLOBAL VARIABLES */
-extern int      pass;           /* The current assembly pass.  0 = first pass */
-extern int      stmtno;         /* The current source line number */
-extern int      radix;          /* The current input conversion radix */
-extern int      lsb;            /* The current local symbol section identifier */
-extern int      last_lsb;       /* The last block in which a macro
+extern THREAD_LOCAL int      pass;           /* The current assembly pass.  0 = first pass */
+extern THREAD_LOCAL int      stmtno;         /* The current source line number */
+extern THREAD_LOCAL int      radix;          /* The current input conversion radix */
+extern THREAD_LOCAL int      lsb;            /* The current local symbol section identifier */
+extern THREAD_LOCAL int      last_lsb;       /* The last block in which a macro
                                    automatic label was created */
 
-extern int      last_locsym;    /* The last local symbol number generated */
+extern THREAD_LOCAL int      last_locsym;    /* The last local symbol number generated */
 
-extern int      enabl_debug;    /* Whether assembler debugging is enabled */
+extern THREAD_LOCAL int      enabl_debug;    /* Whether assembler debugging is enabled */
 
-extern int      enabl_ama;      /* When set, chooses absolute (037) versus
+extern THREAD_LOCAL int      show_stats;     /* Print assembler statistics at the end */
+extern THREAD_LOCAL int      show_mcall;     /* Tell where .MCALLed macros come from */
+
+extern THREAD_LOCAL int      max_expand_depth;       /* Most macros, .REPTs etc. nested
+                                           in each other, or 0 */
+extern THREAD_LOCAL long     max_expand_lines;       /* Most lines all expansions may
+                                           produce in a pass, or 0 */
+extern THREAD_LOCAL long     max_expand_bytes;       /* Most bytes of expanded text
+                                           held at once, or 0 */
+
+extern THREAD_LOCAL int      enabl_ama;      /* When set, chooses absolute (037) versus
                                    PC-relative */
 /* (067) addressing mode */
-extern int      enabl_lsb;      /* When set, stops non-local symbol
+extern THREAD_LOCAL int      enabl_lsb;      /* When set, stops non-local symbol
                                    definitions from delimiting local
                                    symbol sections. */
 
-extern int      enabl_gbl;      /* Implicit definition of global symbols */
+extern THREAD_LOCAL int      enabl_gbl;      /* Implicit definition of global symbols */
+
+extern THREAD_LOCAL int      disable_rad50_symbols;  /* Write full symbol name into .OBJ instead of RAD50 encoding */
+extern THREAD_LOCAL int      enabl_internal_sym;     /* Store internal symbols into .OBJ */
+extern THREAD_LOCAL int      symbols_to_upper;  /* Convert all symbols to upper case */
 
-extern int      disable_rad50_symbols;  /* Write full symbol name into .OBJ instead of RAD50 encoding */
-extern int      enabl_internal_sym;     /* Store internal symbols into .OBJ */
-extern int      symbols_to_upper;  /* Convert all symbols to upper case */
+extern THREAD_LOCAL int      suppressed;     /* Assembly suppressed by failed conditional */
 
-extern int      suppressed;     /* Assembly suppressed by failed conditional */
+extern THREAD_LOCAL MLB     *mlbs[MAX_MLBS]; /* macro libraries specified on the command line */
+extern THREAD_LOCAL int      nr_mlbs;        /* Number of macro libraries */
 
-extern MLB     *mlbs[MAX_MLBS]; /* macro libraries specified on the command line */
-extern int      nr_mlbs;        /* Number of macro libraries */
+extern THREAD_LOCAL SOURCE_HOOK source_hook;    /* Where sources come from, if set */
+extern THREAD_LOCAL void    *source_arg;     /* Passed to it */
 
-extern COND     conds[MAX_CONDS];       /* Stack of recent conditions */
-extern int      last_cond;      /* 0 means no stacked cond. */
+extern THREAD_LOCAL COND     conds[MAX_CONDS];       /* Stack of recent conditions */
+extern THREAD_LOCAL int      last_cond;      /* 0 means no stacked cond. */
 
-extern SECTION *sect_stack[32]; /* 32 saved sections */
-extern int      sect_sp;        /* Stack pointer */
+extern THREAD_LOCAL SECTION *sect_stack[32]; /* 32 saved sections */
+extern THREAD_LOCAL int      sect_sp;        /* Stack pointer */
 
-extern char    *module_name;    /* The module name (taken from the 'TITLE'); */
+extern THREAD_LOCAL char    *module_name;    /* The module name (taken from the 'TITLE'); */
 
-extern char    *ident;          /* .IDENT name */
+extern THREAD_LOCAL char    *ident;          /* .IDENT name */
 
-extern EX_TREE *xfer_address;   /* The transfer address */
+extern THREAD_LOCAL EX_TREE *xfer_address;   /* The transfer address */
 
-extern SYMBOL  *current_pc;     /* The current program counter */
+extern THREAD_LOCAL SYMBOL  *current_pc;     /* The current program counter */
 
-extern unsigned last_dot_addr;  /* Last coded PC... */
-extern SECTION *last_dot_section;       /* ...and it's program section */
+extern THREAD_LOCAL unsigned last_dot_addr;  /* Last coded PC... */
+extern THREAD_LOCAL SECTION *last_dot_section;       /* ...and it's program section */
 
 /* The following are dummy psects for symbols which have meaning to
    the assembler: */
-extern SECTION  register_section;
-extern SECTION  pseudo_section; /* the section containing the  pseudo-operations */
-extern SECTION  instruction_section;    /* the section containing instructions */
-extern SECTION  macro_section;  /* Section for macros */
+extern THREAD_LOCAL SECTION  register_section;
+extern THREAD_LOCAL SECTION  pseudo_section; /* the section containing the  pseudo-operations */
+extern THREAD_LOCAL SECTION  instruction_section;    /* the section containing instructions */
+extern THREAD_LOCAL SECTION  macro_section;  /* Section for macros */
 
 /* These are real psects that get written out to the object file */
-extern SECTION  absolute_section;       /* The default  absolute section */
-extern SECTION  blank_section;
-extern SECTION *sections[256];  /* Array of sections in the order they were defined */
-extern int      sector;         /* number of such sections */
+extern THREAD_LOCAL SECTION  absolute_section;       /* The default  absolute section */
+extern THREAD_LOCAL SECTION  blank_section;
+extern thread_local SECTION *sections[256];  /* Array of sections in the order they were defined */
+extern THREAD_LOCAL int      sector;         /* number of such sections */
 
 #endif
 
@@ -0,0 +1,337 @@
+#define ASSEMBLE_MEM__C
+
+/*
+        Assembling in memory
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <system_error>
+#include <thread>
+
+#include "assemble_mem.h"              /* my own definitions */
+
+#include "util.h"
+#include "assemble_module.h"
+#include "listing.h"
+#include "mcall.h"
+#include "stream2.h"
+
+
+/* The source, for push_text */
+
+struct SOURCE_TEXT {
+    const char     *name;
+    const char     *text;
+    int             length;
+};
+
+/* The settings an assembly starts with: the -e, -d, -ysl and like
+   options, and what the source may change.  The state of an assembly
+   is this thread's globals, which everything reads directly, so one
+   can't begin on a thread until the last one there has finished;
+   an assembly begun from a source hook runs on a thread of its own,
+   with these copied over.  The libraries, path and cache directory
+   are only borrowed, since this thread waits meanwhile.  The profiler
+   isn't set: it profiles the assembly that called the hook. */
+
+typedef struct assemble_settings {
+    int             radix;
+    int             enabl_ama;
+    int             enabl_lsb;
+    int             enabl_gbl;
+    int             disable_rad50_symbols;
+    int             enabl_internal_sym;
+    int             symbols_to_upper;
+    int             enabl_debug;
+    int             show_stats;
+    int             show_mcall;
+    int             max_expand_depth;
+    long            max_expand_lines;
+    long            max_expand_bytes;
+    int             list_md;
+    int             list_me;
+    int             list_bex;
+    int             list_level;
+    int             symbol_len;
+    int             symbol_allow_underscores;
+    MLB            *mlbs[MAX_MLBS];
+    int             nr_mlbs;
+    char           *mcall_path;
+    char           *mcall_cache_dir;
+} ASSEMBLE_SETTINGS;
+
+/* An assembly to run on a thread of its own */
+
+typedef struct nested_job {
+    const char     *name;
+    const char     *text;
+    int             length;
+    int             list;
+    SOURCE_HOOK     hook;
+    void           *arg;
+    ASSEMBLE_RESULT *result;
+    ASSEMBLE_SETTINGS settings;
+} NESTED_JOB;
+
+static THREAD_LOCAL ASSEMBLE_RESULT *collecting;       /* Where errors go */
+static THREAD_LOCAL ASSEMBLE_SETTINGS *started_with;   /* And how that began */
+
+/* get_settings copies this thread's settings into settings */
+
+static void get_settings(
+    ASSEMBLE_SETTINGS *settings)
+{
+    settings->radix = radix;
+    settings->enabl_ama = enabl_ama;
+    settings->enabl_lsb = enabl_lsb;
+    settings->enabl_gbl = enabl_gbl;
+    settings->disable_rad50_symbols = disable_rad50_symbols;
+    settings->enabl_internal_sym = enabl_internal_sym;
+    settings->symbols_to_upper = symbols_to_upper;
+    settings->enabl_debug = enabl_debug;
+    settings->show_stats = show_stats;
+    settings->show_mcall = show_mcall;
+    settings->max_expand_depth = max_expand_depth;
+    settings->max_expand_lines = max_expand_lines;
+    settings->max_expand_bytes = max_expand_bytes;
+    settings->list_md = list_md;
+    settings->list_me = list_me;
+    settings->list_bex = list_bex;
+    settings->list_level = list_level;
+    settings->symbol_len = Glb_symbol_len;
+    settings->symbol_allow_underscores = Glb_symbol_allow_underscores;
+    memcpy(settings->mlbs, mlbs, sizeof(mlbs));
+    settings->nr_mlbs = nr_mlbs;
+    settings->mcall_path = mcall_path;
+    settings->mcall_cache_dir = mcall_cache_dir;
+}
+
+/* put_settings makes settings this thread's */
+
+static void put_settings(
+    const ASSEMBLE_SETTINGS *settings)
+{
+    radix = settings->radix;
+    enabl_ama = settings->enabl_ama;
+    enabl_lsb = settings->enabl_lsb;
+    enabl_gbl = settings->enabl_gbl;
+    disable_rad50_symbols = settings->disable_rad50_symbols;
+    enabl_internal_sym = settings->enabl_internal_sym;
+    symbols_to_upper = settings->symbols_to_upper;
+    enabl_debug = settings->enabl_debug;
+    show_stats = settings->show_stats;
+    show_mcall = settings->show_mcall;
+    max_expand_depth = settings->max_expand_depth;
+    max_expand_lines = settings->max_expand_lines;
+    max_expand_bytes = settings->max_expand_bytes;
+    list_md = settings->list_md;
+    list_me = settings->list_me;
+    list_bex = settings->list_bex;
+    list_level = settings->list_level;
+    Glb_symbol_len = settings->symbol_len;
+    Glb_symbol_allow_underscores = settings->symbol_allow_underscores;
+    memcpy(mlbs, settings->mlbs, sizeof(mlbs));
+    nr_mlbs = settings->nr_mlbs;
+    mcall_path = settings->mcall_path;
+    mcall_cache_dir = settings->mcall_cache_dir;
+}
+
+/* push_text pushes the source text onto the input stream */
+
+static void push_text(
+    STACK *stack,
+    void *arg)
+{
+    SOURCE_TEXT    *src = (SOURCE_TEXT *) arg;
+    FILE_STREAM    *str = new FILE_STREAM;
+
+    str->init_text(src->name, src->text, src->length);
+    stack->push(str);
+}
+
+/* add_diag adds an error to a result */
+
+static void add_diag(
+    ASSEMBLE_RESULT *result,
+    const char *name,
+    int line,
+    const char *message)
+{
+    ASSEMBLE_DIAG  *diag;
+    int             len = (int) strlen(message);
+
+    if (len > 0 && message[len - 1] == '\n')
+        len--;
+
+    /* The array doubles whenever it's full: at each power of two */
+    if ((result->nr_diags & (result->nr_diags - 1)) == 0)
+        result->diags = (ASSEMBLE_DIAG *) memcheck(realloc(result->diags,
+                                                           (result->nr_diags * 2 + 1) * sizeof(ASSEMBLE_DIAG)));
+    diag = &result->diags[result->nr_diags++];
+    diag->name = (char *) memcheck(strdup(name));
+    diag->line = line;
+    diag->message = (char *) memcheck(malloc(len + 1));
+    memcpy(diag->message, message, len);
+    diag->message[len] = 0;
+}
+
+/* collect_diag is the report hook: it adds an error to the result */
+
+static void collect_diag(
+    const char *name,
+    int line,
+    const char *message)
+{
+    add_diag(collecting, name, line, message);
+}
+
+/* take_text takes the text out of a buffer, and frees it */
+
+static char *take_text(
+    BUFFER *buf,
+    int *length)
+{
+    char           *text = buf->buffer;
+
+    *length = buf->length;
+    buf->buffer = NULL;
+    buffer_free(buf);
+    return text;
+}
+
+/* nested_worker runs an assembly begun from a source hook, with the
+   settings of the one that called the hook.  What it borrowed it
+   gives back, for this thread's end mustn't free it. */
+
+static void nested_worker(
+    NESTED_JOB *job)
+{
+    put_settings(&job->settings);
+    assemble_mem(job->name, job->text, job->length, job->list, job->hook, job->arg, job->result);
+    mcall_path = NULL;
+    mcall_cache_dir = NULL;
+    nr_mlbs = 0;
+}
+
+/* assemble_nested runs an assembly begun from a source hook on a
+   thread of its own, and waits for it */
+
+static int assemble_nested(
+    const char *name,
+    const char *text,
+    int length,
+    int list,
+    SOURCE_HOOK hook,
+    void *arg,
+    ASSEMBLE_RESULT *result)
+{
+    NESTED_JOB      job;
+
+    job.name = name;
+    job.text = text;
+    job.length = length;
+    job.list = list;
+    job.hook = hook;
+    job.arg = arg;
+    job.result = result;
+    job.settings = *started_with;
+
+    try {
+        std::thread(nested_worker, &job).join();
+    } catch (const std::system_error &) {
+        memset(result, 0, sizeof(ASSEMBLE_RESULT));
+        add_diag(result, name, 0, "Can't start a thread to assemble it");
+        result->errors = 1;
+    }
+    return result->errors;
+}
+
+/* assemble_mem assembles length bytes of source text, named name,
+   into result, which it fills in from scratch.  With list, it makes a
+   listing as well.  hook, if not NULL, gives the .INCLUDE files and the macros
+   to .MCALL, and is passed arg.  Called from a hook, it assembles on
+   another thread.  Returns the number of errors. */
+
+int assemble_mem(
+    const char *name,
+    const char *text,
+    int length,
+    int list,
+    SOURCE_HOOK hook,
+    void *arg,
+    ASSEMBLE_RESULT *result)
+{
+    SOURCE_TEXT     src;
+    BUFFER         *obj;
+    BUFFER         *lst;
+
+    /* What the source may change, or this replaces */
+    ASSEMBLE_SETTINGS settings;
+    FILE           *save_lstfile = lstfile;
+    BUFFER         *save_lstbuf = lstbuf;
+    SOURCE_HOOK     save_hook = source_hook;
+    void           *save_arg = source_arg;
+    void            (*save_report)(const char *name, int line, const char *message) = report_hook;
+
+    if (collecting != NULL)
+        return assemble_nested(name, text, length, list, hook, arg, result);
+
+    get_settings(&settings);
+    obj = new BUFFER();
+    lst = list ? new BUFFER() : NULL;
+
+    memset(result, 0, sizeof(ASSEMBLE_RESULT));
+
+    src.name = name;
+    src.text = text;
+    src.length = length;
+
+    lstfile = NULL;
+    lstbuf = lst;
+    source_hook = hook;
+    source_arg = arg;
+    report_hook = collect_diag;
+    collecting = result;
+    started_with = &settings;
+
+    assemble_module(push_text, &src, NULL, obj, TRUE, FALSE);
+    result->errors = error_count;
+    assemble_free();
+
+    put_settings(&settings);
+    lstfile = save_lstfile;
+    lstbuf = save_lstbuf;
+    source_hook = save_hook;
+    source_arg = save_arg;
+    report_hook = save_report;
+    collecting = NULL;
+    started_with = NULL;
+
+    result->object = take_text(obj, &result->object_length);
+    if (lst != NULL) {
+        lst->buffer_appendn((char *) "", 1);
+        result->listing = take_text(lst, &result->listing_length);
+        result->listing_length--;      /* Not counting the zero */
+    }
+
+    return result->errors;
+}
+
+/* assemble_mem_free frees what assemble_mem put in a result */
+
+void assemble_mem_free(
+    ASSEMBLE_RESULT *result)
+{
+    int             i;
+
+    free(result->object);
+    free(result->listing);
+    for (i = 0; i < result->nr_diags; i++) {
+        free(result->diags[i].name);
+        free(result->diags[i].message);
+    }
+    free(result->diags);
+    memset(result, 0, sizeof(ASSEMBLE_RESULT));
+}
@@ -0,0 +1,37 @@
+#ifndef ASSEMBLE_MEM__H
+#define ASSEMBLE_MEM__H
+
+/* Assembling in memory: source text in, object module, listing and
+   errors out, with no files.  .INCLUDE files, and macros .MCALL
+   doesn't find in the -m libraries, come from a source hook (see
+   assemble_globals.h).  The assembler's state is per-thread
+   globals, so threads may assemble at once; the settings (-e, -d,
+   -ysl and the like) are those of the calling thread, and are as
+   they were afterwards.  A hook may call assemble_mem itself: that
+   assembly runs on a thread of its own, with the settings the one
+   that called the hook started with. */
+
+#include "assemble_globals.h"
+
+
+typedef struct assemble_diag {
+    char           *name;       /* The file (or macro) it's in */
+    int             line;       /* The line in it, or 0 */
+    char           *message;    /* What's wrong, without the newline */
+} ASSEMBLE_DIAG;
+
+typedef struct assemble_result {
+    char           *object;     /* The object module's records, as in a file */
+    int             object_length;
+    char           *listing;    /* The listing, terminated by a zero, or NULL */
+    int             listing_length;
+    ASSEMBLE_DIAG  *diags;      /* The errors, in order */
+    int             nr_diags;
+    int             errors;     /* How many errors were reported */
+} ASSEMBLE_RESULT;
+
+int        assemble_mem(const char *name, const char *text, int length, int list,
+                        SOURCE_HOOK hook, void *arg, ASSEMBLE_RESULT *result);
+void       assemble_mem_free(ASSEMBLE_RESULT *result);
+
+#endif
@@ -0,0 +1,184 @@
+#define ASSEMBLE_MODULE__C
+
+/*
+        Assembling a whole module
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "assemble_module.h"           /* my own definitions */
+
+#include "util.h"
+#include "assemble.h"
+#include "assemble_aux.h"
+#include "assemble_globals.h"
+#include "listing.h"
+#include "macros.h"
+#include "mcall.h"
+#include "object.h"
+#include "parse.h"
+#include "profile.h"
+#include "replay.h"
+#include "symbols.h"
+
+
+/* assemble_module assembles the source push_input pushes, writing
+   the object module to obj or, if mem isn't NULL, appending it to
+   mem; with neither, the source is only checked.  With replay the
+   second pass replays the first, unless the profiler needs it to
+   read the source, or the recording won't do; with onepass as well,
+   and no listing, the first pass's object code is kept.  Returns the
+   number of errors. */
+
+int assemble_module(
+    PUSH_INPUT push_input,
+    void *arg,
+    FILE *obj,
+    BUFFER *mem,
+    int replay,
+    int onepass)
+{
+    TEXT_RLD        tr;
+    STACK           stack;
+    BUFFER         *code = NULL;
+    int             errcount;
+
+    init_char_class();                 /* After -yus */
+    add_symbols(&blank_section);
+
+    tr.text_init(NULL, 0);
+
+    module_name = static_cast<char *>(memcheck(strdup("")));
+
+    xfer_address = new EX_TREE(1);      /* The undefined transfer address */
+
+    stack.stack_init();
+    push_input(&stack, arg);
+
+    DOT = 0;
+    current_pc->section = &blank_section;
+    last_dot_section = NULL;
+    pass = 0;
+    stmtno = 0;
+    lsb = 0;
+    last_lsb = -1;
+    last_locsym = 32767;
+    last_cond = -1;
+    sect_sp = -1;
+    suppressed = 0;
+
+    /* A listing needs a whole second pass, and so does profiling,
+       which counts the lines and bytes of the second pass */
+    if (replay) {
+        replay_start();
+        if (onepass && !lstfile && !lstbuf && !prof_enabled) {
+            if (obj != NULL || mem != NULL)
+                code = new BUFFER();
+            replay_keep_code(code);
+            tr.journal = code;         /* Keep what it stores */
+        }
+    }
+
+    assemble_stack(&stack, &tr);
+    if (code == NULL)
+        tr.text_flush();               /* A journal is played later */
+
+    assert(stack.top == NULL);
+
+    migrate_implicit();                /* Migrate the implicit globals */
+    replay = replay_stop();
+    onepass = replay && replay_onepass;
+    if (prof_enabled)
+        prof_second_pass(replay);
+    if (show_stats)
+        fprintf(stderr, "Second pass: %s\n",
+                onepass ? "fixups only" : replay ? "replayed" : "source read again");
+    write_globals(obj, mem);           /* Write the global symbol dictionary */
+
+    tr.journal = NULL;
+    tr.text_init(obj, 0, mem);
+    if (onepass)
+        tr.journal = code;             /* The lines assembled again, too */
+
+    stack.stack_init();                /* Superfluous... */
+    if (onepass) {
+        /* Assemble only the lines the first pass couldn't finish */
+        stack.push(replay_fixup_stream());
+    } else if (replay) {
+        /* Assemble what the first pass did over again */
+        stack.push(replay_stream());
+    } else {
+        /* Read the source again */
+        push_input(&stack, arg);
+    }
+
+    DOT = 0;
+    current_pc->section = &blank_section;
+    last_dot_section = NULL;
+
+    pass = 1;
+    stmtno = 0;
+    lsb = 0;
+    last_lsb = -1;
+    last_locsym = 32767;
+    pop_cond(-1);
+    sect_sp = -1;
+    suppressed = 0;
+
+    errcount = assemble_stack(&stack, &tr);
+    if (onepass) {
+        /* Then write the code, each of those lines in its place */
+        tr.journal = NULL;
+        replay_write_code(&tr);
+    }
+    replay_free();
+    buffer_free(code);
+
+    tr.text_flush();
+
+    while (last_cond >= 0) {
+        report(NULL, "%s:%d: Unterminated conditional\n", conds[last_cond].file, conds[last_cond].line);
+        pop_cond(last_cond - 1);
+        errcount++;
+    }
+
+    write_endmod(obj, mem);
+
+    return errcount;
+}
+
+/* assemble_free frees what an assembly leaves behind, its symbols,
+   macros, sections and names, so the thread can assemble another
+   module.  The settings stay as they are. */
+
+void assemble_free(void)
+{
+    int             i;
+
+    Glb_system_st.clear();
+    Glb_section_st.clear();
+    Glb_symbol_st.clear();
+    Glb_implicit_st.clear();
+    free_macros();
+    mcall_reset();
+
+    for (i = 2; i < sector; i++) {
+        free(sections[i]->label);
+        free(sections[i]);
+    }
+    sector = 2;
+    absolute_section.pc = absolute_section.size = 0;
+    blank_section.pc = blank_section.size = 0;
+
+    free(module_name);
+    module_name = NULL;
+    free(ident);
+    ident = NULL;
+    delete xfer_address;
+    xfer_address = NULL;
+    current_pc = NULL;
+
+    error_count = 0;
+}
@@ -0,0 +1,19 @@
+#ifndef ASSEMBLE_MODULE__H
+#define ASSEMBLE_MODULE__H
+
+/* Assembling a whole module: both passes, from the source to the
+   object module.  All it needs to know of where the source comes
+   from is how to push it onto the input stack, which it does for
+   each pass that reads it. */
+
+#include <stdio.h>
+
+#include "stream2.h"
+
+
+typedef void (*PUSH_INPUT)(STACK *stack, void *arg);
+
+int        assemble_module(PUSH_INPUT push_input, void *arg, FILE *obj, BUFFER *mem, int replay, int onepass);
+void       assemble_free(void);
+
+#endif
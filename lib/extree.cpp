@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <utility>
 
 #include "extree.h"                    /* my own definitions */
 
@@ -264,7 +265,7 @@ EX_TREE * EX_TREE::evaluate(int undef)
             delete (tp);
         } else {
             /* Copy verbatim. */
-            res = new EX_TREE(EX_NEG);
+            res = new EX_TREE(EX_COM);
             res->cp = tp->cp;
             res->data.child.left = tp;
         }
@@ -281,7 +282,7 @@ EX_TREE * EX_TREE::evaluate(int undef)
             /* Make a temp sym with the negative value of the given
                sym (this works for symbols within relocatable sections
                too) */
-            res = new EX_TREE("*TEMP", data.symbol->section, (unsigned) -(int) data.symbol->value);
+            res = new EX_TREE("*TEMP", tp->data.symbol->section, (unsigned) -(int) tp->data.symbol->value);
             res->cp = tp->cp;
             delete (tp);
         } else {
@@ -354,15 +355,15 @@ EX_TREE * EX_TREE::evaluate(int undef)
                 }
             }
 
-            /* Associative:  <A-x>+y == A+<y-x> */
-            /*  and if y-x is constant, I can do that math. */
+            /* Associative:  <A-x>+y == A-<x-y> */
+            /*  and if x-y is constant, I can do that math. */
             if (left->type == EX_SUB && right->type == EX_LIT) {
                 EX_TREE        *leftright = left->data.child.right;
 
                 if (leftright->type == EX_LIT) {
                     /* Do the shuffle */
                     res = left;
-                    leftright->data.lit = right->data.lit - leftright->data.lit;
+                    leftright->data.lit -= right->data.lit;
                     delete (right);
                     break;
                 }
@@ -647,6 +648,248 @@ EX_TREE * EX_TREE::evaluate(int undef)
 }
 
 
+/* EX_VALUE::is_rel - the value counterpart of RELTYPE */
+
+int EX_VALUE::is_rel()
+{
+    if (type == EXV_SYM)
+        return (sym->section->flags & PSECT_REL) != 0;
+    if (type == EXV_TEMP)
+        return (section->flags & PSECT_REL) != 0;
+    return 0;
+}
+
+/* EX_VALUE::swap - exchange two values, trees and all.  A value
+   can't be copied, as only one of the copies could own the tree. */
+
+void EX_VALUE::swap(EX_VALUE &other)
+{
+    std::swap(type, other.type);
+    std::swap(value, other.value);
+    std::swap(sym, other.sym);
+    std::swap(section, other.section);
+    std::swap(tree, other.tree);
+    std::swap(cp, other.cp);
+}
+
+/* EX_VALUE::make_tree - build the tree evaluate() would have returned
+   for this value.  Ownership passes to the caller. */
+
+EX_TREE * EX_VALUE::make_tree()
+{
+    EX_TREE        *res;
+
+    switch (type) {
+    case EXV_LIT:
+        res = new EX_TREE(value);
+        break;
+
+    case EXV_SYM:
+        res = new EX_TREE(EX_SYM);
+        res->data.symbol = sym;
+        break;
+
+    case EXV_SYM_OFFSET:
+        res = new EX_TREE(EX_ADD);
+        res->data.child.left = new EX_TREE(EX_SYM);
+        res->data.child.left->data.symbol = sym;
+        res->data.child.left->cp = cp;
+        res->data.child.right = new EX_TREE(value);
+        res->data.child.right->cp = cp;
+        break;
+
+    case EXV_TEMP:
+        res = new EX_TREE("*TEMP", section, value);
+        break;
+
+    default:                           /* EXV_COMPLEX */
+        res = tree;
+        tree = NULL;
+        return res;
+    }
+
+    res->cp = cp;
+    return res;
+}
+
+/* eval - evaluate an EX_TREE into an EX_VALUE without allocating.
+   This handles the common cases (literals, symbols, and symbols
+   plus or minus a constant) following exactly the same rules as
+   evaluate().  Returns FALSE if the tree is anything more complex,
+   in which case the caller falls back on evaluate(). */
+
+int EX_TREE::eval(int undef, EX_VALUE *res)
+{
+    EX_VALUE        left,
+                    right;
+
+    res->cp = cp;
+
+    switch (type) {
+    case EX_LIT:
+        res->set_lit(data.lit);
+        return 1;
+
+    case EX_SYM:
+        {
+            SYMBOL         *sym = data.symbol;
+
+            /* A global symbol with no assignment is "undefined." */
+            if (undef && (sym->flags & (SYMBOLFLAG_GLOBAL | SYMBOLFLAG_DEFINITION)) == SYMBOLFLAG_GLOBAL)
+                return 0;
+
+            /* Turn defined absolute symbol to a literal */
+            if (!(sym->section->flags & PSECT_REL)
+                && (sym->flags & (SYMBOLFLAG_GLOBAL | SYMBOLFLAG_DEFINITION)) != SYMBOLFLAG_GLOBAL
+                && sym->section->type != SECTION_REGISTER) {
+                res->set_lit(sym->value);
+                return 1;
+            }
+
+            /* Snapshot "." since it changes as words are stored */
+            if (strcmp(sym->label, ".") == 0) {
+                res->set_temp(sym->section, sym->value);
+                return 1;
+            }
+
+            res->type = EXV_SYM;
+            res->sym = sym;
+            return 1;
+        }
+
+    case EX_TEMP_SYM:
+        res->set_temp(data.symbol->section, data.symbol->value);
+        return 1;
+
+    case EX_COM:
+        if (!data.child.left->eval(undef, &left) || left.type != EXV_LIT)
+            return 0;
+        res->set_lit(~left.value);
+        return 1;
+
+    case EX_NEG:
+        if (!data.child.left->eval(undef, &left))
+            return 0;
+        if (left.type == EXV_LIT)
+            res->set_lit((unsigned) -(int) left.value);
+        else if (left.type == EXV_SYM)
+            res->set_temp(left.sym->section, (unsigned) -(int) left.sym->value);
+        else if (left.type == EXV_TEMP)
+            res->set_temp(left.section, (unsigned) -(int) left.value);
+        else
+            return 0;
+        return 1;
+
+    case EX_ADD:
+    case EX_SUB:
+        if (!data.child.left->eval(undef, &left) || !data.child.right->eval(undef, &right))
+            return 0;
+
+        if (left.type == EXV_LIT && right.type == EXV_LIT) {
+            res->set_lit(type == EX_ADD ? left.value + right.value : left.value - right.value);
+            return 1;
+        }
+
+        if (type == EX_ADD && left.type == EXV_LIT) {
+            left.swap(right);  /* Put the literal on the right */
+        }
+
+        if (type == EX_SUB && left.is_rel() && right.is_rel()) {
+            SECTION        *lsect = left.type == EXV_SYM ? left.sym->section : left.section;
+            SECTION        *rsect = right.type == EXV_SYM ? right.sym->section : right.section;
+            unsigned        lval = left.type == EXV_SYM ? left.sym->value : left.value;
+            unsigned        rval = right.type == EXV_SYM ? right.sym->value : right.value;
+
+            if (lsect != rsect)
+                return 0;
+            res->set_lit(lval - rval);
+            return 1;
+        }
+
+        if (right.type != EXV_LIT)
+            return 0;
+
+        if (type == EX_SUB)
+            right.value = (unsigned) -(int) right.value;
+
+        if (right.value == 0) {
+            res->swap(left);
+            res->cp = cp;
+            return 1;
+        }
+
+        if (left.is_rel()) {
+            if (left.type == EXV_SYM)
+                res->set_temp(left.sym->section, left.sym->value + right.value);
+            else
+                res->set_temp(left.section, left.value + right.value);
+            return 1;
+        }
+
+        if (left.type == EXV_SYM || left.type == EXV_SYM_OFFSET) {
+            res->type = EXV_SYM_OFFSET;
+            res->sym = left.sym;
+            res->value = left.value + right.value;
+            return 1;
+        }
+
+        return 0;
+
+    case EX_MUL:
+    case EX_DIV:
+    case EX_AND:
+    case EX_OR:
+        if (!data.child.left->eval(undef, &left) || !data.child.right->eval(undef, &right))
+            return 0;
+
+        if (left.type == EXV_LIT && right.type == EXV_LIT) {
+            switch (type) {
+            case EX_MUL:
+                res->set_lit(left.value * right.value);
+                break;
+            case EX_DIV:
+                res->set_lit(left.value / right.value);
+                break;
+            case EX_AND:
+                res->set_lit(left.value & right.value);
+                break;
+            default:
+                res->set_lit(left.value | right.value);
+                break;
+            }
+            return 1;
+        }
+
+        if (type != EX_DIV && left.type == EXV_LIT) {
+            left.swap(right);  /* Commutative */
+        }
+
+        if (right.type != EXV_LIT)
+            return 0;
+
+        /* The identities evaluate() knows about */
+        if ((type == EX_MUL && right.value == 1) || (type == EX_DIV && right.value == 1) ||
+            (type == EX_AND && right.value == 0177777) || (type == EX_OR && right.value == 0)) {
+            res->swap(left);
+            res->cp = cp;
+            return 1;
+        }
+        if ((type == EX_MUL || type == EX_AND) && right.value == 0) {
+            res->set_lit(0);
+            return 1;
+        }
+        if (type == EX_OR && right.value == 0177777) {
+            res->set_lit(0177777);
+            return 1;
+        }
+        return 0;
+
+    default:                           /* EX_UNDEFINED_SYM, EX_ERR */
+        return 0;
+    }
+}
+
+
 /* Allocate an EX_TREE */
 
 // EX_TREE        *new_ex_tree()(
@@ -33,7 +33,19 @@
         EX_OR = 13                     /* bitwise or */
     };
 
+    enum exv_type { EXV_LIT = 1,
+        /* Value is a literal */
+        EXV_SYM = 2,
+        /* Value is a plain symbol reference */
+        EXV_SYM_OFFSET = 3,
+        /* Value is a symbol plus (or minus) a literal offset */
+        EXV_TEMP = 4,
+        /* Value is a location in a program section */
+        EXV_COMPLEX = 5                /* Anything else; kept as a tree */
+    };
+
 class EX_TREE;
+struct EX_VALUE;
 
 // EX_TREE        *new_ex_tree()(void);
 // EX_TREE        *new_ex_lit(unsigned value);
@@ -68,6 +80,32 @@ class EX_TREE {
     // EX_TREE        *new_ex_lit(unsigned value);
     EX_TREE        *ex_err(char *cp) { return ::ex_err(this, cp); };
     EX_TREE        *evaluate(int undef);
+    int             eval(int undef, EX_VALUE *res);
 } ;
 
+/* EX_VALUE receives the result of an evaluation without building a
+   new tree.  EXV_SYM and EXV_SYM_OFFSET stand for what evaluate()
+   would give as EX_SYM and EX_ADD(EX_SYM, EX_LIT); EXV_TEMP stands
+   for an EX_TEMP_SYM.  Only EXV_COMPLEX owns a tree. */
+
+struct EX_VALUE {
+    EX_VALUE() : type(EXV_LIT), value(0), sym(NULL), section(NULL), tree(NULL), cp(NULL) {};
+    ~EX_VALUE() { if (tree) delete tree; };
+    EX_VALUE(const EX_VALUE &) = delete;       /* It owns its tree */
+    EX_VALUE       &operator=(const EX_VALUE &) = delete;
+
+    exv_type        type;
+    unsigned        value;      /* Literal, offset from sym, or location */
+    SYMBOL         *sym;        /* EXV_SYM, EXV_SYM_OFFSET */
+    SECTION        *section;    /* EXV_TEMP */
+    EX_TREE        *tree;       /* EXV_COMPLEX */
+    char           *cp;         /* points to end of parsed expression */
+
+    void            swap(EX_VALUE &other);
+    void            set_lit(unsigned lit) { type = EXV_LIT; value = lit; };
+    void            set_temp(SECTION *sect, unsigned loc) { type = EXV_TEMP; section = sect; value = loc; };
+    int             is_rel();
+    EX_TREE        *make_tree();
+};
+
 #endif
@@ -9,35 +9,50 @@
 
 #include "util.h"
 #include "assemble_globals.h"
+#include "replay.h"
 
-int error_count = 0;
+THREAD_LOCAL int error_count = 0;
 
 
 /* GLOBAL VARIABLES */
 
-int             list_md = 1;    /* option to list macro/rept definition = yes */
+THREAD_LOCAL int             list_md = 1;    /* option to list macro/rept definition = yes */
 
-int             list_me = 1;    /* option to list macro/rept expansion = yes */
+THREAD_LOCAL int             list_me = 1;    /* option to list macro/rept expansion = yes */
 
-int             list_bex = 1;   /* option to show binary */
+THREAD_LOCAL int             list_bex = 1;   /* option to show binary */
 
-int             list_level = 1; /* Listing control level.  .LIST
+THREAD_LOCAL int             list_level = 1; /* Listing control level.  .LIST
                                    increments; .NLIST decrements */
 
-static char    *listline;       /* Source lines */
+static THREAD_LOCAL char    *listline;       /* Source lines */
 
-static char    *binline;        /* for octal expansion */
+static THREAD_LOCAL char    *binline;        /* for octal expansion */
 
-FILE           *lstfile = NULL;
+THREAD_LOCAL FILE           *lstfile = NULL;
+
+THREAD_LOCAL BUFFER         *lstbuf = NULL;
+
+THREAD_LOCAL void (*report_hook)(const char *name, int line, const char *message) = NULL;
+
+/* list_puts writes text to the listing, in the file or in memory */
+
+static void list_puts(const char *text)
+{
+    if (lstbuf)
+        lstbuf->buffer_appendn((char *) text, strlen(text));
+    else
+        fputs(text, lstfile);
+}
 
 
 
 
 /* do_list returns TRUE if listing is enabled. */
 
-static int dolist(void)
+int dolist(void)
 {
-    int ok = lstfile != NULL && pass > 0 && list_level > 0;
+    int ok = (lstfile != NULL || lstbuf != NULL) && pass > 0 && list_level > 0;
 
     return ok;
 }
@@ -70,9 +85,9 @@ void list_flush(void)
 {
     if (dolist()) {
         padto(binline, offsetof(LSTFORMAT, source));
-        fputs(binline, lstfile);
-        fputs(listline, lstfile);
-        fputc('\n', lstfile);
+        list_puts(binline);
+        list_puts(listline);
+        list_puts("\n");
         listline[0] = 0;
         binline[0] = 0;
     }
@@ -126,31 +141,63 @@ void list_word(STREAM *str, unsigned addr, unsigned value, int size, const char
 
 
 
+/* Print a run of words (or bytes) stored at addr */
+
+void list_words(STREAM *str, unsigned addr, const unsigned *values, int count, int size)
+{
+    if (dolist()) {
+        while (count-- > 0) {
+            list_fit(str, addr);
+            if (size == 1)
+                sprintf(binline + strlen(binline), "   %3.3o  ", *values++ & 0377);
+            else
+                sprintf(binline + strlen(binline), "%6.6o  ", *values++ & 0177777);
+            addr += size;
+        }
+    }
+}
+
 /* reports errors */
 void report(STREAM *str, const char *fmt, ...)
 {
     va_list         ap;
     const char     *name = "**";
     int             line = 0;
+    char           *message;
+    int             len;
 
-    if (!pass)
+    if (!pass) {
+        replay_reported();
         return;                        /* Don't report now. */
+    }
 
     if (str) {
         name = str->name;
         line = str->line;
     }
 
-    fprintf(stderr, "%s:%d: ***ERROR ", name, line);
     va_start(ap, fmt);
-    vfprintf(stderr, fmt, ap);
+    len = vsnprintf(NULL, 0, fmt, ap);
     va_end(ap);
+    message = (char *)memcheck(malloc(len + 1));
+    va_start(ap, fmt);
+    vsnprintf(message, len + 1, fmt, ap);
+    va_end(ap);
+
+    if (report_hook)
+        report_hook(name, line, message);
+    else
+        fprintf(stderr, "%s:%d: ***ERROR %s", name, line, message);
     error_count++;
 
-    if (lstfile) {
-        fprintf(lstfile, "%s:%d: ***ERROR ", name, line);
-        va_start(ap, fmt);
-        vfprintf(lstfile, fmt, ap);
-        va_end(ap);
+    if (lstfile || lstbuf) {
+        char            where[64];
+
+        snprintf(where, sizeof(where), ":%d: ***ERROR ", line);
+        list_puts(name);
+        list_puts(where);
+        list_puts(message);
     }
+
+    free(message);
 }
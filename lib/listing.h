@@ -3,6 +3,7 @@
 #define LISTING__H
 
 #include "stream2.h"
+#include "util.h"
 
 /*
     format of a listing line
@@ -22,24 +23,31 @@ typedef struct lstformat {
 
 /* GLOBAL VARIABLES */
 #ifndef  LISTING__C
-extern int  list_md;        /* option to list macro/rept definition = yes */
-extern int  list_me;        /* option to list macro/rept expansion = yes */
-extern int  list_bex;       /* option to show binary */
-extern int  list_level;     /* Listing control level.  .LIST
+extern THREAD_LOCAL int  list_md;        /* option to list macro/rept definition = yes */
+extern THREAD_LOCAL int  list_me;        /* option to list macro/rept expansion = yes */
+extern THREAD_LOCAL int  list_bex;       /* option to show binary */
+extern THREAD_LOCAL int  list_level;     /* Listing control level.  .LIST
                                increments; .NLIST decrements */
 
 //extern   char   *listline;               /* Source lines */
 
-extern FILE    *lstfile;
-extern int error_count;
+extern THREAD_LOCAL FILE    *lstfile;
+extern THREAD_LOCAL BUFFER  *lstbuf;    /* Or the memory the listing goes to */
+extern THREAD_LOCAL int error_count;
+
+/* report_hook, if set, is given each error in place of stderr: where
+   it is, and the message, which ends with a newline */
+extern THREAD_LOCAL void (*report_hook)(const char *name, int line, const char *message);
 
 #endif
 
 
 void   list_word(STREAM *str, unsigned addr, unsigned value, int size, const char *flags);
+void   list_words(STREAM *str, unsigned addr, const unsigned *values, int count, int size);
 void   list_value(STREAM *str, unsigned word);
 void   list_source(STREAM *str, const char *cp);
 void   list_flush(void);
+int    dolist(void);
 void   report(STREAM *str, const char *fmt, ...);
 
 
@@ -17,6 +17,8 @@
 #include "assemble_aux.h"
 #include "listing.h"
 #include "parse.h"
+#include "profile.h"
+#include "replay.h"
 #include "stream2.h"
 #include "symbols.h"
 
@@ -41,7 +43,7 @@ MACRO_STREAM::~MACRO_STREAM()
 //     macro_stream_delete, buffer_stream_gets, buffer_stream_rewind
 // };
 
-MACRO_STREAM::MACRO_STREAM(STREAM *refstr, BUFFER *buf, MACRO *mac, ARG *args) : BUFFER_STREAM(buf, ""), nargs(0), cond(0)
+MACRO_STREAM::MACRO_STREAM(STREAM *refstr, BUFFER *buf, MACRO *mac, int _nargs) : BUFFER_STREAM(buf, ""), nargs(_nargs), cond(0)
 {
     str_type = TYPE_MACRO_STREAM;
 
@@ -50,13 +52,26 @@ MACRO_STREAM::MACRO_STREAM(STREAM *refstr, BUFFER *buf, MACRO *mac, ARG *args) :
     sprintf(name, "%s:%d->%s", refstr->name, refstr->line, mac->label);
 
     // mstr->bstr.stream.vtbl = &macro_stream_vtbl;
-    /* Count the args and save their number */
-    for (nargs = 0; args; args = args->next, nargs++) ;
     cond = last_cond;
 }
 
+/* The directives read_body cares about */
+
+static const DIRECTIVE body_directives[] = {
+    { ".MACRO", P_MACRO },
+    { ".REPT", P_REPT },
+    { ".IRP", P_IRP },
+    { ".IRPC", P_IRPC },
+    { ".ENDM", P_ENDM },
+    { ".ENDR", P_ENDR },
+    { ".REM", P_REM },
+    { NULL, 0 }
+};
+
 /* read_body fetches the body of .MACRO, .REPT, .IRP, or .IRPC into a
-   BUFFER. */
+   BUFFER.  Only the nesting directives are recognized, with
+   get_directive; the text of a .REM block is skipped over so that
+   directives quoted in it don't count. */
 
 void read_body(
     STACK *stack,
@@ -65,6 +80,7 @@ void read_body(
     int called)
 {
     int             nest;
+    char            remquote = 0;   /* Closing quote of a .REM block */
 
     /* Read the stream in until the end marker is hit */
 
@@ -73,7 +89,7 @@ void read_body(
 
     nest = 1;
     for (;;) {
-        SYMBOL         *op;
+        int             op;
         char           *nextline;
         char           *cp;
 
@@ -86,40 +102,58 @@ void read_body(
         if (!called && (list_level - 1 + list_md) > 0) {
             list_flush();
             list_source(stack->top, nextline);
+            replay_record_listed(stack->top, nextline);
         }
 
-        op = get_op(nextline, &cp);
-
-        if (op == NULL) {              /* Not a pseudo-op */
+        if (remquote) {
+            /* Inside .REM; look for the closing quote */
+            if (memchr(nextline, remquote, strcspn(nextline, "\n")) != NULL)
+                remquote = 0;
             gb->buffer_append_line(nextline);
             continue;
         }
-        if (op->section->type == SECTION_PSEUDO) {
-            if (op->value == P_MACRO || op->value == P_REPT || op->value == P_IRP || op->value == P_IRPC)
-                nest++;
-
-            if (op->value == P_ENDM || op->value == P_ENDR) {
-                nest--;
-                /* If there's a name on the .ENDM, then */
-                /* close the body early if it matches the definition */
-                if (name && op->value == P_ENDM) {
-                    cp = skipwhite(cp);
-                    if (!EOL(*cp)) {
-                        char           *label = get_symbol(cp, &cp, NULL);
-
-                        if (label) {
-                            if (strcmp(label, name) == 0)
-                                nest = 0;       /* End of macro body. */
-                            free(label);
-                        }
+
+        op = get_directive(nextline, &cp, body_directives);
+
+        switch (op) {
+        case P_MACRO:
+        case P_REPT:
+        case P_IRP:
+        case P_IRPC:
+            nest++;
+            break;
+
+        case P_ENDM:
+        case P_ENDR:
+            nest--;
+            /* If there's a name on the .ENDM, then */
+            /* close the body early if it matches the definition */
+            if (name && op == P_ENDM) {
+                cp = skipwhite(cp);
+                if (!EOL(*cp)) {
+                    char           *label = get_symbol(cp, &cp, NULL);
+
+                    if (label) {
+                        if (strcmp(label, name) == 0)
+                            nest = 0;   /* End of macro body. */
+                        free(label);
                     }
                 }
             }
+            break;
 
-            if (nest == 0)
-                return;                /* All done. */
+        case P_REM:
+            /* The comment runs to the next occurrence of the first
+               character after .REM, as in assemble */
+            cp = skipwhite(cp);
+            if (*cp && *cp != '\n' && memchr(cp + 1, *cp, strcspn(cp + 1, "\n")) == NULL)
+                remquote = *cp;
+            break;
         }
 
+        if (nest == 0)
+            return;                    /* All done. */
+
         gb->buffer_append_line(nextline);
     }
 }
@@ -149,6 +183,53 @@ void dumpmacro(MACRO *mac, FILE *fp)
     fputs(".ENDM\n", fp);
 }
 
+/* new_macro enters a new, empty macro into the macro table. */
+
+static MACRO   *new_macro(char *label)
+{
+    MACRO          *mac;
+
+    /* Allow redefinition of a macro; new definition replaces the old. */
+    mac = (MACRO *) Glb_macro_st.lookup_sym(label);
+    if (mac) {
+        /* Remove from the symbol table... */
+        Glb_macro_st.remove_sym(mac);
+        delete (mac);
+    }
+
+    mac = new MACRO(label);
+
+    // macro_st.add_table(mac->sym);
+    Glb_macro_st.add_table(mac);
+
+    return mac;
+}
+
+/* restore_macro defines a macro from parts already parsed, as they
+   come from the .MCALL cache.  It takes over args and text, and the
+   compiled body, pieces, if there is one; if it doesn't fit the text,
+   the body is compiled again. */
+
+MACRO          *restore_macro(
+    char *label,
+    ARG *args,
+    BUFFER *text,
+    MACRO_PIECE *pieces,
+    int npieces)
+{
+    MACRO          *mac = new_macro(label);
+
+    mac->args = args;
+    mac->text = text;
+    mac->index_args();
+    if (pieces == NULL || !mac->use_template(pieces, npieces)) {
+        free(pieces);
+        mac->compile_body();
+    }
+
+    return mac;
+}
+
 /* defmacro - define a macro. */
 /* Also used by .MCALL to pull macro definitions from macro libraries */
 
@@ -169,18 +250,10 @@ MACRO          *defmacro(
         return NULL;
     }
 
-    /* Allow redefinition of a macro; new definition replaces the old. */
-    mac = (MACRO *) Glb_macro_st.lookup_sym(label);
-    if (mac) {
-        /* Remove from the symbol table... */
-        Glb_macro_st.remove_sym(mac);
-       delete (mac);
-    }
-
-    mac = new MACRO(label);
-
-    // macro_st.add_table(mac->sym);
-    Glb_macro_st.add_table(mac);
+    mac = new_macro(label);
+    free(label);                       /* The macro has its own copy */
+    mac->source = (char *)memcheck(malloc(strlen(stack->top->name) + 32));
+    sprintf(mac->source, "%s:%d", stack->top->name, stack->top->line);
 
     argtail = &mac->args;
     cp = skipdelim(cp);
@@ -224,6 +297,8 @@ MACRO          *defmacro(
         cp = skipdelim(cp);
     }
 
+    mac->index_args();
+
     /* Read the stream in until the end marker is hit */  {
         BUFFER         *gb;
         int             levelmod = 0;
@@ -245,6 +320,8 @@ MACRO          *defmacro(
         mac->text = gb;
     }
 
+    mac->compile_body();
+
     return mac;
 }
 
@@ -364,16 +441,16 @@ void eval_arg(
     /* Check for value substitution */
 
     if (arg->value[0] == '\\') {
-        EX_TREE        *value = parse_expr(arg->value + 1, 0);
+        EX_VALUE        value;
         unsigned        word = 0;
         char            temp[10];
 
-        if (value->type != EX_LIT) {
+        parse_value(arg->value + 1, 0, &value);
+        if (value.type != EXV_LIT) {
+            replay_spoil();
             report(refstr, "Constant value required\n");
         } else
-            word = value->data.lit;
-
-        delete (value);
+            word = value.value;
 
         /* printf can't do base 2. */
         my_ultoa(word & 0177777, temp, radix);
@@ -382,67 +459,311 @@ void eval_arg(
     }
 }
 
-/* expandmacro - return a STREAM containing the expansion of a macro */
+/* get_arg_slice - point val at the argument value at cp (which may
+   be bracketed, as for getstring) and return the end of it. */
+
+char *get_arg_slice(char *cp, ARG_SLICE *val)
+{
+    int             start,
+                    len;
+    char           *endp;
+
+    if (!brackrange(cp, &start, &len, &endp)) {
+        start = 0;
+        len = strcspn(cp, " \t\n,;");
+        endp = cp + len;
+    }
+
+    val->text = cp + start;
+    val->len = len;
+    val->given = 1;
+    val->pending = len > 0 && val->text[0] == '\\';
+    return endp;
+}
+
+/* eval_slice is eval_arg for an ARG_SLICE.  Returns FALSE if the
+   value wasn't a constant, which was reported. */
+
+int eval_slice(STREAM *refstr, ARG_SLICE *val)
+{
+    EX_VALUE        value;
+    unsigned        word = 0;
+    char           *expr;
+    int             ok = TRUE;
+
+    expr = (char *)memcheck(malloc(val->len));
+    memcpy(expr, val->text + 1, val->len - 1);
+    expr[val->len - 1] = 0;
+
+    parse_value(expr, 0, &value);
+    if (value.type != EXV_LIT) {
+        replay_spoil();                /* The second pass may expand it differently */
+        report(refstr, "Constant value required\n");
+        ok = FALSE;
+    } else
+        word = value.value;
+    free(expr);
+
+    my_ultoa(word & 0177777, val->temp, radix);
+    val->text = val->temp;
+    val->len = strlen(val->temp);
+    val->pending = 0;
+    return ok;
+}
+
+/* fill_template builds the expansion of a macro from its compiled
+   body in one pass: the total size is known from the slices, so gb
+   is grown at most once and the pieces are copied in.  Whatever gb
+   held before is replaced.  A \expression argument is evaluated
+   here, when the body first uses it; one the body never uses isn't
+   evaluated at all.  Returns FALSE if one wasn't a constant. */
+
+int fill_template(BUFFER *gb, MACRO *mac, ARG_SLICE *vals, STREAM *refstr)
+{
+    MACRO_PIECE    *pc;
+    char           *out;
+    int             total;
+    int             ok = TRUE;
+    int             i;
+
+    total = 0;
+    for (i = 0, pc = mac->tmpl; i < mac->npieces; i++, pc++) {
+        total += pc->len;
+        if (pc->slot >= 0) {
+            if (vals[pc->slot].pending && !eval_slice(refstr, &vals[pc->slot]))   /* First use */
+                ok = FALSE;
+            total += vals[pc->slot].len;
+        }
+    }
+
+    if (gb->size < total + 1)
+        gb->buffer_resize(total + 1);
+    out = gb->buffer;
+    for (i = 0, pc = mac->tmpl; i < mac->npieces; i++, pc++) {
+        memcpy(out, mac->text->buffer + pc->offset, pc->len);
+        out += pc->len;
+        if (pc->slot >= 0) {
+            memcpy(out, vals[pc->slot].text, vals[pc->slot].len);
+            out += vals[pc->slot].len;
+        }
+    }
+    *out = 0;
+    gb->length = total;
+    return ok;
+}
+
+/* expand_template makes a new BUFFER of the expansion.  *okp is as
+   fill_template returns. */
+
+static BUFFER *expand_template(MACRO *mac, ARG_SLICE *vals, STREAM *refstr, int *okp)
+{
+    BUFFER         *gb = new BUFFER();
+
+    *okp = fill_template(gb, mac, vals, refstr);
+    return gb;
+}
+
+/* The expansion cache.  Many macro calls are textually identical,
+   and the expansion only depends on the macro definition and the
+   argument values, so identical calls can share one expansion
+   BUFFER (they are only read).  Calls that generate local symbols
+   never repeat and aren't cached.  A \expression argument is keyed
+   by its text, not evaluated, along with what its value could depend
+   on: the symbols (by symbol_generation), the pass and the radix, and
+   if it has a '$' the local symbol block, and if it has a '.' the
+   location counter.  A hit then needs no
+   evaluation; a miss evaluates it as the expansion is built, and if
+   it wasn't a constant the expansion isn't kept, so the error is
+   reported at every such call.  The cache is direct-mapped, so a
+   collision just replaces the older entry. */
+
+#define MACRO_CACHE_SIZE 1024          /* A power of 2 */
+
+struct MACRO_CACHE_ENTRY {
+    MACRO    *mac;        /* The macro... */
+    unsigned  generation; /* ...and its definition */
+    char     *key;        /* The argument values */
+    int       keylen;
+    BUFFER   *buf;        /* The expansion; holds one use */
+};
+
+static THREAD_LOCAL MACRO_CACHE_ENTRY macro_cache[MACRO_CACHE_SIZE];
+
+static THREAD_LOCAL char    *cache_key;             /* Key being looked up */
+static THREAD_LOCAL int      cache_keysize;
+static THREAD_LOCAL long     cache_lookups;         /* Statistics */
+static THREAD_LOCAL long     cache_hits;
+static THREAD_LOCAL long     cache_uncacheable;
+
+static THREAD_LOCAL unsigned macro_generation;      /* Counts macro definitions */
+
+/* add_to_key appends len bytes to cache_key, which holds keylen,
+   and returns the new length. */
+
+static int add_to_key(int keylen, const void *data, int len)
+{
+    if (keylen + len > cache_keysize) {
+        cache_keysize = keylen + len + 256;
+        cache_key = (char *)memcheck(realloc(cache_key, cache_keysize));
+    }
+    memcpy(cache_key + keylen, data, len);
+    return keylen + len;
+}
+
+/* make_cache_key builds the lookup key for a call of mac into
+   cache_key: each argument value preceded by its length, a
+   \expression by its text, and then, if there was one of those, the
+   state its value may depend on.  Arguments the body never uses are left
+   out.  Nothing is evaluated.  Returns the key length; *hashp gets
+   the entry index. */
+
+static int make_cache_key(MACRO *mac, ARG_SLICE *vals, unsigned *hashp)
+{
+    unsigned        hash = 2166136261u ^ mac->generation;     /* FNV-1a */
+    int             keylen = 0;
+    int             pending = 0,
+                    dot = 0,
+                    local = 0;
+    int             i, j;
+
+    for (i = 0; i < mac->nargs; i++) {
+        if (mac->argidx[i].canon != i || !mac->used[i])
+            continue;                  /* Makes no difference */
+
+        if (vals[i].pending) {
+            pending = 1;
+            dot |= memchr(vals[i].text, '.', vals[i].len) != NULL;
+            local |= memchr(vals[i].text, '$', vals[i].len) != NULL;
+        }
+        keylen = add_to_key(keylen, &vals[i].len, sizeof(int));
+        keylen = add_to_key(keylen, vals[i].text, vals[i].len);
+    }
+
+    /* The values end where they would without it, so such a key
+       can't be the same as one without */
+    if (pending) {
+        unsigned        state[3];
+
+        state[0] = symbol_generation;
+        state[1] = pass;
+        state[2] = radix;
+        keylen = add_to_key(keylen, state, sizeof(state));
+        if (local)
+            keylen = add_to_key(keylen, &lsb, sizeof(lsb));
+        if (dot) {
+            keylen = add_to_key(keylen, &current_pc->value, sizeof(current_pc->value));
+            keylen = add_to_key(keylen, &current_pc->section, sizeof(SECTION *));
+        }
+    }
+
+    for (j = 0; j < keylen; j++)
+        hash = (hash ^ (unsigned char) cache_key[j]) * 16777619u;
+
+    *hashp = hash & (MACRO_CACHE_SIZE - 1);
+    return keylen;
+}
+
+/* macro_cache_stats reports how well the expansion cache did. */
+
+void macro_cache_stats(FILE *fp)
+{
+    fprintf(fp, "Macro expansions: %ld cached lookups, %ld hits (%ld%%), %ld not cacheable\n",
+            cache_lookups, cache_hits, cache_lookups ? cache_hits * 100 / cache_lookups : 0L,
+            cache_uncacheable);
+}
+
+/* free_macros deletes all the macros, and empties the expansion
+   cache. */
+
+void free_macros(void)
+{
+    int             i;
+
+    for (i = 0; i < HASH_SIZE; i++) {
+        while (Glb_macro_st.hash[i] != NULL) {
+            MACRO          *mac = (MACRO *) Glb_macro_st.hash[i];
+
+            Glb_macro_st.hash[i] = mac->next;
+            delete mac;
+        }
+    }
+
+    for (i = 0; i < MACRO_CACHE_SIZE; i++) {
+        buffer_free(macro_cache[i].buf);
+        free(macro_cache[i].key);
+        memset(&macro_cache[i], 0, sizeof(MACRO_CACHE_ENTRY));
+    }
+}
+
+/* expandmacro - return a STREAM containing the expansion of a macro.
+   The call line is not copied; each argument value is a slice of it
+   (or of the default), kept at the position of the first macro
+   argument of that name. */
+
+#define ARG_SLICE_MAX 16               /* Slices kept on the stack */
 
 STREAM         *expandmacro(
     STREAM *refstr,
     MACRO *mac,
     char *cp)
 {
-    ARG            *arg,
-                   *args,
-                   *macarg;
-    char           *label;
-    MACRO_STREAM         *str;
+    ARG_SLICE       slices[ARG_SLICE_MAX];
+    ARG_SLICE      *vals;
+    MACRO_STREAM   *str;
     BUFFER         *buf;
+    MACRO_CACHE_ENTRY *ent = NULL;
+    PROF_SITE      *site = NULL;
+    int             cacheable = 1;
+    int             i;
 
-    args = NULL;
-    arg = NULL;
+    if (prof_enabled)
+        site = prof_begin(mac->label, mac->source, refstr);
+
+    vals = slices;
+    if (mac->nargs > ARG_SLICE_MAX)
+        vals = (ARG_SLICE *)memcheck(malloc(mac->nargs * sizeof(ARG_SLICE)));
+    for (i = 0; i < mac->nargs; i++)
+        vals[i].given = vals[i].pending = 0;
 
     /* Parse the arguments */
 
     while (!EOL(*cp)) {
         char           *nextcp;
+        int             len;
 
         /* Check for named argument */
-        label = get_symbol(cp, &nextcp, NULL);
-        if (label && (nextcp = skipwhite(nextcp), *nextcp == '=') && (macarg = find_arg(mac->args, label))) {
+        i = -1;
+        if (issym(*cp) && !isdig(*cp)) {
+            for (len = 1; issym(cp[len]); len++) ;
+            nextcp = skipwhite(cp + len);
+            if (*nextcp == '=')
+                i = mac->find_arg_index(cp, len);
+        }
+
+        if (i >= 0) {
             /* Check if I've already got a value for it */
-            if (find_arg(args, label) != NULL) {
-                report(refstr, "Duplicate submission of keyword " "argument %s\n", label);
-                free(label);
-                free_args(args);
+            if (vals[i].given) {
+                report(refstr, "Duplicate submission of keyword " "argument %s\n", mac->argidx[i].arg->label);
+                if (vals != slices)
+                    free(vals);
                 return NULL;
             }
 
-            arg = new ARG();
-            arg->label = label;
-            nextcp = skipwhite(nextcp + 1);
-            arg->value = getstring(nextcp, &nextcp);
+            nextcp = get_arg_slice(skipwhite(nextcp + 1), &vals[i]);
         } else {
-            if (label)
-                free(label);
-
             /* Find correct positional argument */
 
-            for (macarg = mac->args; macarg != NULL; macarg = macarg->next) {
-                if (find_arg(args, macarg->label) == NULL)
+            for (i = 0; i < mac->nargs; i++) {
+                if (mac->argidx[i].canon == i && !vals[i].given)
                     break;             /* This is the next positional arg */
             }
 
-            if (macarg == NULL)
+            if (i >= mac->nargs)
                 break;                 /* Don't pick up any more arguments. */
 
-            arg = new ARG();
-            arg->label = (char *)memcheck(strdup(macarg->label));       /* Copy the name */
-            arg->value = getstring(cp, &nextcp);
+            nextcp = get_arg_slice(cp, &vals[i]);
         }
 
-        arg->next = args;
-        args = arg;
-
-        eval_arg(refstr, arg);         /* Check for expression evaluation */
-
         cp = skipdelim(nextcp);
     }
 
@@ -455,35 +776,68 @@ STREAM         *expandmacro(
             locsym = last_locsym;
         last_lsb = lsb;
 
-        for (macarg = mac->args; macarg != NULL; macarg = macarg->next) {
-            arg = find_arg(args, macarg->label);
-            if (arg == NULL) {
-                arg = new ARG();
-                arg->label = (char *)memcheck(strdup(macarg->label));
-                if (macarg->locsym) {
-                    char            temp[32];
-
-                    /* Here's where we generate local labels */
-                    sprintf(temp, "%d$", locsym++);
-                    arg->value = (char *)memcheck(strdup(temp));
-                } else if (macarg->value) {
-                    arg->value = (char *)memcheck(strdup(macarg->value));
-                } else
-                    arg->value = (char *)memcheck(strdup(""));
-
-                arg->next = args;
-                args = arg;
+        for (i = 0; i < mac->nargs; i++) {
+            ARG            *macarg = mac->argidx[i].arg;
+
+            if (mac->argidx[i].canon != i || vals[i].given)
+                continue;
+
+            if (macarg->locsym) {
+                cacheable = 0;
+                /* Here's where we generate local labels */
+                sprintf(vals[i].temp, "%d$", locsym++);
+                vals[i].text = vals[i].temp;
+                vals[i].len = strlen(vals[i].temp);
+            } else if (macarg->value) {
+                vals[i].text = macarg->value;
+                vals[i].len = strlen(macarg->value);
+            } else {
+                vals[i].text = vals[i].temp;
+                vals[i].len = 0;
             }
         }
 
         last_locsym = locsym;
     }
 
-    buf = subst_args(mac->text, args);
+    buf = NULL;
+    if (cacheable) {
+        unsigned        hash;
+        int             keylen = make_cache_key(mac, vals, &hash);
+
+        cache_lookups++;
+        ent = &macro_cache[hash];
+        if (ent->buf != NULL && ent->mac == mac && ent->generation == mac->generation &&
+            ent->keylen == keylen && memcmp(ent->key, cache_key, keylen) == 0) {
+            cache_hits++;
+            buf = buffer_clone(ent->buf);
+        } else {
+            /* Replace whatever was there */
+            buffer_free(ent->buf);
+            free(ent->key);
+            ent->mac = mac;
+            ent->generation = mac->generation;
+            ent->key = (char *)memcheck(malloc(keylen + 1));
+            memcpy(ent->key, cache_key, keylen);
+            ent->keylen = keylen;
+            ent->buf = NULL;
+        }
+    } else
+        cache_uncacheable++;
 
-    str = new MACRO_STREAM(refstr, buf, mac, args);
+    if (buf == NULL) {
+        int             ok;
 
-    free_args(args);
+        buf = expand_template(mac, vals, refstr, &ok);
+        if (ent != NULL && ok)
+            ent->buf = buffer_clone(buf);
+    }
+
+    str = new MACRO_STREAM(refstr, buf, mac, mac->ndistinct);
+    str->prof = site;
+
+    if (vals != slices)
+        free(vals);
     buffer_free(buf);
 
     return str;
@@ -513,20 +867,187 @@ MACRO::MACRO(char *label) : SYMBOL(label)
 {
     flags = 0;
     // sym.label = label;
-    stmtno = stmtno;
+    this->stmtno = ::stmtno;
     next = NULL;
     section = &macro_section;
     value = 0;
     args = NULL;
     text = NULL;
+    nargs = 0;
+    ndistinct = 0;
+    argidx = NULL;
+    npieces = 0;
+    tmpl = NULL;
+    used = NULL;
+    source = NULL;
+    generation = ++macro_generation;
 }
 
 /* free a macro, it's args, it's text, etc. */
 MACRO::~MACRO()
 {
-    if (text) {
-        free(text);
-    }
+    buffer_free(text);
     free_args(args);
+    free(argidx);
+    free(tmpl);
+    free(used);
+    free(source);
     // delete (sym);
 }
+
+/* index_args builds the argument index from the argument list.  An
+   argument name given twice keeps referring to its first position,
+   as find_arg would have found it. */
+
+void MACRO::index_args()
+{
+    ARG            *arg;
+    int             i,
+                    j;
+
+    free(argidx);
+    argidx = NULL;
+
+    for (nargs = 0, arg = args; arg != NULL; arg = arg->next)
+        nargs++;
+    if (nargs)
+        argidx = (ARG_INDEX *)memcheck(malloc(nargs * sizeof(ARG_INDEX)));
+
+    ndistinct = 0;
+    for (i = 0, arg = args; arg != NULL; arg = arg->next, i++) {
+        argidx[i].arg = arg;
+        argidx[i].len = strlen(arg->label);
+        argidx[i].canon = i;
+        for (j = 0; j < i; j++) {
+            if (strcmp(argidx[j].arg->label, arg->label) == 0) {
+                argidx[i].canon = j;
+                break;
+            }
+        }
+        if (argidx[i].canon == i)
+            ndistinct++;
+    }
+}
+
+/* find_arg_index - look up the symbol text cp[0..len) among the
+   macro's arguments, after the same truncation and case folding
+   get_symbol applies.  Returns the argument's position or -1. */
+
+int MACRO::find_arg_index(const char *cp, int len)
+{
+    char            label[SYMMAX_MAX + 1];
+    int             i;
+
+    if (nargs == 0)
+        return -1;
+
+    if (len > Glb_symbol_len)
+        len = Glb_symbol_len;
+    memcpy(label, cp, len);
+    label[len] = 0;
+    if (symbols_to_upper)
+        upcase(label);
+
+    for (i = 0; i < nargs; i++) {
+        if (argidx[i].len == len && memcmp(argidx[i].arg->label, label, len) == 0)
+            return argidx[i].canon;
+    }
+
+    return -1;
+}
+
+/* compile_body turns the macro text into a template.  It finds the
+   argument names exactly where subst_args would: symbols as
+   get_symbol reads them, so nothing that starts with a digit. */
+
+void MACRO::compile_body()
+{
+    char           *in;
+    char           *begin;
+    char           *end;
+    int             alloc = 0;
+
+    free(tmpl);
+    tmpl = NULL;
+    npieces = 0;
+    free(used);
+    used = (char *)memcheck(calloc(nargs + 1, 1));
+
+    end = text->buffer + text->length;
+    for (begin = in = text->buffer;; ) {
+        char           *next;
+        int             slot = -1;
+
+        while (in < end) {
+            if (!issym(*in) || isdig(*in)) {
+                in++;
+                continue;
+            }
+
+            for (next = in + 1; issym(*next); next++) ;
+
+            if ((slot = find_arg_index(in, (int) (next - in))) >= 0)
+                break;
+            in = next;
+        }
+
+        if (npieces >= alloc) {
+            alloc += 16;
+            tmpl = (MACRO_PIECE *)memcheck(realloc(tmpl, alloc * sizeof(MACRO_PIECE)));
+        }
+
+        if (slot < 0) {
+            /* The rest of the text */
+            tmpl[npieces].offset = (int) (begin - text->buffer);
+            tmpl[npieces].len = (int) (in - begin);
+            tmpl[npieces].slot = -1;
+            npieces++;
+            break;
+        }
+
+        /* An apostrophe may appear before or after the symbol. */
+        /* In either case, remove it from the expansion. */
+
+        if (in > begin && in[-1] == '\'')
+            in--;
+        if (*next == '\'')
+            next++;
+
+        tmpl[npieces].offset = (int) (begin - text->buffer);
+        tmpl[npieces].len = (int) (in - begin);
+        tmpl[npieces].slot = slot;
+        npieces++;
+        used[slot] = 1;
+
+        in = begin = next;
+    }
+}
+
+/* use_template takes n pieces, compiled beforehand, as the template,
+   after checking that they stay within the text and the arguments,
+   and end as compile_body's do.  Returns FALSE, taking nothing, if
+   they don't. */
+
+int MACRO::use_template(MACRO_PIECE *pieces, int n)
+{
+    int             i;
+
+    if (n < 1 || pieces[n - 1].slot != -1)
+        return FALSE;
+    for (i = 0; i < n; i++) {
+        if (pieces[i].offset < 0 || pieces[i].len < 0 ||
+            pieces[i].offset > text->length - pieces[i].len ||
+            pieces[i].slot < -1 || pieces[i].slot >= nargs ||
+            (pieces[i].slot < 0 && i < n - 1))
+            return FALSE;
+    }
+
+    free(tmpl);
+    tmpl = pieces;
+    npieces = n;
+    free(used);
+    used = (char *)memcheck(calloc(nargs + 1, 1));
+    for (i = 0; i < n - 1; i++)
+        used[pieces[i].slot] = 1;
+    return TRUE;
+}
@@ -17,7 +17,41 @@ struct ARG {
     char    *value;      /* Default or active substitution */
 };
 
-/* A MACRO is a superstructure surrounding a SYMBOL. */
+/* Per-macro argument index, built once by defmacro, so that an
+   expansion can resolve argument names to positions without walking
+   or copying the ARG list. */
+
+struct ARG_INDEX {
+    ARG      *arg;        /* The argument */
+    int       len;        /* strlen(arg->label) */
+    int       canon;      /* Position of the first argument of this name */
+};
+
+/* A compiled macro body is a list of pieces: a run of literal text
+   from the body, followed by the value of an argument.  Apostrophe
+   concatenation has already been taken out of the literal runs. */
+
+struct MACRO_PIECE {
+    int       offset;     /* Start of the literal run in text */
+    int       len;        /* Its length */
+    int       slot;       /* Argument position to substitute, or -1 */
+};
+
+/* An ARG_SLICE is the value of one macro argument during an
+   expansion.  It points into the call line or into the macro's
+   default; only generated local labels and \expression values need
+   to be formatted, and they go into temp[]. */
+
+struct ARG_SLICE {
+    char     *text;       /* The value text (not terminated) */
+    int       len;        /* Its length */
+    int       given;      /* Supplied by the macro call */
+    int       pending;    /* A \expression, evaluated when first used */
+    char      temp[20];   /* Room for a generated value */
+};
+
+/* A MACRO is a superstructure surrounding a SYMBOL.  .IRP and .IRPC
+   use one, not entered in the macro table, for their compiled body. */
 
 struct MACRO : public SYMBOL {
     MACRO(char *label);
@@ -25,6 +59,20 @@ struct MACRO : public SYMBOL {
     // SYMBOL   *sym;        /* Surrounds a symbol, contains the macro name */
     ARG      *args;       /* The argument list */
     BUFFER   *text;       /* The macro text */
+    int       nargs;      /* Number of entries in argidx */
+    int       ndistinct;  /* Number of distinct argument names */
+    ARG_INDEX *argidx;    /* The arguments by position */
+    unsigned  generation; /* Distinguishes this definition from any
+                             other, even one at the same address */
+    int       npieces;    /* Number of entries in tmpl */
+    MACRO_PIECE *tmpl;    /* The compiled body */
+    char     *used;       /* Whether tmpl refers to each argument position */
+    char     *source;     /* Where it was defined, for the profiler */
+
+    void      index_args();
+    int       find_arg_index(const char *cp, int len);
+    void      compile_body();
+    int       use_template(MACRO_PIECE *pieces, int n);
 };
 
 struct MACRO_STREAM : public BUFFER_STREAM{
@@ -32,7 +80,7 @@ struct MACRO_STREAM : public BUFFER_STREAM{
     int       nargs;      /* Add number-of-macro-arguments */
     int       cond;       /* Add saved conditional stack */
 
-    MACRO_STREAM(STREAM *refstr, BUFFER *buf, MACRO *mac, ARG *args);
+    MACRO_STREAM(STREAM *refstr, BUFFER *buf, MACRO *mac, int nargs);
     virtual ~MACRO_STREAM() override;
 
     char      *gets() override { return BUFFER_STREAM::gets(); };
@@ -46,10 +94,16 @@ struct MACRO_STREAM : public BUFFER_STREAM{
 #endif
 
 MACRO  *defmacro(char *cp, STACK *stack, int called);
+MACRO  *restore_macro(char *label, ARG *args, BUFFER *text, MACRO_PIECE *pieces = NULL, int npieces = 0);
 STREAM *expandmacro(STREAM *refstr, MACRO *mac, char *cp);
 void     read_body(STACK *stack, BUFFER *gb, char *name, int called);
 void     eval_arg(STREAM *refstr, ARG *arg);
 BUFFER  *subst_args(BUFFER *text, ARG *args);
+char    *get_arg_slice(char *cp, ARG_SLICE *val);
+int      eval_slice(STREAM *refstr, ARG_SLICE *val);
+int      fill_template(BUFFER *gb, MACRO *mac, ARG_SLICE *vals, STREAM *refstr);
+void     macro_cache_stats(FILE *fp);
+void     free_macros(void);
 
 
 
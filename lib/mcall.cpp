@@ -0,0 +1,686 @@
+#define MCALL__C
+
+/*
+        Finding the macros for .MCALL
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#ifndef WIN32
+#include <dirent.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+
+#include "mcall.h"                     /* my own definitions */
+
+#include "util.h"
+#include "assemble_globals.h"
+
+
+static THREAD_LOCAL SYMBOL_TABLE mcall_st;          /* The index */
+static THREAD_LOCAL int      mcall_indexed;         /* Whether it has been built */
+static THREAD_LOCAL int      mcall_nr_mlbs;         /* How many libraries it has */
+
+THREAD_LOCAL char           *mcall_cache_dir = NULL;        /* The .MCALL cache directory */
+THREAD_LOCAL char           *mcall_path = NULL;     /* The .MCALL search path, if not $MCALL */
+
+
+MCALL_SOURCE::MCALL_SOURCE(char *label, MLB *_mlb, char *_file) : SYMBOL(label)
+{
+    mlb = _mlb;
+    file = _file ? (char *)memcheck(strdup(_file)) : NULL;
+    text = NULL;
+    length = 0;
+}
+
+MCALL_SOURCE::~MCALL_SOURCE()
+{
+    free(file);
+    free(text);
+}
+
+/* add_source enters a macro into the index, unless a source earlier
+   in the search order already has it. */
+
+static void add_source(char *label, MLB *mlb, char *file)
+{
+    if (mcall_st.lookup_sym(label) == NULL)
+        mcall_st.add_table(new MCALL_SOURCE(label, mlb, file));
+}
+
+#ifndef WIN32
+/* index_directory enters every NAME.MAC file of a directory. */
+
+static void index_directory(const char *dir)
+{
+    DIR            *dp;
+    struct dirent  *de;
+
+    dp = opendir(dir);
+    if (dp == NULL)
+        return;
+
+    while ((de = readdir(dp)) != NULL) {
+        int             len = strlen(de->d_name);
+        char           *path;
+        char           *label;
+
+        if (len <= 4 || strcmp(de->d_name + len - 4, ".MAC") != 0)
+            continue;
+
+        /* The same name my_searchenv would have built */
+        path = (char *)memcheck(malloc(strlen(dir) + len + 2));
+        strcpy(path, dir);
+        if (path[strlen(path) - 1] != '/')
+            strcat(path, "/");
+        strcat(path, de->d_name);
+
+        label = (char *)memcheck(strdup(de->d_name));
+        label[len - 4] = 0;
+        add_source(label, NULL, path);
+        free(label);
+        free(path);
+    }
+
+    closedir(dp);
+}
+#endif
+
+/* build_index fills the index from the -m libraries and the MCALL
+   path, unless a source hook stands in for the file system.  That's
+   done once, at the first .MCALL, when the options have all been
+   seen. */
+
+static void build_index(void)
+{
+    int             i,
+                    j;
+
+    mcall_indexed = 1;
+    mcall_nr_mlbs = nr_mlbs;
+
+    for (i = 0; i < nr_mlbs; i++)
+        for (j = 0; j < mlbs[i]->nentries; j++)
+            add_source(mlbs[i]->directory[j].label, mlbs[i], NULL);
+
+#ifndef WIN32
+    if (source_hook == NULL) {
+        const char     *path = mcall_search_path();
+        char           *pathcopy;
+        char           *rest;
+        char           *cp;
+
+        if (path == NULL)
+            return;
+
+        pathcopy = (char *)memcheck(strdup(path));
+        rest = pathcopy;
+        while ((cp = path_next(&rest)) != NULL)
+            index_directory(cp);
+        free(pathcopy);
+    }
+#endif
+}
+
+/* mcall_search_path returns the directories .MCALL searches for NAME.MAC
+   files: those -p gave this thread, or else the MCALL environment
+   variable's.  NULL if there are none. */
+
+const char *mcall_search_path(void)
+{
+    return mcall_path != NULL ? mcall_path : getenv("MCALL");
+}
+
+/* mcall_add_path adds a directory to the end of this thread's search
+   path, which starts out as the MCALL environment variable's. */
+
+void mcall_add_path(const char *dir)
+{
+    const char     *path = mcall_search_path();
+    char           *temp;
+
+    if (path == NULL)
+        path = "";
+
+    temp = (char *)memcheck(malloc(strlen(path) + strlen(dir) + 2));
+    strcpy(temp, path);
+    strcat(temp, PATHSEP);
+    strcat(temp, dir);
+    free(mcall_path);
+    mcall_path = temp;
+    mcall_reset();
+}
+
+/* mcall_reset forgets the index, with whatever it has learned about
+   missing macros, so the next .MCALL builds it again.  That happens
+   by itself when a library is added, or a directory with
+   mcall_add_path; whoever changes the path otherwise must call it. */
+
+void mcall_reset(void)
+{
+    int             i;
+
+    for (i = 0; i < HASH_SIZE; i++) {
+        while (mcall_st.hash[i] != NULL) {
+            SYMBOL         *sym = mcall_st.hash[i];
+
+            mcall_st.hash[i] = sym->next;
+            delete (MCALL_SOURCE *) sym;
+        }
+    }
+    mcall_indexed = 0;
+}
+
+/* mcall_find returns where the named macro can be found, or NULL.  A
+   name that can't be found is entered too, with neither library nor
+   file, so asking again costs one lookup. */
+
+MCALL_SOURCE *mcall_find(char *label)
+{
+    MCALL_SOURCE   *src;
+
+    if (mcall_indexed && mcall_nr_mlbs != nr_mlbs)
+        mcall_reset();
+    if (!mcall_indexed)
+        build_index();
+
+    src = (MCALL_SOURCE *) mcall_st.lookup_sym(label);
+    if (src != NULL)
+        return src->mlb != NULL || src->file != NULL ? src : NULL;
+
+    if (source_hook != NULL) {
+        const char     *text;
+        int             len;
+
+        text = source_hook(source_arg, SOURCE_MCALL, label, &len);
+        src = new MCALL_SOURCE(label, NULL, text != NULL ? label : NULL);
+        if (text != NULL) {
+            src->text = (char *)memcheck(malloc(len + 1));
+            memcpy(src->text, text, len);
+            src->length = len;
+        }
+        mcall_st.add_table(src);
+        return text != NULL ? src : NULL;
+    }
+
+#ifdef WIN32
+    /* Directories aren't indexed here; search the path for it */
+    if (src == NULL) {
+        char            macfile[FILENAME_MAX];
+        char            hitfile[FILENAME_MAX];
+
+        strncpy(macfile, label, sizeof(macfile));
+        strncat(macfile, ".MAC", sizeof(macfile) - strlen(macfile) - 1);
+        my_searchpath(macfile, mcall_search_path(), hitfile, sizeof(hitfile));
+        if (hitfile[0]) {
+            src = new MCALL_SOURCE(label, NULL, hitfile);
+            mcall_st.add_table(src);
+            return src;
+        }
+    }
+#endif
+
+    mcall_st.add_table(new MCALL_SOURCE(label, NULL, NULL));
+    return NULL;
+}
+
+/* mcall_open returns a STREAM that reads the macro's source text, or
+   NULL if it can't be read. */
+
+STREAM *mcall_open(MCALL_SOURCE *src)
+{
+    STREAM         *str = NULL;
+
+    if (src->mlb != NULL) {
+        BUFFER         *buf = mlb_entry(src->mlb, src->label);
+
+        if (buf != NULL) {
+            str = new BUFFER_STREAM(buf, src->label);
+            buffer_free(buf);
+        }
+    } else {
+        FILE_STREAM    *fstr = new FILE_STREAM();
+
+        if (src->text != NULL ? fstr->init_text(src->file, src->text, src->length) : fstr->init(src->file))
+            str = fstr;
+        else
+            delete fstr;
+    }
+
+    if (str != NULL && show_mcall)
+        fprintf(stderr, ".MCALL %s from %s\n", src->label, src->mlb ? src->mlb->name : src->file);
+
+    return str;
+}
+
+/* *** The .MCALL cache
+
+   Each cached macro is a file in mcall_cache_dir.  Its name is a hash
+   of the key, which names the source (library or file, and the entry
+   in it), gives the length and a hash of the source's text, and the
+   options that change how macros are parsed.  The key is also stored in the
+   file and checked, so a hash collision is just a miss.
+
+   The file holds the key, the macro's definition (its name and
+   arguments: local symbol flag, name, default) and the body text;
+   strings are preceded by their lengths.  Native macro libraries
+   keep definitions in the same form.  It is written under a temporary name and renamed
+   into place, so a macro11 running at the same time sees either the
+   whole file or none.  The temporary name is the process's and a
+   count, so threads of one process don't share one either. */
+
+#define CACHE_MAGIC "MACRO11 MCALL CACHE 1"
+
+static std::atomic<unsigned> temp_count;       /* For temporary names */
+
+/* mcall_options returns the options that change how macros are
+   parsed, as a string. */
+
+const char     *mcall_options(void)
+{
+    static THREAD_LOCAL char     options[32];
+
+    snprintf(options, sizeof(options), "%d|%d|%d", Glb_symbol_len, Glb_symbol_allow_underscores,
+             symbols_to_upper);
+    return options;
+}
+
+/* hash_text adds text to an FNV-1a hash */
+
+static ulong64 hash_text(ulong64 hash, const char *text, long len)
+{
+    long            i;
+
+    for (i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char) text[i]) * 1099511628211ULL;
+    return hash;
+}
+
+/* source_text finds the text of a source, to hash: a library entry
+   where it lies, or a file read into *data, which the caller frees.
+   Returns FALSE if it can't. */
+
+static int source_text(MCALL_SOURCE *src, const char **text, long *len, char **data)
+{
+    FILE           *fp;
+    long            size;
+
+    *data = NULL;
+    if (src->mlb != NULL) {
+        MLBENT         *ent = mlb_find(src->mlb, src->label);
+
+        if (ent == NULL)
+            return FALSE;
+        *text = src->mlb->data + ent->position;
+        *len = ent->length;
+        return TRUE;
+    }
+
+    if ((fp = fopen(src->file, "rb")) == NULL)
+        return FALSE;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    *data = (char *)memcheck(malloc(size > 0 ? size : 1));
+    if (size < 0 || fread(*data, 1, size, fp) < (size_t) size) {
+        fclose(fp);
+        free(*data);
+        *data = NULL;
+        return FALSE;
+    }
+    fclose(fp);
+    *text = *data;
+    *len = size;
+    return TRUE;
+}
+
+/* cache_file works out the key and the file name for a source.
+   Returns FALSE if the source isn't a file that can be read. */
+
+static int cache_file(MCALL_SOURCE *src, char *key, int keysize, char *file, int filesize)
+{
+    const char     *path = src->mlb ? src->mlb->name : src->file;
+    const char     *text;
+    long            len;
+    char           *data;
+    ulong64         hash = 14695981039346656037ULL;     /* FNV-1a */
+
+    if (src->text != NULL || !source_text(src, &text, &len, &data))
+        return FALSE;                  /* Not from a file */
+
+    /* The text's own hash, as a file can change within the second
+       its time stamp gives */
+    snprintf(key, keysize, "%s|%s|%ld|%016llx|%s", path, src->label, len,
+             (unsigned long long) hash_text(hash, text, len), mcall_options());
+    free(data);
+
+    hash = hash_text(hash, key, (long) strlen(key));
+    snprintf(file, filesize, "%s/%016llx.m11", mcall_cache_dir, (unsigned long long) hash);
+    return TRUE;
+}
+
+/* get_number and get_string take fields out of a cache file image.
+   Each is followed by one separator character. */
+
+static int get_number(char **cpp, char *end, long *value)
+{
+    char           *cp = *cpp;
+
+    *value = strtol(cp, &cp, 10);
+    if (cp == *cpp || cp >= end)
+        return FALSE;
+    *cpp = cp + 1;
+    return TRUE;
+}
+
+static int get_string(char **cpp, char *end, long len, char **str)
+{
+    if (len < 0 || end - *cpp < len + 1)
+        return FALSE;
+    *str = (char *)memcheck(malloc(len + 1));
+    memcpy(*str, *cpp, len);
+    (*str)[len] = 0;
+    *cpp += len + 1;
+    return TRUE;
+}
+
+/* read_cache_file reads the whole file into memory, NUL-terminated. */
+
+static char *read_cache_file(char *file, long *sizep)
+{
+    FILE           *fp;
+    char           *data;
+    long            size;
+
+    fp = fopen(file, "rb");
+    if (fp == NULL)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size <= 0) {
+        fclose(fp);
+        return NULL;
+    }
+
+    data = (char *)memcheck(malloc(size + 1));
+    if (fread(data, 1, size, fp) < (size_t) size) {
+        fclose(fp);
+        free(data);
+        return NULL;
+    }
+    fclose(fp);
+
+    data[size] = 0;
+    *sizep = size;
+    return data;
+}
+
+/* get_definition takes a macro's name and arguments out of a cache
+   file image or a native library.  Returns FALSE, with nothing
+   allocated, if they aren't sound. */
+
+static int get_definition(char **cpp, char *end, char **labelp, ARG **argsp)
+{
+    char           *label = NULL;
+    long            len,
+                    nargs;
+    ARG            *args = NULL,
+                  **argtail = &args;
+
+    if (!get_number(cpp, end, &len) || !get_string(cpp, end, len, &label))
+        goto fail;
+
+    if (!get_number(cpp, end, &nargs))
+        goto fail;
+    while (nargs-- > 0) {
+        ARG            *arg = new ARG();
+        long            locsym;
+
+        *argtail = arg;
+        argtail = &arg->next;
+        if (!get_number(cpp, end, &locsym) || !get_number(cpp, end, &len) ||
+            !get_string(cpp, end, len, &arg->label) || !get_number(cpp, end, &len))
+            goto fail;
+        arg->locsym = locsym;
+        if (len >= 0 && !get_string(cpp, end, len, &arg->value))
+            goto fail;
+    }
+
+    *labelp = label;
+    *argsp = args;
+    return TRUE;
+
+  fail:
+    while (args) {
+        ARG            *next = args->next;
+
+        delete args;
+        args = next;
+    }
+    free(label);
+    return FALSE;
+}
+
+/* mcall_put_definition appends the macro's name and arguments to
+   buf, in the form get_definition reads. */
+
+void mcall_put_definition(BUFFER *buf, MACRO *mac)
+{
+    char            num[64];
+    ARG            *arg;
+    int             nargs;
+
+    snprintf(num, sizeof(num), "%d ", (int) strlen(mac->label));
+    buf->buffer_appendn(num, strlen(num));
+    buf->buffer_appendn(mac->label, strlen(mac->label));
+    buf->buffer_appendn((char *) "\n", 1);
+
+    for (nargs = 0, arg = mac->args; arg != NULL; arg = arg->next)
+        nargs++;
+    snprintf(num, sizeof(num), "%d\n", nargs);
+    buf->buffer_appendn(num, strlen(num));
+
+    for (arg = mac->args; arg != NULL; arg = arg->next) {
+        snprintf(num, sizeof(num), "%d %d ", arg->locsym, (int) strlen(arg->label));
+        buf->buffer_appendn(num, strlen(num));
+        buf->buffer_appendn(arg->label, strlen(arg->label));
+        if (arg->value) {
+            snprintf(num, sizeof(num), " %d ", (int) strlen(arg->value));
+            buf->buffer_appendn(num, strlen(num));
+            buf->buffer_appendn(arg->value, strlen(arg->value));
+            buf->buffer_appendn((char *) "\n", 1);
+        } else
+            buf->buffer_appendn((char *) " -1\n", 4);
+    }
+}
+
+/* mcall_put_template appends the macro's compiled body to buf: the
+   number of pieces, then each piece's offset, length and argument
+   slot (-1 for none), as get_template reads them.  */
+
+void mcall_put_template(BUFFER *buf, MACRO *mac)
+{
+    char            num[64];
+    int             i;
+
+    snprintf(num, sizeof(num), "%d\n", mac->npieces);
+    buf->buffer_appendn(num, strlen(num));
+    for (i = 0; i < mac->npieces; i++) {
+        snprintf(num, sizeof(num), "%d %d %d\n", mac->tmpl[i].offset, mac->tmpl[i].len,
+                 mac->tmpl[i].slot);
+        buf->buffer_appendn(num, strlen(num));
+    }
+}
+
+/* get_template takes a compiled body out of a native library.  Returns
+   NULL if it isn't sound; restore_macro checks it against the body. */
+
+static MACRO_PIECE *get_template(char *cp, char *end, int *np)
+{
+    MACRO_PIECE    *pieces;
+    long            n,
+                    offset,
+                    len,
+                    slot;
+    int             i;
+
+    if (!get_number(&cp, end, &n) || n < 1 || n > end - cp)
+        return NULL;
+    pieces = (MACRO_PIECE *)memcheck(malloc(n * sizeof(MACRO_PIECE)));
+    for (i = 0; i < n; i++) {
+        if (!get_number(&cp, end, &offset) || !get_number(&cp, end, &len) ||
+            !get_number(&cp, end, &slot)) {
+            free(pieces);
+            return NULL;
+        }
+        pieces[i].offset = (int) offset;
+        pieces[i].len = (int) len;
+        pieces[i].slot = (int) slot;
+    }
+
+    *np = (int) n;
+    return pieces;
+}
+
+/* mcall_compiled defines the macro from the definition a native
+   library keeps for it, if it has one made under the same options.
+   The body is used where it lies in the library, along with its
+   template, so the body needn't be scanned for arguments again.
+   Returns NULL if there's no such definition. */
+
+MACRO *mcall_compiled(MCALL_SOURCE *src)
+{
+    MLBENT         *ent;
+    char           *cp,
+                   *label;
+    ARG            *args;
+    MACRO          *mac;
+    MACRO_PIECE    *pieces;
+    int             npieces = 0;
+
+    if (src->mlb == NULL || !src->mlb->native || strcmp(src->mlb->options, mcall_options()) != 0)
+        return NULL;
+    if ((ent = mlb_find(src->mlb, src->label)) == NULL || ent->def == NULL)
+        return NULL;
+
+    cp = ent->def;
+    if (!get_definition(&cp, ent->def + ent->deflen, &label, &args))
+        return NULL;
+
+    pieces = get_template(ent->tmpl, ent->tmpl + ent->tmpllen, &npieces);
+    mac = restore_macro(label, args, new BUFFER(ent->body, ent->bodylen), pieces, npieces);
+    free(label);
+
+    if (show_mcall)
+        fprintf(stderr, ".MCALL %s from %s (precompiled)\n", src->label, src->mlb->name);
+
+    return mac;
+}
+
+/* mcall_cache_load defines the macro from its cache file, if there's
+   a valid one.  Returns NULL if not. */
+
+MACRO *mcall_cache_load(MCALL_SOURCE *src)
+{
+    char            key[FILENAME_MAX + 128];
+    char            file[FILENAME_MAX];
+    char           *data,
+                   *cp,
+                   *end,
+                   *str = NULL,
+                   *label = NULL;
+    long            size,
+                    len;
+    ARG            *args = NULL;
+    BUFFER         *text;
+    MACRO          *mac = NULL;
+
+    if (mcall_cache_dir == NULL || !cache_file(src, key, sizeof(key), file, sizeof(file)))
+        return NULL;
+
+    if ((data = read_cache_file(file, &size)) == NULL)
+        return NULL;
+    cp = data;
+    end = data + size;
+
+    if (strncmp(cp, CACHE_MAGIC "\n", strlen(CACHE_MAGIC) + 1) != 0)
+        goto done;
+    cp += strlen(CACHE_MAGIC) + 1;
+
+    /* Check that it's really for this source */
+    if (!get_number(&cp, end, &len) || !get_string(&cp, end, len, &str))
+        goto done;
+    if (strcmp(str, key) != 0)
+        goto done;
+
+    if (!get_definition(&cp, end, &label, &args))
+        goto done;
+
+    if (!get_number(&cp, end, &len) || len < 0 || end - cp != len) {
+        while (args) {
+            ARG            *next = args->next;
+
+            delete args;
+            args = next;
+        }
+        goto done;
+    }
+    text = new BUFFER();
+    if (len > 0)
+        text->buffer_appendn(cp, len);
+
+    mac = restore_macro(label, args, text);
+
+    if (show_mcall)
+        fprintf(stderr, ".MCALL %s from %s (cached)\n", src->label, src->mlb ? src->mlb->name : src->file);
+
+  done:
+    free(label);
+    free(str);
+    free(data);
+    return mac;
+}
+
+/* mcall_cache_save writes the macro's definition to the cache. */
+
+void mcall_cache_save(MCALL_SOURCE *src, MACRO *mac)
+{
+    char            key[FILENAME_MAX + 128];
+    char            file[FILENAME_MAX];
+    char            temp[FILENAME_MAX + 32];
+    FILE           *fp;
+    BUFFER         *def;
+
+    if (mcall_cache_dir == NULL || !cache_file(src, key, sizeof(key), file, sizeof(file)))
+        return;
+
+    snprintf(temp, sizeof(temp), "%s.%d.%u.tmp", file, (int) getpid(), temp_count++);
+    fp = fopen(temp, "wb");
+    if (fp == NULL)
+        return;
+
+    fprintf(fp, "%s\n", CACHE_MAGIC);
+    fprintf(fp, "%d %s\n", (int) strlen(key), key);
+
+    def = new BUFFER();
+    mcall_put_definition(def, mac);
+    fwrite(def->buffer, 1, def->length, fp);
+    buffer_free(def);
+
+    fprintf(fp, "%d\n", mac->text->length);
+    fwrite(mac->text->buffer, 1, mac->text->length, fp);
+
+    if (ferror(fp)) {
+        fclose(fp);
+        remove(temp);
+        return;
+    }
+    if (fclose(fp) != 0 || rename(temp, file) != 0)
+        remove(temp);
+}
@@ -0,0 +1,56 @@
+#ifndef MCALL__H
+#define MCALL__H
+
+/* The .MCALL index: where each macro that .MCALL can pull in comes
+   from.  The directories of all the -m macro libraries and the files
+   in the MCALL search path are merged into one table, in the order
+   they're searched: the first library wins, then the libraries in
+   command line order, then the directories in path order. */
+
+#include <stdio.h>
+
+#include "mlb.h"
+#include "stream2.h"
+#include "symbols.h"
+#include "macros.h"
+
+struct MCALL_SOURCE : public SYMBOL {
+    MCALL_SOURCE(char *label, MLB *mlb, char *file);
+    ~MCALL_SOURCE();
+    MLB      *mlb;        /* The macro library it's in... */
+    char     *file;       /* ...or else the .MAC file; neither if
+                             it's known not to be anywhere */
+    char     *text;       /* The text the source hook gave, if it
+                             came from there; file is its name */
+    int       length;
+};
+
+#ifndef MCALL__C
+extern THREAD_LOCAL char *mcall_path;            /* The search path, or NULL for $MCALL */
+#endif
+
+MCALL_SOURCE *mcall_find(char *label);
+void          mcall_reset(void);
+const char   *mcall_search_path(void);
+void          mcall_add_path(const char *dir);
+STREAM       *mcall_open(MCALL_SOURCE *src);
+
+/* The .MCALL cache keeps macro definitions, parsed, in files in a
+   directory, so the next run can skip reading and parsing them. */
+
+#ifndef MCALL__C
+extern THREAD_LOCAL char *mcall_cache_dir;       /* The cache directory, or NULL */
+#endif
+
+MACRO        *mcall_cache_load(MCALL_SOURCE *src);
+void          mcall_cache_save(MCALL_SOURCE *src, MACRO *mac);
+
+/* Native macro libraries keep definitions made beforehand, in the
+   same form as the cache. */
+
+const char   *mcall_options(void);
+void          mcall_put_definition(BUFFER *buf, MACRO *mac);
+void          mcall_put_template(BUFFER *buf, MACRO *mac);
+MACRO        *mcall_compiled(MCALL_SOURCE *src);
+
+#endif
@@ -37,6 +37,19 @@ DAMAGE.
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "rad50.h"
 
@@ -49,6 +62,7 @@ DAMAGE.
 #include "util.h"
 
 #define WORD(cp) ((*(cp) & 0xff) + ((*((cp)+1) & 0xff) << 8))
+#define LONG(cp) (WORD(cp) + ((unsigned long) WORD((cp)+2) << 16))
 
 /* BYTEPOS calculates the byte position within the macro libray file.
    I use this to sort the entries by their start position, in order to
@@ -57,8 +71,6 @@ DAMAGE.
 
 #define BYTEPOS(rec) ((WORD((rec)+4) & 32767) * 512 + (WORD((rec)+6) & 511))
 
-extern FILE    *lstfile;
-
 /* compare_position is the qsort callback function that compares byte
    locations within the macro library */
 static int compare_position(const void *arg1, const void *arg2)
@@ -83,6 +95,281 @@ static void trim(char *buf)
         *cp = 0;
 }
 
+/* map_file makes the whole library file available at mlb->data:
+   mapped where the system can, otherwise read into memory.  Returns
+   FALSE on failure. */
+
+static int map_file(MLB *mlb, char *name)
+{
+#ifndef WIN32
+    int             fd;
+    struct stat     st;
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0)
+        return FALSE;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return FALSE;
+    }
+    mlb->size = st.st_size;
+    /* Writable, but private: macro text is handed out in place from
+       native libraries, and nothing written to it reaches the file */
+    mlb->data = (char *) mmap(NULL, mlb->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mlb->data == (char *) MAP_FAILED) {
+        mlb->data = NULL;
+        return FALSE;
+    }
+    mlb->mapped = TRUE;
+    return TRUE;
+#else
+    FILE           *fp;
+    long            size;
+
+    fp = fopen(name, "rb");
+    if (fp == NULL)
+        return FALSE;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size <= 0) {
+        fclose(fp);
+        return FALSE;
+    }
+    mlb->size = size;
+    mlb->data = (char *)memcheck(malloc(size));
+    if (fread(mlb->data, 1, size, fp) < (size_t) size) {
+        fclose(fp);
+        return FALSE;
+    }
+    fclose(fp);
+    return TRUE;
+#endif
+}
+
+/* mlb_hash hashes a directory entry name for mlb->index, and for
+   the extended index that mlb_write can add to a library. */
+
+unsigned mlb_hash(const char *label)
+{
+    unsigned        hash = 0;
+
+    while (*label)
+        hash = hash * 31 + (unsigned char) *label++;
+    return hash;
+}
+
+/* index_directory builds the hash index of the directory.  The
+   index is at least twice the size of the directory, so probe
+   sequences stay short.  If a name appears twice, the first entry
+   (by file position, as the directory is sorted) is kept, which is
+   the one the linear search used to find. */
+
+static void index_directory(MLB *mlb)
+{
+    unsigned        size;
+    int             i;
+
+    for (size = 16; size < (unsigned) mlb->nentries * 2; size <<= 1) ;
+    mlb->indexmask = size - 1;
+    mlb->index = (int *)memcheck(malloc(size * sizeof(int)));
+    for (i = 0; i < (int) size; i++)
+        mlb->index[i] = -1;
+
+    for (i = 0; i < mlb->nentries; i++) {
+        unsigned        h = mlb_hash(mlb->directory[i].label) & mlb->indexmask;
+
+        while (mlb->index[h] >= 0) {
+            if (strcmp(mlb->directory[mlb->index[h]].label, mlb->directory[i].label) == 0)
+                break;
+            h = (h + 1) & mlb->indexmask;
+        }
+        if (mlb->index[h] < 0)
+            mlb->index[h] = i;
+    }
+}
+
+/* The extended index.  mlb_write can put it in the block(s) right
+   after the directory, where RT-11 doesn't look.  It holds the
+   directory already decoded, with each entry's length, and the hash
+   table mlb->index would otherwise be built into:
+
+        "M11XIDX1"
+        4 bytes         number of entries (= directory entries)
+        4 bytes         size of the hash table, a power of 2
+        16 bytes each   entry: name (NUL padded), position, length
+        2 bytes each    hash table: entry number, or 0177777
+
+   All numbers are little-endian, like the rest of the file. */
+
+#define MLB_XMAGIC "M11XIDX1"
+#define MLB_XHEAD 16                   /* Size of the fixed part */
+#define MLB_XENT 16                    /* Size of an entry */
+
+/* read_xindex sets up the directory and index from an extended
+   index, if there's a sound one after the directory ending at
+   dirend, which has room for count entries.  Returns FALSE if not. */
+
+static int read_xindex(MLB *mlb, unsigned long dirend, unsigned count)
+{
+    unsigned long   pos = (dirend + 511) & ~511UL;
+    char           *xp;
+    unsigned long   n,
+                    hsize,
+                    i;
+    int             empty = 0;
+
+    if (pos + MLB_XHEAD > mlb->size)
+        return FALSE;
+    xp = mlb->data + pos;
+    if (memcmp(xp, MLB_XMAGIC, 8) != 0)
+        return FALSE;
+
+    n = LONG(xp + 8);
+    hsize = LONG(xp + 12);
+    /* All in unsigned long, and compared so nothing can wrap */
+    if (n > count || hsize < 16 || (hsize & (hsize - 1)) != 0 || hsize <= n ||
+        hsize > mlb->size || n * MLB_XENT + hsize * 2 > mlb->size - pos - MLB_XHEAD)
+        return FALSE;
+
+    for (i = 0; i < n; i++) {
+        char           *ent = xp + MLB_XHEAD + i * MLB_XENT;
+
+        if (LONG(ent + 8) > mlb->size || LONG(ent + 12) > mlb->size - LONG(ent + 8) ||
+            memchr(ent, 0, 8) == NULL)
+            return FALSE;
+    }
+
+    /* mlb_find stops at an empty slot, so there must be one */
+    for (i = 0; i < hsize; i++)
+        if ((unsigned long) WORD(xp + MLB_XHEAD + n * MLB_XENT + i * 2) >= n)
+            empty = 1;
+    if (!empty)
+        return FALSE;
+
+    mlb->nentries = n;
+    mlb->directory = (MLBENT *)memcheck(malloc(sizeof(MLBENT) * (n + 1)));
+    memset(mlb->directory, 0, sizeof(MLBENT) * n);
+    for (i = 0; i < n; i++) {
+        char           *ent = xp + MLB_XHEAD + i * MLB_XENT;
+
+        mlb->directory[i].label = (char *)memcheck(strdup(ent));
+        mlb->directory[i].position = LONG(ent + 8);
+        mlb->directory[i].length = LONG(ent + 12);
+    }
+
+    xp += MLB_XHEAD + n * MLB_XENT;
+    mlb->indexmask = hsize - 1;
+    mlb->index = (int *)memcheck(malloc(hsize * sizeof(int)));
+    for (i = 0; i < hsize; i++) {
+        unsigned        e = WORD(xp + i * 2);
+
+        mlb->index[i] = e < n ? (int) e : -1;
+    }
+
+    return TRUE;
+}
+
+/* The native library format, which macrolib -n writes.  It isn't
+   limited to RT-11 names, and it keeps everything mlb_entry and
+   .MCALL need ready to use in place:
+
+        "M11NLIB2"
+        4 bytes         number of entries
+        4 bytes         size of the hash table, a power of 2
+        4 bytes         position of the options string
+        4 bytes         zero
+        40 bytes each   entry: positions and lengths of the name, the
+                        text, the definition, the body and the body's
+                        template, with the name's length in place of
+                        a zero
+        4 bytes each    hash table: entry number, or 037777777777;
+                        at least one is empty
+
+   The name and the four strings each end in a NUL, past their
+   lengths.  The text is the member's source, without CRs.  The
+   definition, body and template are what defmacro made of the
+   member's first macro, with the options string saying under which
+   options: the definition holds the macro's name and arguments, in
+   the form of the .MCALL cache, the body is the macro's text, and
+   the template is where in the body its arguments are substituted
+   (see mcall_put_template).  They're absent (zero length) if the
+   member doesn't define a macro.  */
+
+#define MLB_NMAGIC "M11NLIB2"
+#define MLB_NHEAD 24                   /* Size of the fixed part */
+#define MLB_NENT 40                    /* Size of an entry */
+
+/* native_string checks that a string of the native library lies
+   within the file, and ends with a NUL. */
+
+static int native_string(MLB *mlb, unsigned long pos, unsigned long len)
+{
+    return pos < mlb->size && len < mlb->size - pos && mlb->data[pos + len] == 0;
+}
+
+/* read_native sets up the directory of a native library.  Returns
+   FALSE if it isn't sound. */
+
+static int read_native(MLB *mlb)
+{
+    char           *hp = mlb->data;
+    unsigned        n,
+                    hsize,
+                    i;
+    int             empty = FALSE;
+
+    n = LONG(hp + 8);
+    hsize = LONG(hp + 12);
+    if (hsize < 16 || (hsize & (hsize - 1)) != 0 || hsize <= n ||
+        MLB_NHEAD + (unsigned long) n * MLB_NENT + hsize * 4UL > mlb->size ||
+        LONG(hp + 16) >= mlb->size || memchr(mlb->data + LONG(hp + 16), 0, mlb->size - LONG(hp + 16)) == NULL)
+        return FALSE;
+
+    mlb->native = TRUE;
+    mlb->options = mlb->data + LONG(hp + 16);
+    mlb->nentries = n;
+    mlb->directory = (MLBENT *)memcheck(malloc(sizeof(MLBENT) * (n + 1)));
+    memset(mlb->directory, 0, sizeof(MLBENT) * n);
+    for (i = 0; i < n; i++) {
+        char           *ent = hp + MLB_NHEAD + i * MLB_NENT;
+        MLBENT         *me = &mlb->directory[i];
+
+        if (!native_string(mlb, LONG(ent), LONG(ent + 28)) ||
+            !native_string(mlb, LONG(ent + 4), LONG(ent + 8)) ||
+            !native_string(mlb, LONG(ent + 12), LONG(ent + 16)) ||
+            !native_string(mlb, LONG(ent + 20), LONG(ent + 24)) ||
+            !native_string(mlb, LONG(ent + 32), LONG(ent + 36)))
+            return FALSE;
+
+        me->label = mlb->data + LONG(ent);
+        me->position = LONG(ent + 4);
+        me->length = LONG(ent + 8);
+        if (LONG(ent + 16) > 0) {
+            me->def = mlb->data + LONG(ent + 12);
+            me->deflen = LONG(ent + 16);
+            me->body = mlb->data + LONG(ent + 20);
+            me->bodylen = LONG(ent + 24);
+            me->tmpl = mlb->data + LONG(ent + 32);
+            me->tmpllen = LONG(ent + 36);
+        }
+    }
+
+    hp += MLB_NHEAD + n * MLB_NENT;
+    mlb->indexmask = hsize - 1;
+    mlb->index = (int *)memcheck(malloc(hsize * sizeof(int)));
+    for (i = 0; i < hsize; i++) {
+        unsigned long   e = LONG(hp + i * 4);
+
+        mlb->index[i] = e < n ? (int) e : -1;
+        if (e >= n)
+            empty = TRUE;
+    }
+
+    return empty;                      /* Or a search might not end */
+}
+
 /* mlb_open opens a file which is given to be a macro library. */
 /* Returns NULL on failure. */
 
@@ -95,22 +382,33 @@ MLB *mlb_open(char *name)
     unsigned        start_block;
     int             i;
 
+    mlb->name = (char *)memcheck(strdup(name));
     mlb->directory = NULL;
-
-    mlb->fp = fopen(name, "rb");
-    if (mlb->fp == NULL) {
+    mlb->nentries = 0;
+    mlb->index = NULL;
+    mlb->data = NULL;
+    mlb->mapped = FALSE;
+    mlb->native = FALSE;
+    mlb->options = NULL;
+
+    if (!map_file(mlb, name)) {
         mlb_close(mlb);
         return NULL;
     }
 
-    buff = (char *)memcheck(malloc(044));      /* Size of MLB library header */
+    if (mlb->size >= MLB_NHEAD && memcmp(mlb->data, MLB_NMAGIC, 8) == 0) {
+        if (read_native(mlb))
+            return mlb;
+        mlb_close(mlb);
+        return NULL;
+    }
 
-    if (fread(buff, 1, 044, mlb->fp) < 044) {
+    if (mlb->size < 044) {             /* Size of MLB library header */
         mlb_close(mlb);
-        free(buff);
         return NULL;
     }
 
+    buff = mlb->data;
     if (WORD(buff) != 01001) {         /* Is this really a macro library? */
         mlb_close(mlb);                /* Nope. */
         return NULL;
@@ -122,19 +420,18 @@ MLB *mlb_open(char *name)
     start_block = WORD(buff + 034);    /* The start RT-11 block of the
                                           directory */
 
-    free(buff);                        /* Done with that header. */
-
-    /* Allocate a buffer for the disk directory */
-    buff = (char *)memcheck(malloc(nr_entries * entsize));
-    fseek(mlb->fp, start_block * 512, SEEK_SET);        /* Go to the directory */
-
-    /* Read the disk directory */
-    if (fread(buff, entsize, nr_entries, mlb->fp) < nr_entries) {
-        mlb_close(mlb);                /* Sorry, read error. */
-        free(buff);
+    if (entsize < 8 || (unsigned long) start_block * 512 + nr_entries * entsize > mlb->size) {
+        mlb_close(mlb);                /* Sorry, no room for the directory. */
         return NULL;
     }
 
+    if (read_xindex(mlb, (unsigned long) start_block * 512 + nr_entries * entsize, nr_entries))
+        return mlb;                    /* All done already */
+
+    /* Copy the disk directory, which gets rearranged below */
+    buff = (char *)memcheck(malloc(nr_entries * entsize));
+    memcpy(buff, mlb->data + start_block * 512, nr_entries * entsize);
+
     /* Shift occupied directory entries to the front of the array
        before sorting */
     {
@@ -168,13 +465,14 @@ MLB *mlb_open(char *name)
         qsort(buff, i, entsize, compare_position);
 
         /* Now, allocate my in-memory directory */
-        mlb->directory = (MLBENT *)memcheck(malloc(sizeof(MLBENT) * mlb->nentries));
+        mlb->directory = (MLBENT *)memcheck(malloc(sizeof(MLBENT) * (mlb->nentries + 1)));
         memset(mlb->directory, 0, sizeof(MLBENT) * mlb->nentries);
 
         /* Build in-memory directory */
         for (j = 0; j < i; j++) {
             char            radname[16];
             char           *ent;
+            unsigned long   end;
 
             ent = buff + (j * entsize);
 
@@ -187,91 +485,509 @@ MLB *mlb_open(char *name)
             mlb->directory[j].label = (char *)memcheck(strdup(radname));
             mlb->directory[j].position = BYTEPOS(ent);
             if (j < i - 1) {
-                mlb->directory[j].length = BYTEPOS(ent + entsize) - BYTEPOS(ent);
+                end = BYTEPOS(ent + entsize);
             } else {
-                unsigned long   max;
-                char            c;
-
-                fseek(mlb->fp, 0, SEEK_END);
-                max = ftell(mlb->fp);
                 /* Look for last non-zero */
-                do {
-                    max--;
-                    fseek(mlb->fp, max, SEEK_SET);
-                    c = fgetc(mlb->fp);
-                } while (max > 0 && c == 0);
-                max++;
-                mlb->directory[j].length = max - BYTEPOS(ent);
+                end = mlb->size;
+                while (end > 1 && mlb->data[end - 1] == 0)
+                    end--;
             }
+
+            /* Keep entries inside the file */
+            if (mlb->directory[j].position > mlb->size)
+                mlb->directory[j].position = mlb->size;
+            if (end > mlb->size)
+                end = mlb->size;
+            if (end < mlb->directory[j].position)
+                end = mlb->directory[j].position;
+            mlb->directory[j].length = end - mlb->directory[j].position;
         }
 
         free(buff);
     }
 
+    index_directory(mlb);
+
     /* Done.  Return the struct that represents the opened MLB. */
     return mlb;
 }
 
-/* mlb_close discards MLB and closes the file. */
+/* The libraries mlb_open_all is opening, shared by its threads */
+
+struct MLB_OPEN_JOB {
+    int       count;      /* How many */
+    char    **names;      /* Their file names */
+    MLB     **mlbs;       /* Where each one goes */
+    std::atomic<int> next;        /* The next one not yet taken */
+};
+
+static void open_worker(MLB_OPEN_JOB *job)
+{
+    int             i;
+
+    while ((i = job->next++) < job->count)
+        job->mlbs[i] = mlb_open(job->names[i]);
+}
+
+#define MLB_OPEN_THREADS 8             /* Most threads mlb_open_all uses */
+
+/* mlb_open_all opens count macro libraries together, on a few
+   threads, since most of the time goes in waiting for the disk.
+   mlbs[i] gets the library named names[i], or NULL if it can't be
+   opened, just as from mlb_open; which threads did what makes no
+   difference to the result.  The threads start with none of this
+   thread's settings (-ysl, -yus, the cache), and need none: mlb_open
+   reads no settings.  A native library's options are checked against
+   them later, by mcall on this thread, when a macro is looked up. */
+
+void mlb_open_all(int count, char **names, MLB **mlbs)
+{
+    MLB_OPEN_JOB    job;
+    std::vector<std::thread> threads;
+    int             nthreads = MLB_OPEN_THREADS;  /* Waiting, not computing */
+    int             i;
+
+    job.count = count;
+    job.names = names;
+    job.mlbs = mlbs;
+    job.next = 0;
+
+    if (nthreads > count)
+        nthreads = count;
+
+    /* This thread is one of them */
+    for (i = 1; i < nthreads; i++) {
+        try {
+            threads.emplace_back(open_worker, &job);
+        } catch (const std::system_error &) {
+            break;                     /* Do with what there is */
+        }
+    }
+
+    open_worker(&job);
+
+    for (i = 0; i < (int) threads.size(); i++)
+        threads[i].join();
+}
+
+/* mlb_close discards MLB and unmaps the file. */
 void mlb_close(MLB *mlb)
 {
     if (mlb) {
         int i;
 
         if (mlb->directory) {
-            for (i = 0; i < mlb->nentries; i++)
+            for (i = 0; i < mlb->nentries && !mlb->native; i++)
                 if (mlb->directory[i].label)
                     free(mlb->directory[i].label);
             free(mlb->directory);
         }
-        if (mlb->fp)
-            fclose(mlb->fp);
+        free(mlb->index);
+        free(mlb->name);
+        if (mlb->data) {
+#ifndef WIN32
+            if (mlb->mapped)
+                munmap(mlb->data, mlb->size);
+            else
+#endif
+                free(mlb->data);
+        }
 
         free(mlb);
     }
 }
 
-/* mlb_entry returns a BUFFER containing the specified entry from the
-   macro library, or NULL if not found. */
+/* copy_text copies len bytes of macro text from src to dst, leaving
+   out carriage returns and NULs, and returns the number of bytes
+   stored.  It checks 8 bytes at a time for either character and
+   copies the clean words whole. */
 
-BUFFER *mlb_entry(MLB *mlb, char *name)
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+#define HAS_ZERO(v) (((v) - ONES) & ~(v) & HIGHS)
+
+static int copy_text(char *dst, const char *src, int len)
 {
-    int       i;
-    MLBENT   *ent;
-    BUFFER   *buf;
-    char     *bp;
-    int       c;
+    char           *out = dst;
+    int             i = 0,
+                    k;
+
+    while (i + 8 <= len) {
+        ulong64         v;
+
+        memcpy(&v, src + i, 8);
+        if (!HAS_ZERO(v) && !HAS_ZERO(v ^ (ONES * '\r'))) {
+            memcpy(out, src + i, 8);
+            out += 8;
+            i += 8;
+            continue;
+        }
+        for (k = 0; k < 8; k++, i++)
+            if (src[i] != '\r' && src[i] != 0)
+                *out++ = src[i];
+    }
 
-    for (i = 0; i < mlb->nentries; i++) {
-        ent = &mlb->directory[i];
-        if (strcmp(mlb->directory[i].label, name) == 0)
-            break;
+    for (; i < len; i++)
+        if (src[i] != '\r' && src[i] != 0)
+            *out++ = src[i];
+
+    return (int) (out - dst);
+}
+
+/* mlb_find returns the directory entry of the named member, or NULL
+   if not found. */
+
+MLBENT *mlb_find(MLB *mlb, char *name)
+{
+    unsigned        h,
+                    i;
+    MLBENT         *ent;
+
+    h = mlb_hash(name) & mlb->indexmask;
+    for (i = 0; i <= mlb->indexmask; i++) {
+        if (mlb->index[h] < 0)
+            return NULL;
+        ent = &mlb->directory[mlb->index[h]];
+        if (strcmp(ent->label, name) == 0)
+            return ent;
+        h = (h + 1) & mlb->indexmask;
     }
 
-    if (i >= mlb->nentries)
+    return NULL;                       /* Every slot probed */
+}
+
+/* mlb_entry returns a BUFFER containing the specified entry from the
+   macro library, or NULL if not found.  A native library's text is
+   used where it lies. */
+
+BUFFER *mlb_entry(MLB *mlb, char *name)
+{
+    MLBENT         *ent;
+    BUFFER         *buf;
+    int             len;
+
+    if ((ent = mlb_find(mlb, name)) == NULL)
         return NULL;
 
+    if (mlb->native)                   /* With the trailing 0 */
+        return new BUFFER(mlb->data + ent->position, ent->length + 1);
+
     /* Allocate a buffer to hold the text */
     buf = new BUFFER(ent->length + 1);        /* Make it large enough */
-    bp = buf->buffer;
-
-    fseek(mlb->fp, ent->position, SEEK_SET);
 
-    for (i = 0; i < ent->length; i++) {
-        c = fgetc(mlb->fp);            /* Get macro byte */
-        if (c == '\r' || c == 0)       /* If it's a carriage return or 0,
-                                          discard it. */
-            continue;
-        *bp++ = c;
-    }
-    *bp++ = 0;                         /* Store trailing 0 delim */
+    len = copy_text(buf->buffer, mlb->data + ent->position, ent->length);
+    buf->buffer[len++] = 0;            /* Store trailing 0 delim */
 
     /* Now resize that buffer to the length actually read. */
-    buf->buffer_resize((int) (bp - buf->buffer));
+    buf->buffer_resize(len);
 
     return buf;
 }
 
+/* *** Writing macro libraries */
+
+/* put_word and put_long store little-endian numbers */
+
+static void put_word(char *cp, unsigned w)
+{
+    cp[0] = w & 0xff;
+    cp[1] = (w >> 8) & 0xff;
+}
+
+static void put_long(char *cp, unsigned long l)
+{
+    put_word(cp, l & 0xffff);
+    put_word(cp + 2, (l >> 16) & 0xffff);
+}
+
+/* A member being written, and the qsort callback that puts members
+   in RAD50 name order, the order of the directory. */
+
+typedef struct mlbmem {
+    char           *name;
+    BUFFER         *text;
+    unsigned        rad[2];     /* The name in RAD50 */
+    unsigned long   position;   /* Where the text went */
+    unsigned long   length;
+} MLBMEM;
+
+static int compare_rad50(const void *arg1, const void *arg2)
+{
+    const MLBMEM   *m1 = (const MLBMEM *) arg1;
+    const MLBMEM   *m2 = (const MLBMEM *) arg2;
+
+    if (m1->rad[0] != m2->rad[0])
+        return m1->rad[0] < m2->rad[0] ? -1 : 1;
+    if (m1->rad[1] != m2->rad[1])
+        return m1->rad[1] < m2->rad[1] ? -1 : 1;
+    return 0;
+}
+
+/* rt11_stamp gives the creation date and time for a library header:
+   the RT-11 date word, and the time in 60 Hz ticks since midnight.
+   SOURCE_DATE_EPOCH, if it's set, is used instead of the time now, in
+   UTC, so the same members make the same library.  Dates RT-11 can't
+   hold (before 1972 or after 2099) come out as 0, no date. */
+
+static void rt11_stamp(unsigned *date, unsigned long *ticks)
+{
+    const char     *epoch = getenv("SOURCE_DATE_EPOCH");
+    time_t          now;
+    struct tm      *tm;
+    int             year;
+
+    *date = 0;
+    *ticks = 0;
+    if (epoch != NULL && *epoch != 0) {
+        now = (time_t) strtoll(epoch, NULL, 10);
+        tm = gmtime(&now);
+    } else {
+        now = time(NULL);
+        tm = localtime(&now);
+    }
+    if (tm == NULL)
+        return;
+
+    year = tm->tm_year + 1900 - 1972;
+    if (year >= 0 && year < 128)       /* The age bits make it 128 years */
+        *date = ((year >> 5) << 14) | ((tm->tm_mon + 1) << 10) | (tm->tm_mday << 5) | (year & 037);
+    *ticks = ((tm->tm_hour * 60UL + tm->tm_min) * 60 + tm->tm_sec) * 60;
+}
+
+/* mlb_valid_name says whether a name can be a library entry name:
+   one to six RAD50 characters, no blanks. */
+
+int mlb_valid_name(const char *name)
+{
+    static const char radchars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ$.0123456789";
+    int             len = strlen(name);
+
+    return len >= 1 && len <= 6 && (int) strspn(name, radchars) == len;
+}
+
+/* mlb_write writes a macro library with the given members, whose
+   names must satisfy mlb_valid_name and be distinct.  The header and
+   directory are as LIBR/M writes them: the directory fills whole
+   blocks, with the unused entries all ones, and is sorted by name; the
+   text is stored with CR LF line ends, the way RT-11 keeps it.  With "extended", the extended index is added after
+   the directory, so mlb_open needn't decode, sort or index anything.
+   Returns FALSE if the file can't be written. */
+
+int mlb_write(const char *filename, int count, char **names, BUFFER **texts, int extended)
+{
+    MLBMEM         *mem;
+    char           *out;
+    unsigned long   size,
+                    dirpos,
+                    xpos = 0,
+                    pos,
+                    ticks;
+    unsigned        hsize = 0,
+                    nslots,
+                    date;
+    int             i;
+    FILE           *fp;
+    int             ok;
+
+    mem = (MLBMEM *)memcheck(malloc(sizeof(MLBMEM) * (count + 1)));
+    for (i = 0; i < count; i++) {
+        mem[i].name = names[i];
+        mem[i].text = texts[i];
+        rad50x2(names[i], mem[i].rad);
+    }
+    qsort(mem, count, sizeof(MLBMEM), compare_rad50);
+
+    /* Lay out the file: header block, directory, extended index,
+       then the text */
+    dirpos = 512;
+    nslots = (count + 63) & ~63U;      /* 64 entries to a block */
+    if (nslots == 0)
+        nslots = 64;
+    pos = dirpos + nslots * 8UL;
+    if (extended) {
+        for (hsize = 16; hsize < (unsigned) count * 2; hsize <<= 1) ;
+        xpos = pos;
+        pos = (xpos + MLB_XHEAD + count * MLB_XENT + hsize * 2 + 511) & ~511UL;
+    }
+
+    size = pos;
+    for (i = 0; i < count; i++) {
+        BUFFER         *text = mem[i].text;
+        int             j;
+
+        mem[i].position = size;
+        mem[i].length = 0;
+        for (j = 0; j < text->length; j++) {
+            if (text->buffer[j] == '\r' || text->buffer[j] == 0)
+                continue;
+            mem[i].length += text->buffer[j] == '\n' ? 2 : 1;
+        }
+        size += mem[i].length;
+    }
+    size = (size + 511) & ~511UL;
+
+    out = (char *)memcheck(calloc(size, 1));
+
+    /* The header */
+    rt11_stamp(&date, &ticks);
+    put_word(out, 01001);              /* Macro library ID */
+    put_word(out + 2, 0500);           /* LIBR version, V05 */
+    put_word(out + 6, date);           /* Date of creation */
+    put_word(out + 010, ticks >> 16);  /* Time of creation, high word */
+    put_word(out + 012, ticks & 0xffff);        /* and low word */
+    put_word(out + 032, 8);            /* Directory entry size */
+    put_word(out + 034, dirpos / 512); /* Directory start block */
+    put_word(out + 036, nslots);       /* Directory entries allocated */
+    memset(out + dirpos + count * 8, 0377, (nslots - count) * 8);
+
+    /* The directory, and the text */
+    for (i = 0; i < count; i++) {
+        char           *ent = out + dirpos + i * 8;
+        BUFFER         *text = mem[i].text;
+        char           *tp = out + mem[i].position;
+        int             j;
+
+        put_word(ent, mem[i].rad[0]);
+        put_word(ent + 2, mem[i].rad[1]);
+        put_word(ent + 4, mem[i].position / 512);
+        put_word(ent + 6, mem[i].position % 512);
+
+        for (j = 0; j < text->length; j++) {
+            char            c = text->buffer[j];
+
+            if (c == '\r' || c == 0)
+                continue;
+            if (c == '\n')
+                *tp++ = '\r';
+            *tp++ = c;
+        }
+    }
+
+    if (extended) {
+        char           *xp = out + xpos;
+        char           *hp = xp + MLB_XHEAD + count * MLB_XENT;
+
+        memcpy(xp, MLB_XMAGIC, 8);
+        put_long(xp + 8, count);
+        put_long(xp + 12, hsize);
+        for (i = 0; i < count; i++) {
+            char           *ent = xp + MLB_XHEAD + i * MLB_XENT;
+
+            strncpy(ent, mem[i].name, 8);
+            put_long(ent + 8, mem[i].position);
+            put_long(ent + 12, mem[i].length);
+        }
+
+        memset(hp, 0377, hsize * 2);
+        for (i = 0; i < count; i++) {
+            unsigned        h = mlb_hash(mem[i].name) & (hsize - 1);
+
+            while (WORD(hp + h * 2) != 0177777)
+                h = (h + 1) & (hsize - 1);
+            put_word(hp + h * 2, i);
+        }
+    }
+
+    fp = fopen(filename, "wb");
+    ok = fp != NULL && fwrite(out, 1, size, fp) == size;
+    if (fp != NULL && fclose(fp) != 0)
+        ok = FALSE;
+
+    free(out);
+    free(mem);
+    return ok;
+}
+
+/* mlb_write_native writes a native library.  The members' names
+   must be distinct; defs, bodies and tmpls are their definitions,
+   from defmacro under the given options, or NULL.  Returns FALSE if
+   the file can't be written. */
+
+int mlb_write_native(const char *filename, int count, char **names, BUFFER **texts,
+                     BUFFER **defs, BUFFER **bodies, BUFFER **tmpls, const char *options)
+{
+    char           *out,
+                   *hp;
+    unsigned long   size,
+                    pos;
+    unsigned        hsize;
+    int             i;
+    FILE           *fp;
+    int             ok;
+
+    for (hsize = 16; hsize < (unsigned) count * 2; hsize <<= 1) ;
+
+    /* Work out the size: the strings follow the hash table */
+    size = MLB_NHEAD + (unsigned long) count * MLB_NENT + hsize * 4UL + strlen(options) + 1;
+    for (i = 0; i < count; i++) {
+        size += strlen(names[i]) + 1 + texts[i]->length + 1;
+        if (defs[i] != NULL)
+            size += defs[i]->length + 1 + bodies[i]->length + 1 + tmpls[i]->length + 1;
+    }
+
+    out = (char *)memcheck(calloc(size, 1));
+
+    memcpy(out, MLB_NMAGIC, 8);
+    put_long(out + 8, count);
+    put_long(out + 12, hsize);
+
+    hp = out + MLB_NHEAD + count * MLB_NENT;
+    memset(hp, 0377, hsize * 4);
+    pos = MLB_NHEAD + (unsigned long) count * MLB_NENT + hsize * 4UL;
+
+    put_long(out + 16, pos);
+    strcpy(out + pos, options);
+    pos += strlen(options) + 1;
+
+    for (i = 0; i < count; i++) {
+        char           *ent = out + MLB_NHEAD + i * MLB_NENT;
+        unsigned        h = mlb_hash(names[i]) & (hsize - 1);
+        int             len = strlen(names[i]);
+
+        put_long(ent, pos);
+        put_long(ent + 28, len);
+        memcpy(out + pos, names[i], len);
+        pos += len + 1;
+
+        len = copy_text(out + pos, texts[i]->buffer, texts[i]->length);
+        put_long(ent + 4, pos);
+        put_long(ent + 8, len);
+        pos += len + 1;
+
+        if (defs[i] != NULL) {
+            put_long(ent + 12, pos);
+            put_long(ent + 16, defs[i]->length);
+            memcpy(out + pos, defs[i]->buffer, defs[i]->length);
+            pos += defs[i]->length + 1;
+
+            put_long(ent + 20, pos);
+            put_long(ent + 24, bodies[i]->length);
+            memcpy(out + pos, bodies[i]->buffer, bodies[i]->length);
+            pos += bodies[i]->length + 1;
+
+            put_long(ent + 32, pos);
+            put_long(ent + 36, tmpls[i]->length);
+            memcpy(out + pos, tmpls[i]->buffer, tmpls[i]->length);
+            pos += tmpls[i]->length + 1;
+        }
+
+        while (LONG(hp + h * 4) != 0xffffffffUL)
+            h = (h + 1) & (hsize - 1);
+        put_long(hp + h * 4, i);
+    }
+
+    /* Dropping CRs may have left some room at the end */
+    size = pos;
+
+    fp = fopen(filename, "wb");
+    ok = fp != NULL && fwrite(out, 1, size, fp) == size;
+    if (fp != NULL && fclose(fp) != 0)
+        ok = FALSE;
+
+    free(out);
+    return ok;
+}
+
 /* mlb_extract - walk thru a macro library and store it's contents
    into files in the current directory.
 
@@ -44,17 +44,39 @@ typedef struct mlbent {
     char           *label;
     unsigned long   position;
     int             length;
+    char           *def;        /* Native libraries: the macro's name and
+                                   arguments, parsed, or NULL */
+    int             deflen;
+    char           *body;       /* ...and its body */
+    int             bodylen;
+    char           *tmpl;       /* ...and its template */
+    int             tmpllen;
 } MLBENT;
 
 typedef struct mlb {
-    FILE           *fp;
+    char           *name;       /* The file name */
+    char           *data;       /* The library file, mapped or read in */
+    unsigned long   size;       /* Its size */
+    int             mapped;     /* Whether data is mmap'ed */
     MLBENT         *directory;
     int             nentries;
+    int            *index;      /* Hash table of directory entry
+                                   numbers, -1 if empty */
+    unsigned        indexmask;  /* Size of index - 1 */
+    int             native;     /* Whether it's a native library */
+    char           *options;    /* Native: the options it was parsed with */
 } MLB;
 
 extern MLB     *mlb_open(char *name);
+extern void     mlb_open_all(int count, char **names, MLB **mlbs);
 extern BUFFER  *mlb_entry(MLB *mlb, char *name);
+extern MLBENT  *mlb_find(MLB *mlb, char *name);
 extern void     mlb_close(MLB *mlb);
 extern void     mlb_extract(MLB *mlb);
+extern unsigned mlb_hash(const char *label);
+extern int      mlb_valid_name(const char *name);
+extern int      mlb_write(const char *filename, int count, char **names, BUFFER **texts, int extended);
+extern int      mlb_write_native(const char *filename, int count, char **names, BUFFER **texts,
+                                 BUFFER **defs, BUFFER **bodies, BUFFER **tmpls, const char *options);
 
 #endif /* MLB_H */
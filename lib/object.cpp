@@ -48,6 +48,7 @@ DAMAGE.
 
 #include "object.h"
 #include "assemble_globals.h"
+#include "util.h"
 
 //#include "macro11.h"
 
@@ -55,16 +56,39 @@ DAMAGE.
   writerec writes "formatted binary records."
   Each is preceeded by any number of 0 bytes, begins with a 1,0 pair,
   followed by 2 byte length, followed by data, followed by 1 byte
-  negative checksum.
+  negative checksum.  They go to fp, or are appended to mem if that
+  isn't NULL.
 */
 
-static int writerec(FILE *fp, char *data, int len)
+static int writerec(FILE *fp, BUFFER *mem, char *data, int len)
 {
     int             chksum;     /* Checksum is negative sum of all
                                    bytes including header and length */
     int             i;
     unsigned        hdrlen = len + 4;
 
+    if (mem != NULL) {
+        char            hdr[4];
+        char            sum;
+
+        hdr[0] = FBR_LEAD1;
+        hdr[1] = FBR_LEAD2;
+        hdr[2] = hdrlen & 0xff;
+        hdr[3] = (hdrlen >> 8) & 0xff;
+
+        chksum = 0;
+        for (i = 0; i < 4; i++)
+            chksum -= hdr[i] & 0xff;
+        for (i = 0; i < len; i++)
+            chksum -= data[i] & 0xff;
+        sum = chksum & 0xff;
+
+        mem->buffer_appendn(hdr, 4);
+        mem->buffer_appendn(data, len);
+        mem->buffer_appendn(&sum, 1);
+        return 1;
+    }
+
     if (fp == NULL)
         return 1;                      /* Silently ignore this attempt to write. */
 
@@ -104,9 +128,10 @@ static int writerec(FILE *fp, char *data, int len)
 
 /* gsd_init - prepare a GSD prior to writing GSD records */
 
-void GSD::gsd_init(FILE *_fp)
+void GSD::gsd_init(FILE *_fp, BUFFER *_mem)
 {
     fp = _fp;
+    mem = _mem;
     buf[0] = OBJ_GSD;             /* GSD records start with 1,0 */
     buf[1] = 0;
     offset = 2;                   /* Offset for further additions */
@@ -117,9 +142,9 @@ void GSD::gsd_init(FILE *_fp)
 int GSD::gsd_flush()
 {
     if (offset > 2) {
-        if (!writerec(fp, buf, offset))
+        if (!writerec(fp, mem, buf, offset))
             return 0;
-        gsd_init(fp);
+        gsd_init(fp, mem);
     }
     return 1;
 }
@@ -240,7 +265,7 @@ int GSD::gsd_end()
 {
     buf[0] = OBJ_ENDGSD;
     buf[1] = 0;
-    return writerec(fp, buf, 2);
+    return writerec(fp, mem, buf, 2);
 }
 
 /* TEXT and RLD record handling */
@@ -249,11 +274,110 @@ int GSD::gsd_end()
    record refers to the prior TEXT record, giving relocation
    information. */
 
+/* A TEXT_RLD with a journal keeps the calls that shape the records
+   there, instead of making them, so that text_play can make them
+   later, with other calls spliced in: one-pass mode does this with
+   the lines it assembles again.  Each is kept as its code and three
+   arguments, and some of them with more after. */
+
+enum {
+    JNL_INIT,                          /* text_init(addr) */
+    JNL_FLUSH,                         /* text_flush() */
+    JNL_FIT,                           /* text_fit(addr, txtsize, rldsize) */
+    JNL_TEXT,                          /* text_word_i(w, size) */
+    JNL_WORDS,                         /* text_words(addr, size, count), then the words */
+    JNL_RLD_WORD,                      /* rld_word(wd) */
+    JNL_RLD_BYTE,                      /* rld_byte(byte) */
+    JNL_RLD_CODE,                      /* rld_code(code, addr, size) */
+    JNL_RLD_NAME                       /* rld_name(), then the name and a zero */
+};
+
+/* journal_op adds a call to the journal */
+
+void TEXT_RLD::journal_op(int op, unsigned a, unsigned b, unsigned c)
+{
+    char            entry[1 + 3 * sizeof(unsigned)];
+
+    entry[0] = (char) op;
+    memcpy(entry + 1, &a, sizeof(unsigned));
+    memcpy(entry + 1 + sizeof(unsigned), &b, sizeof(unsigned));
+    memcpy(entry + 1 + 2 * sizeof(unsigned), &c, sizeof(unsigned));
+    journal->buffer_appendn(entry, sizeof(entry));
+}
+
+/* text_play makes the calls kept in length bytes of a journal.
+   Returns 0 if writing failed. */
+
+int TEXT_RLD::text_play(const char *ops, int length)
+{
+    const char     *end = ops + length;
+    unsigned        a, b, c;
+    int             op;
+
+    while (ops < end) {
+        op = *ops++;
+        memcpy(&a, ops, sizeof(unsigned));
+        memcpy(&b, ops + sizeof(unsigned), sizeof(unsigned));
+        memcpy(&c, ops + 2 * sizeof(unsigned), sizeof(unsigned));
+        ops += 3 * sizeof(unsigned);
+
+        switch (op) {
+        case JNL_INIT:
+            text_init(fp, a, mem);
+            break;
+        case JNL_FLUSH:
+            if (!text_flush())
+                return 0;
+            break;
+        case JNL_FIT:
+            if (!text_fit(a, (int) b, (int) c))
+                return 0;
+            break;
+        case JNL_TEXT:
+            text_word_i(a, (int) b);
+            break;
+        case JNL_WORDS: {
+            unsigned       *words = (unsigned *) memcheck(malloc((c + 1) * sizeof(unsigned)));
+            int             ok;
+
+            memcpy(words, ops, c * sizeof(unsigned));
+            ops += c * sizeof(unsigned);
+            ok = text_words(&a, (int) b, words, (int) c);
+            free(words);
+            if (!ok)
+                return 0;
+            break;
+        }
+        case JNL_RLD_WORD:
+            rld_word(a);
+            break;
+        case JNL_RLD_BYTE:
+            rld_byte(a);
+            break;
+        case JNL_RLD_CODE:
+            rld_code(a, b, (int) c);
+            break;
+        case JNL_RLD_NAME:
+            rld_name((char *) ops);
+            ops += strlen(ops) + 1;
+            break;
+        }
+    }
+
+    return 1;
+}
+
 /* text_init prepares a TEXT_RLD prior to writing */
 
-void TEXT_RLD::text_init(FILE *_fp, unsigned addr)
+void TEXT_RLD::text_init(FILE *_fp, unsigned addr, BUFFER *_mem)
 {
+    if (journal != NULL) {
+        journal_op(JNL_INIT, addr, 0, 0);
+        return;
+    }
+
     fp = _fp;
+    mem = _mem;
 
     text[0] = OBJ_TEXT;            /* text records begin with 3, 0 */
     text[1] = 0;
@@ -272,13 +396,18 @@ void TEXT_RLD::text_init(FILE *_fp, unsigned addr)
 
 int TEXT_RLD::text_flush()
 {
+    if (journal != NULL) {
+        journal_op(JNL_FLUSH, 0, 0, 0);
+        return 1;
+    }
+
     if (txt_offset > 4) {
-        if (!writerec(fp, text, txt_offset))
+        if (!writerec(fp, mem, text, txt_offset))
             return 0;
     }
 
     if (rld_offset > 2) {
-        if (!writerec(fp, rld, rld_offset))
+        if (!writerec(fp, mem, rld, rld_offset))
             return 0;
     }
 
@@ -291,13 +420,18 @@ int TEXT_RLD::text_flush()
 
 int TEXT_RLD::text_fit(unsigned addr, int txtsize, int rldsize)
 {
+    if (journal != NULL) {
+        journal_op(JNL_FIT, addr, txtsize, rldsize);
+        return 1;
+    }
+
     if (txt_offset + txtsize <= sizeof(text) && rld_offset + rldsize <= sizeof(rld)
         && (txtsize == 0 || txt_addr + txt_offset - 4 == addr))
         return 1;                      /* All's well. */
 
     if (!text_flush())
         return 0;
-    text_init(fp, addr);
+    text_init(fp, addr, mem);
 
     return 1;
 }
@@ -306,6 +440,12 @@ int TEXT_RLD::text_fit(unsigned addr, int txtsize, int rldsize)
 
 void TEXT_RLD::rld_name(char *name)
 {
+    if (journal != NULL) {
+        journal_op(JNL_RLD_NAME, 0, 0, 0);
+        journal->buffer_appendn(name, strlen(name) + 1);
+        return;
+    }
+
     rld[rld_offset++] = 0xff; rld[rld_offset++] = 0xff;
     while(*name) {
         rld[rld_offset++] = *name++;
@@ -319,6 +459,11 @@ void TEXT_RLD::rld_name(char *name)
 
 void TEXT_RLD::text_word_i(unsigned w, int size)
 {
+    if (journal != NULL) {
+        journal_op(JNL_TEXT, w, size, 0);
+        return;
+    }
+
     text[txt_offset++] = w & 0xff;
     if (size > 1)
         text[txt_offset++] = (w >> 8) & 0xff;
@@ -337,10 +482,54 @@ int TEXT_RLD::text_word(unsigned *addr, int size, unsigned word)
     return 1;                          /* say "ok". */
 }
 
+/* text_words - write a run of constant words (or bytes) to text.
+   Each TEXT record is filled as far as it will go before it's
+   flushed, instead of checking the fit word by word. */
+
+int TEXT_RLD::text_words(unsigned *addr, int size, const unsigned *words, int count)
+{
+    if (journal != NULL) {
+        journal_op(JNL_WORDS, *addr, size, count);
+        journal->buffer_appendn((char *) words, count * sizeof(unsigned));
+        *addr += count * size;
+        return 1;
+    }
+
+    while (count > 0) {
+        int             room;
+
+        if (!text_fit(*addr, size, 0))
+            return 0;
+
+        room = (int) (sizeof(text) - txt_offset) / size;
+        if (room > count)
+            room = count;
+
+        count -= room;
+        *addr += room * size;
+        if (size == 1) {
+            while (room-- > 0)
+                text[txt_offset++] = *words++ & 0xff;
+        } else {
+            while (room-- > 0) {
+                text[txt_offset++] = *words & 0xff;
+                text[txt_offset++] = (*words++ >> 8) & 0xff;
+            }
+        }
+    }
+
+    return 1;
+}
+
 /* rld_word - adds a word to the RLD information. */
 
 void TEXT_RLD::rld_word(unsigned wd)
 {
+    if (journal != NULL) {
+        journal_op(JNL_RLD_WORD, wd, 0, 0);
+        return;
+    }
+
     rld[rld_offset++] = wd & 0xff;
     rld[rld_offset++] = (wd >> 8) & 0xff;
 }
@@ -349,6 +538,11 @@ void TEXT_RLD::rld_word(unsigned wd)
 
 void TEXT_RLD::rld_byte(unsigned byte)
 {
+    if (journal != NULL) {
+        journal_op(JNL_RLD_BYTE, byte, 0, 0);
+        return;
+    }
+
     rld[rld_offset++] = byte & 0xff;
 }
 
@@ -357,6 +551,11 @@ void TEXT_RLD::rld_byte(unsigned byte)
 
 void TEXT_RLD::rld_code(unsigned code, unsigned addr, int size)
 {
+    if (journal != NULL) {
+        journal_op(JNL_RLD_CODE, code, addr, size);
+        return;
+    }
+
     unsigned offset = addr - txt_addr + 4;
 
     rld_word(code | offset << 8 | (size == 1 ? 0200 : 0));
@@ -556,7 +755,7 @@ int TEXT_RLD::text_define_location(char *name, unsigned *addr)
     if (!text_flush())               /* Flush that block out. */
         return 0;
 
-    text_init(fp, *addr);      /* Set new text address */
+    text_init(fp, *addr, mem);      /* Set new text address */
 
     return 1;
 }
@@ -577,7 +776,7 @@ int TEXT_RLD::text_modify_location(unsigned *addr)
 
     if (!text_flush())               /* Flush that block out. */
         return 0;
-    text_init(fp, *addr);      /* Set new text address */
+    text_init(fp, *addr, mem);      /* Set new text address */
 
     return 1;
 }
@@ -929,12 +1128,12 @@ int text_complex_commit_displaced(TEXT_RLD *tr, unsigned *addr, int size, TEXT_C
     return 1;
 }
 
-/* Write end-of-object-module to file. */
+/* Write end-of-object-module to file, or to mem. */
 
-int write_endmod(FILE *fp)
+int write_endmod(FILE *fp, BUFFER *mem)
 {
     char            endmod[2] = {
         OBJ_ENDMOD, 0
     };
-    return writerec(fp, endmod, 2);
+    return writerec(fp, mem, endmod, 2);
 }
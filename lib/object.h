@@ -40,6 +40,8 @@ DAMAGE.
 
 #include <stdio.h>
 
+#include "stream2.h"
+
 #define FBR_LEAD1 1                    /* The byte value that defines the
                                           beginning of a formatted binary
                                           record */
@@ -122,13 +124,14 @@ DAMAGE.
 
 struct GSD {
     GSD(FILE *fp) : offset(0)  { gsd_init(fp); };
-    GSD() : offset(0), fp(nullptr) {};
+    GSD() : offset(0), fp(nullptr), mem(nullptr) {};
     ~GSD() {};
     FILE           *fp;         /* The file assigned for output */
+    BUFFER         *mem;        /* Or the memory, if not NULL */
     char            buf[1024*512];   /* space for 15 GSD entries */
     int             offset;     /* Current buffer for GSD entries */
 
-    void  gsd_init(FILE *fp);
+    void  gsd_init(FILE *fp, BUFFER *mem = NULL);
     int   gsd_flush();
     int   gsd_mod(char *modname);
     int   gsd_csect(char *sectname, int size);
@@ -144,19 +147,23 @@ private:
 };
 
 struct TEXT_RLD {
-    TEXT_RLD(FILE *fp, unsigned addr): txt_offset(0), rld_offset(0)  {text_init(fp, addr); }
-    TEXT_RLD() : fp(nullptr), txt_addr(0), txt_offset(0), rld_offset(0) {};
+    TEXT_RLD(FILE *fp, unsigned addr): txt_offset(0), rld_offset(0), journal(nullptr)  {text_init(fp, addr); }
+    TEXT_RLD() : fp(nullptr), mem(nullptr), txt_addr(0), txt_offset(0), rld_offset(0), journal(nullptr) {};
     ~TEXT_RLD() {};
     FILE           *fp;         /* The object file, or NULL */
+    BUFFER         *mem;        /* Or the memory, if not NULL */
     char            text[128*20];  /* text buffer */
     unsigned        txt_addr;   /* The base text address */
     int             txt_offset; /* Current text offset */
     char            rld[128*20];   /* RLD buffer */
     int             rld_offset; /* Current RLD offset */
+    BUFFER         *journal;    /* If not NULL, what would be written is
+                                   kept here instead, for text_play */
 
-    void  text_init(FILE *fp, unsigned addr);
+    void  text_init(FILE *fp, unsigned addr, BUFFER *mem = NULL);
     int   text_flush();
     int   text_word(unsigned *addr, int size, unsigned word);
+    int   text_words(unsigned *addr, int size, const unsigned *words, int count);
     int   text_internal_word(unsigned *addr, int size, unsigned word);
     int   text_global_word(unsigned *addr, int size, unsigned word, char *global);
     int   text_displaced_word(unsigned *addr, int size, unsigned word);
@@ -170,7 +177,9 @@ struct TEXT_RLD {
     int   text_psect_offset_word(unsigned *addr, int size, unsigned word, char *name);
     int   text_psect_displaced_word(unsigned *addr, int size, unsigned word, char *name);
     int   text_psect_displaced_offset_word(unsigned *addr, int size, unsigned word, char *name);
+    int   text_play(const char *ops, int length);
 //private:
+    void  journal_op(int op, unsigned a, unsigned b, unsigned c);
     int   text_fit(unsigned addr, int txtsize, int rldsize);
     void  rld_name(char *name);
     void  text_word_i(unsigned w, int size);
@@ -207,6 +216,6 @@ int   text_complex_commit(TEXT_RLD *tr, unsigned *addr, int size, TEXT_COMPLEX *
 int   text_complex_commit_displaced(TEXT_RLD *tr, unsigned *addr, int size, TEXT_COMPLEX *tx, unsigned word);
 
 
-int   write_endmod(FILE *fp);
+int   write_endmod(FILE *fp, BUFFER *mem = NULL);
 
 #endif /* OBJECT_J */
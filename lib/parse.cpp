@@ -12,14 +12,46 @@
 #include "rad50.h"
 #include "assemble_globals.h"
 #include "encoding.h"
+#include "replay.h"
 
 
+THREAD_LOCAL unsigned char   char_class[256];       /* CC_* bits for each character */
+static THREAD_LOCAL unsigned char digit_value[256]; /* Digit value in radix <= 36, or 0377 */
+
+/* init_char_class - (re)build the character class tables.  Must be
+   called again whenever an option that changes what is allowed in a
+   symbol (-yus) changes. */
+
+void init_char_class(void)
+{
+    int             c;
+
+    for (c = 0; c < 256; c++) {
+        char_class[c] = 0;
+        digit_value[c] = 0377;
+
+        if (c >= '0' && c <= '9') {
+            char_class[c] |= CC_SYM | CC_DIGIT;
+            digit_value[c] = c - '0';
+        } else if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) {
+            char_class[c] |= CC_SYM;
+            digit_value[c] = (c | 040) - 'a' + 10;
+        } else if (c == '.' || c == '$' || (c == '_' && Glb_symbol_allow_underscores)) {
+            char_class[c] |= CC_SYM;
+        } else if (c == ' ' || c == '\t') {
+            char_class[c] |= CC_WHITE;
+        } else if (strchr("+-*/!&", c) && c != 0) {
+            char_class[c] |= CC_BINOP;
+        }
+    }
+}
+
 /* skipwhite - used everywhere to advance a char pointer past spaces */
 
 char           *skipwhite(
     char *cp)
 {
-    while (*cp == ' ' || *cp == '\t')
+    while (char_class[(unsigned char) *cp] & CC_WHITE)
         cp++;
     return cp;
 }
@@ -101,10 +133,137 @@ SYMBOL         *get_op(
     return op;
 }
 
+/* get_directive is a cheap get_op for callers that are only looking
+   for a few directives, like read_body looking for the end of a
+   body.  It accepts the lines get_op does (an optional label, then
+   the operation), but it doesn't allocate or look in the symbol
+   table: the operation is matched against dirs, ignoring case like
+   assemble does.  Returns the value of the match, or -1. */
+
+int get_directive(char *cp, char **endp, const DIRECTIVE *dirs)
+{
+    char           *op;
+    int             len;
+
+    cp = skipwhite(cp);
+
+    /* Every directive starts with a '.', before any comment */
+    if (cp[strcspn(cp, ".;\n")] != '.')
+        return -1;
+
+    if (!issym(*cp))
+        return -1;
+    for (len = 1; issym(cp[len]); len++) ;
+    op = cp;
+    cp = skipwhite(cp + len);
+
+    if (*cp == ':') {                  /* A label definition? */
+        if (isdig(*op)) {
+            /* As get_symbol: only a local label may start with a
+               digit */
+            int             i,
+                            alpha = 0;
+
+            for (i = 1; i < len; i++)
+                if (!isdig(op[i]))
+                    alpha++;
+            if (alpha == 0)
+                return -1;
+            if (len > Glb_symbol_len)
+                len = Glb_symbol_len;
+            if (alpha == 1 && op[len - 1] != '$')
+                return -1;
+        }
+        cp++;
+        if (*cp == ':')
+            cp++;                      /* Skip it */
+        cp = skipwhite(cp);
+        if (!issym(*cp))
+            return -1;
+        for (len = 1; issym(cp[len]); len++) ;
+        op = cp;
+        cp += len;
+    }
+
+    if (*op != '.')
+        return -1;
+    if (len > Glb_symbol_len)
+        len = Glb_symbol_len;
+
+    for (; dirs->name != NULL; dirs++) {
+        int             i;
+
+        for (i = 0; i < len; i++)
+            if (toupper((unsigned char) op[i]) != dirs->name[i])
+                break;
+        if (i == len && dirs->name[len] == 0) {
+            if (endp)
+                *endp = cp;
+            return dirs->value;
+        }
+    }
+
+    return -1;
+}
+
 
 
 /* get_mode - parse a general addressing mode. */
 
+/* get_register_token - recognize a lone register name (a symbol
+   in the register section, or %n) without parsing an expression.
+   *endp is left pointing past any blanks that follow.  Returns NO_REG
+   for anything else, including a register that's part of a larger
+   expression; the caller then falls back on parse_expr. */
+
+static unsigned get_register_token(char *cp, char **endp)
+{
+    unsigned        reg;
+
+    cp = skipwhite(cp);
+
+    if (*cp == '%') {
+        if (cp[1] < '0' || cp[1] > '7' || issym(cp[2]))
+            return NO_REG;
+        reg = cp[1] - '0';
+        cp += 2;
+    } else if (issym(*cp) && !isdig(*cp)) {
+        char            label[SYMMAX_MAX + 1];
+        SYMBOL         *sym;
+        int             len;
+
+        for (len = 1; issym(cp[len]); len++) ;
+        memcpy(label, cp, len > Glb_symbol_len ? Glb_symbol_len : len);
+        label[len > Glb_symbol_len ? Glb_symbol_len : len] = 0;
+        if (symbols_to_upper)
+            upcase(label);
+        cp += len;
+
+        sym = Glb_symbol_st.lookup_sym(label);
+        if (sym != NULL)
+            replay_note_use(sym);
+        else
+            sym = Glb_system_st.lookup_sym(label);
+        if (sym == NULL || sym->section->type != SECTION_REGISTER)
+            return NO_REG;
+        reg = sym->value;
+    } else
+        return NO_REG;
+
+    cp = skipwhite(cp);
+    if (char_class[(unsigned char) *cp] & CC_BINOP)
+        return NO_REG;                 /* e.g. R0+2 */
+
+    *endp = cp;
+    return reg;
+}
+
+/* get_mode - parse a general addressing mode.  The operand shapes
+   that consist of nothing but a register, Rn (Rn) (Rn)+ -(Rn) and
+   @Rn, are first tried with get_register_token; only displacement
+   and immediate forms, and registers written as expressions, need
+   the expression parser. */
+
 int get_mode(
     char *cp,
     char **endp,
@@ -141,8 +300,17 @@ int get_mode(
 
         if (*tcp++ == '(') {
             unsigned        reg;
+            char           *rcp;
 
             /* It's -(Rn) */
+            reg = get_register_token(tcp, &rcp);
+            if (reg != NO_REG && *rcp == ')') {
+                mode->type |= 040 | reg;
+                if (endp)
+                    *endp = rcp + 1;
+                return TRUE;
+            }
+
             value = parse_expr(tcp, 0);
             reg = get_register(value);
             if (reg == NO_REG || (tcp = skipwhite(value->cp), *tcp++ != ')')) {
@@ -162,12 +330,16 @@ int get_mode(
         char           *tcp;
         unsigned        reg;
 
-        value = parse_expr(cp + 1, 0);
-        reg = get_register(value);
+        reg = get_register_token(cp + 1, &tcp);
+        value = NULL;
+        if (reg == NO_REG || *tcp++ != ')') {
+            value = parse_expr(cp + 1, 0);
+            reg = get_register(value);
 
-        if (reg == NO_REG || (tcp = skipwhite(value->cp), *tcp++ != ')')) {
-            delete (value);
-            return FALSE;
+            if (reg == NO_REG || (tcp = skipwhite(value->cp), *tcp++ != ')')) {
+                delete (value);
+                return FALSE;
+            }
         }
 
         tcp = skipwhite(tcp);
@@ -197,6 +369,19 @@ int get_mode(
         return TRUE;
     }
 
+    /* A lone register, Rn or @Rn */
+    {
+        char           *rcp;
+        unsigned        reg = get_register_token(cp, &rcp);
+
+        if (reg != NO_REG && *rcp != '(') {
+            mode->type |= reg;
+            if (endp)
+                *endp = rcp;
+            return TRUE;
+        }
+    }
+
     /* Modes with an offset */
 
     mode->offset = parse_expr(cp, 0);
@@ -205,19 +390,24 @@ int get_mode(
 
     if (*cp == '(') {
         unsigned        reg;
+        char           *tcp;
 
         /* indirect register plus offset */
-        value = parse_expr(cp + 1, 0);
-        reg = get_register(value);
-        if (reg == NO_REG || (cp = skipwhite(value->cp), *cp++ != ')')) {
+        reg = get_register_token(cp + 1, &tcp);
+        if (reg != NO_REG && *tcp == ')') {
+            cp = tcp + 1;
+        } else {
+            value = parse_expr(cp + 1, 0);
+            reg = get_register(value);
+            if (reg == NO_REG || (cp = skipwhite(value->cp), *cp++ != ')')) {
+                delete (value);
+                return FALSE;          /* Syntax error in addressing mode */
+            }
             delete (value);
-            return FALSE;              /* Syntax error in addressing mode */
         }
 
         mode->type |= 060 | reg;
 
-        delete (value);
-
         if (endp)
             *endp = cp;
         return TRUE;
@@ -466,11 +656,11 @@ char *get_symbol(char *cp, char **endp, int *islocal)
         return NULL;
 
     digits = 0;
-    if (isdigit(*cp))
+    if (isdig(*cp))
         digits = 2;                    /* Think about digit count */
 
     for (symcp = cp + 1; issym(*symcp); symcp++) {
-        if (!isdigit(*symcp))          /* Not a digit? */
+        if (!isdig(*symcp))          /* Not a digit? */
             digits--;                  /* Make a note. */
     }
 
@@ -514,7 +704,7 @@ char *get_symbol(char *cp, char **endp, int *islocal)
         }
     } else {
         /* disallow local label format */
-        if (isdigit(*symcp)) {
+        if (isdig(*symcp)) {
             free(symcp);
             return NULL;
         }
@@ -578,6 +768,152 @@ int brackrange(char *cp, int *start, int *length, char **endp)
     return 1;
 }
 
+/* is_number - given text starting with a digit, decide whether it's
+   a number or a symbol (a local label like 10$, or something like
+   1AB).  This is the same decision get_symbol makes, without building
+   the symbol. */
+
+static int is_number(char *cp)
+{
+    int             len;
+    int             nondigits = 0;
+
+    for (len = 1; issym(cp[len]); len++) {
+        if (!isdig(cp[len]))
+            nondigits++;
+    }
+
+    if (nondigits == 0)
+        return 1;                      /* A plain digit string */
+
+    if (len > Glb_symbol_len)
+        len = Glb_symbol_len;
+
+    return nondigits == 1 && cp[len - 1] != '$';
+}
+
+/* parse_digits - convert len characters, already known to be valid
+   digits in radix rad, into a number.  On little-endian hosts eight
+   (then four) digits at a time are combined inside one machine word,
+   SWAR fashion: adjacent digits are paired, then pairs of pairs, and
+   so on.  Whatever remains is done one digit at a time.  Only the low
+   bits of the result matter, so overflow is allowed to wrap. */
+
+static unsigned parse_digits(const char *cp, int len, int rad)
+{
+    unsigned        value = 0;
+
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || defined(_WIN32)
+    unsigned        r2 = rad * rad;
+    unsigned        r4 = r2 * r2;
+
+    while (len >= 8) {
+        unsigned long long w;
+
+        memcpy(&w, cp, 8);
+        /* Digit values, '0'-'9' and 'A'-'F' alike */
+        w = (w & 0x0F0F0F0F0F0F0F0FULL) + 9 * ((w >> 6) & 0x0101010101010101ULL);
+        w = ((w * (rad * 256 + 1)) >> 8) & 0x00FF00FF00FF00FFULL;
+        w = ((w * (r2 * 65536ULL + 1)) >> 16) & 0x0000FFFF0000FFFFULL;
+        w = (w * (((unsigned long long) r4 << 32) + 1)) >> 32;
+        value = value * (r4 * r4) + (unsigned) w;
+        cp += 8;
+        len -= 8;
+    }
+
+    if (len >= 4) {
+        unsigned        w;
+
+        memcpy(&w, cp, 4);
+        w = (w & 0x0F0F0F0F) + 9 * ((w >> 6) & 0x01010101);
+        w = ((w * (rad * 256 + 1)) >> 8) & 0x00FF00FF;
+        w = (w * (r2 * 65536 + 1)) >> 16;
+        value = value * r4 + w;
+        cp += 4;
+        len -= 4;
+    }
+#endif
+
+    while (len-- > 0)
+        value = value * rad + digit_value[(unsigned char) *cp++];
+
+    return value;
+}
+
+/* parse_number - convert the digit string at cp (which is_number has
+   accepted) in radix rad, or decimal if it ends with a period.
+   Returns a pointer past the number, or NULL if there are no digits
+   valid in the radix. */
+
+static char *parse_number(char *cp, int rad, unsigned *value)
+{
+    char           *endcp;
+    int             len;
+
+    /* Look for a trailing period, to indicate decimal... */
+    for (endcp = cp; isdig(*endcp); endcp++) ;
+    if (*endcp == '.')
+        rad = 10;
+
+    for (len = 0; digit_value[(unsigned char) cp[len]] < rad; len++) ;
+    if (len == 0)
+        return NULL;
+
+    *value = parse_digits(cp, len, rad);
+    endcp = cp + len;
+    if (*endcp == '.')
+        endcp++;
+
+    return endcp;
+}
+
+/* parse_literal - recognize a list element that is nothing but a
+   number, optionally with a ^B ^O ^D or ^X radix prefix, followed by
+   a comma or the end of the statement.  Returns a pointer past the
+   number, or NULL if the element is anything else; parse_expr must
+   then be used.  This is the fast path for long .WORD/.BYTE data
+   lists. */
+
+char *parse_literal(char *cp, unsigned *value)
+{
+    int             rad = radix;
+    char           *endcp;
+
+    cp = skipwhite(cp);
+
+    if (*cp == '^') {
+        switch (tolower(cp[1])) {
+        case 'b':
+            rad = 2;
+            break;
+        case 'o':
+            rad = 8;
+            break;
+        case 'd':
+            rad = 10;
+            break;
+        case 'x':
+            rad = 16;
+            break;
+        default:
+            return NULL;
+        }
+        cp = skipwhite(cp + 2);
+    }
+
+    if (!isdig(*cp) || !is_number(cp))
+        return NULL;
+
+    if ((endcp = parse_number(cp, rad, value)) == NULL)
+        return NULL;
+
+    cp = skipwhite(endcp);
+    if (*cp != ',' && !EOL(*cp))
+        return NULL;                   /* Part of a larger expression */
+
+    return endcp;
+}
+
 /* parse_unary parses out a unary operator or leaf expression.  */
 
 EX_TREE *parse_unary(char *cp)
@@ -739,41 +1075,21 @@ EX_TREE *parse_unary(char *cp)
 
     /* Numeric constants are trickier than they need to be, */
     /* since local labels start with a digit too. */
-    if (isdigit(*cp)) {
-        char           *label;
-        int             local;
-
-        if ((label = get_symbol(cp, NULL, &local)) == NULL) {
-            char           *endcp;
-            unsigned long   value;
-            int             rad = radix;
-
-            /* get_symbol returning NULL assures me that it's not a
-               local label.  */
-
-            /* Look for a trailing period, to indicate decimal... */
-            for (endcp = cp; isdigit(*endcp); endcp++) ;
-            if (*endcp == '.')
-                rad = 10;
-
-            value = strtoul(cp, &endcp, rad);
-            if (*endcp == '.')
-                endcp++;
-
-            if (cp == endcp) {
-                //  Number in string can't be parsed. Most likely radix error
-                for (endcp = cp; isdigit(*endcp); endcp++) ;
-                return ex_err(NULL, endcp);
-
-            }
-            tp = new EX_TREE(EX_LIT);
-            tp->data.lit = value;
-            tp->cp = endcp;
-
-            return tp;
+    if (isdig(*cp) && is_number(cp)) {
+        char           *endcp;
+        unsigned        value;
+
+        if ((endcp = parse_number(cp, radix, &value)) == NULL) {
+            //  Number in string can't be parsed. Most likely radix error
+            for (endcp = cp; isdig(*endcp); endcp++) ;
+            return ex_err(NULL, endcp);
         }
 
-        free(label);
+        tp = new EX_TREE(EX_LIT);
+        tp->data.lit = value;
+        tp->cp = endcp;
+
+        return tp;
     }
 
     /* Now check for a symbol */
@@ -792,10 +1108,14 @@ EX_TREE *parse_unary(char *cp)
         }
 
         sym = Glb_symbol_st.lookup_sym(label);
-        if (sym == NULL) {
+        if (sym != NULL)
+            replay_note_use(sym);
+        else {
             /* A symbol from the "PST", which means an instruction
                code. */
             sym = Glb_system_st.lookup_sym(label);
+            if (sym != NULL && sym->section->type != SECTION_REGISTER)
+                replay_note_permanent(label);
         }
 
         if (sym != NULL) {
@@ -847,3 +1167,52 @@ EX_TREE *parse_expr(char *cp, int undef)
         return expr;
     }
 }
+
+/*
+  parse_value - like parse_expr, but evaluates into the caller's
+  EX_VALUE.  Simple expressions don't allocate anything beyond the
+  parse tree; anything else is kept as an evaluated tree in
+  value->tree (type EXV_COMPLEX).  Returns the end of the expression.
+*/
+
+char *parse_value(char *cp, int undef, EX_VALUE *value)
+{
+    EX_TREE        *expr;
+
+    expr = parse_binary(cp, 0, 0);     /* Parse into a tree */
+    value->cp = expr->cp;
+    if (expr->type == EX_ERR) {
+        value->type = EXV_COMPLEX;
+        value->tree = expr;
+        return value->cp;
+    }
+
+    if (!expr->eval(undef, value)) {
+        EX_TREE        *tree = expr->evaluate(undef);
+
+        /* evaluate() can still fold to something simple, e.g. X*0 */
+        switch (tree->type) {
+        case EX_LIT:
+            value->set_lit(tree->data.lit);
+            delete (tree);
+            break;
+        case EX_SYM:
+            value->type = EXV_SYM;
+            value->sym = tree->data.symbol;
+            delete (tree);
+            break;
+        case EX_TEMP_SYM:
+            value->set_temp(tree->data.symbol->section, tree->data.symbol->value);
+            delete (tree);
+            break;
+        default:
+            value->type = EXV_COMPLEX;
+            value->tree = tree;
+            tree->cp = expr->cp;
+            break;
+        }
+    }
+    delete (expr);
+
+    return value->cp;
+}
@@ -6,21 +6,42 @@
 #include "assemble_aux.h"              /* ADDR_MODE */
 
 
+/* Character classes for char_class[] */
+#define CC_SYM          01             /* May be part of a symbol */
+#define CC_DIGIT        02             /* Decimal digit */
+#define CC_WHITE        04             /* Blank or tab */
+#define CC_BINOP        010            /* Binary operator, see parse_binary */
+
+#ifndef PARSE__C
+extern THREAD_LOCAL unsigned char char_class[256];  /* Built by init_char_class() */
+#endif
+
 // is char 'c' part of a symbol?
-#define issym(c) (isalpha(c) || isdigit(c) \
-		|| (c) == '.' || (c) == '$' \
-        || (Glb_symbol_allow_underscores && (c) == '_'))
+#define issym(c) (char_class[(unsigned char) (c)] & CC_SYM)
+#define isdig(c) (char_class[(unsigned char) (c)] & CC_DIGIT)
+
+void   init_char_class(void);
+
+/* An entry in a list of directives for get_directive; the list ends
+   with a NULL name. */
+struct DIRECTIVE {
+    const char     *name;       /* Upper case, e.g. ".ENDM" */
+    int             value;      /* What get_directive returns for it */
+};
 
 
 char  *skipwhite(char *cp);
 char  *skipdelim(char *cp);
 
 SYMBOL  *get_op(char *cp, char **endp);
+int      get_directive(char *cp, char **endp, const DIRECTIVE *dirs);
 char    *getstring(char *cp,char **endp);
 char    *get_symbol(char *cp, char **endp, int *islocal);
 int      get_mode(char *cp, char **endp, ADDR_MODE *mode);
 
 EX_TREE *parse_expr(char *cp, int undef);
+char    *parse_value(char *cp, int undef, EX_VALUE *value);
+char    *parse_literal(char *cp, unsigned *value);
 int      parse_float(char *cp, char **endp, int size, unsigned *flt);
 int      brackrange(char *cp, int *start, int *length, char **endp);
 
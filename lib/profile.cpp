@@ -0,0 +1,271 @@
+#define PROFILE__C
+
+/*
+        The macro expansion profiler
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "profile.h"                   /* my own definitions */
+
+#include "util.h"
+#include "assemble_globals.h"
+
+
+THREAD_LOCAL int             prof_enabled = 0;      /* Whether to profile at all */
+
+#define PROF_HASH_SIZE 1024            /* Must be a power of 2 */
+
+static THREAD_LOCAL PROF_SITE *prof_hash[PROF_HASH_SIZE];
+static THREAD_LOCAL int      prof_nsites;           /* Sites in prof_hash */
+static THREAD_LOCAL PROF_SITE *prof_current;        /* The site being charged */
+static THREAD_LOCAL double   prof_outside;          /* Time charged to no site */
+static THREAD_LOCAL clock_t  prof_mark;             /* When the charge started */
+static THREAD_LOCAL int      prof_replayed;         /* The second pass replays the first */
+
+/* prof_switch charges the time since the last switch to the current
+   site, and makes site the current one. */
+
+static void prof_switch(PROF_SITE *site)
+{
+    clock_t         now = clock();
+    double          elapsed = (double) (now - prof_mark) / CLOCKS_PER_SEC;
+
+    if (prof_current)
+        prof_current->seconds += elapsed;
+    else
+        prof_outside += elapsed;
+    prof_mark = now;
+    prof_current = site;
+}
+
+static unsigned prof_hash_string(unsigned hash, const char *cp)
+{
+    while (*cp)
+        hash = (hash ^ (unsigned char) *cp++) * 16777619u;
+    return (hash ^ 0xff) * 16777619u;
+}
+
+/* prof_begin is called when an expansion starts.  It finds or makes
+   the site, and charges it from now on: for the expansion itself,
+   and, through prof_line, for the lines it produces. */
+
+PROF_SITE *prof_begin(const char *name, const char *defined, STREAM *caller)
+{
+    char           *called;
+    unsigned        hash;
+    PROF_SITE      *site;
+
+    called = (char *)memcheck(malloc(strlen(caller->name) + 32));
+    sprintf(called, "%s:%d", caller->name, caller->line);
+    if (defined == NULL)
+        defined = called;
+
+    hash = prof_hash_string(2166136261u, name);
+    hash = prof_hash_string(hash, defined);
+    hash = prof_hash_string(hash, called) & (PROF_HASH_SIZE - 1);
+
+    for (site = prof_hash[hash]; site != NULL; site = site->next) {
+        if (strcmp(site->name, name) == 0 && strcmp(site->defined, defined) == 0 &&
+            strcmp(site->called, called) == 0)
+            break;
+    }
+
+    if (site == NULL) {
+        site = (PROF_SITE *)memcheck(calloc(1, sizeof(PROF_SITE)));
+        site->name = (char *)memcheck(strdup(name));
+        site->defined = (char *)memcheck(strdup(defined));
+        site->called = called;
+        site->next = prof_hash[hash];
+        prof_hash[hash] = site;
+        prof_nsites++;
+    } else
+        free(called);
+
+    if (pass == 0 || !prof_replayed)
+        site->expansions++;
+    prof_switch(site);
+
+    return site;
+}
+
+/* prof_second_pass is called as the second pass starts.  A replay of
+   the first expands nothing, so the expansions the first pass counted
+   stand; otherwise they're counted over again. */
+
+void prof_second_pass(int replayed)
+{
+    PROF_SITE      *site;
+    int             i;
+
+    prof_replayed = replayed;
+    if (replayed)
+        return;
+    for (i = 0; i < PROF_HASH_SIZE; i++) {
+        for (site = prof_hash[i]; site != NULL; site = site->next)
+            site->expansions = 0;
+    }
+}
+
+/* prof_charge charges site from now on, as when its expansion
+   began, for a data-only .REPT a replay stores again. */
+
+void prof_charge(PROF_SITE *site)
+{
+    prof_switch(site);
+}
+
+/* prof_line is called for each line assemble reads; str is the
+   stream it came from. */
+
+void prof_line(STREAM *str)
+{
+    prof_switch(str->prof);
+    if (pass && prof_current)
+        prof_current->lines++;
+}
+
+/* prof_lines counts lines assembled without being read, as by
+   store_rept_data. */
+
+void prof_lines(int count)
+{
+    if (pass && prof_current)
+        prof_current->lines += count;
+}
+
+/* prof_bytes counts object bytes stored. */
+
+void prof_bytes(int count)
+{
+    if (pass && prof_current)
+        prof_current->bytes += count;
+}
+
+/* prof_sites returns all the sites, in an allocated array. */
+
+static PROF_SITE **prof_sites(void)
+{
+    PROF_SITE     **sites;
+    PROF_SITE      *site;
+    int             i,
+                    n = 0;
+
+    prof_switch(prof_current);         /* Bring the time up to date */
+
+    sites = (PROF_SITE **)memcheck(malloc((prof_nsites + 1) * sizeof(PROF_SITE *)));
+    for (i = 0; i < PROF_HASH_SIZE; i++) {
+        for (site = prof_hash[i]; site != NULL; site = site->next)
+            sites[n++] = site;
+    }
+
+    return sites;
+}
+
+static int compare_definition(const void *a, const void *b)
+{
+    const PROF_SITE *sa = *(const PROF_SITE * const *) a;
+    const PROF_SITE *sb = *(const PROF_SITE * const *) b;
+    int             cmp = strcmp(sa->name, sb->name);
+
+    return cmp ? cmp : strcmp(sa->defined, sb->defined);
+}
+
+static int compare_cost(const void *a, const void *b)
+{
+    const PROF_SITE *sa = *(const PROF_SITE * const *) a;
+    const PROF_SITE *sb = *(const PROF_SITE * const *) b;
+
+    if (sa->seconds != sb->seconds)
+        return sa->seconds < sb->seconds ? 1 : -1;
+    if (sa->bytes != sb->bytes)
+        return sa->bytes < sb->bytes ? 1 : -1;
+    return compare_definition(a, b);
+}
+
+static void print_site(FILE *fp, PROF_SITE *site, const char *where, double total)
+{
+    fprintf(fp, "%10ld %10ld %10ld %9.3f %5.1f%%  %s (%s)\n",
+            site->expansions, site->lines, site->bytes, site->seconds,
+            total > 0 ? site->seconds * 100 / total : 0.0, site->name, where);
+}
+
+/* prof_report writes the profile as text: the definitions, then the
+   call sites, each with the most expensive first. */
+
+void prof_report(FILE *fp)
+{
+    PROF_SITE     **sites = prof_sites();
+    PROF_SITE      *defs;
+    PROF_SITE     **byref;
+    double          total = prof_outside;
+    int             ndefs = 0;
+    int             i;
+
+    for (i = 0; i < prof_nsites; i++)
+        total += sites[i]->seconds;
+
+    /* Sum up the sites of each definition */
+    qsort(sites, prof_nsites, sizeof(PROF_SITE *), compare_definition);
+    defs = (PROF_SITE *)memcheck(calloc(prof_nsites + 1, sizeof(PROF_SITE)));
+    byref = (PROF_SITE **)memcheck(malloc((prof_nsites + 1) * sizeof(PROF_SITE *)));
+    for (i = 0; i < prof_nsites; i++) {
+        if (i == 0 || compare_definition(&sites[i - 1], &sites[i]) != 0) {
+            defs[ndefs].name = sites[i]->name;
+            defs[ndefs].defined = sites[i]->defined;
+            byref[ndefs] = &defs[ndefs];
+            ndefs++;
+        }
+        defs[ndefs - 1].expansions += sites[i]->expansions;
+        defs[ndefs - 1].lines += sites[i]->lines;
+        defs[ndefs - 1].bytes += sites[i]->bytes;
+        defs[ndefs - 1].seconds += sites[i]->seconds;
+    }
+
+    fprintf(fp, "Macro expansion profile: %.3f seconds in all, both passes\n\n", total);
+
+    fprintf(fp, "By definition:\n");
+    fprintf(fp, "Expansions      Lines      Bytes   Seconds   Time  Name (defined at)\n");
+    qsort(byref, ndefs, sizeof(PROF_SITE *), compare_cost);
+    for (i = 0; i < ndefs; i++)
+        print_site(fp, byref[i], byref[i]->defined, total);
+
+    fprintf(fp, "\nBy call site:\n");
+    fprintf(fp, "Expansions      Lines      Bytes   Seconds   Time  Name (called from)\n");
+    qsort(sites, prof_nsites, sizeof(PROF_SITE *), compare_cost);
+    for (i = 0; i < prof_nsites; i++)
+        print_site(fp, sites[i], sites[i]->called, total);
+
+    free(byref);
+    free(defs);
+    free(sites);
+}
+
+/* prof_write writes the profile for other programs to read: a
+   heading line, then a line per call site, with tab-separated
+   fields.  Returns FALSE if the file can't be written. */
+
+int prof_write(const char *filename)
+{
+    PROF_SITE     **sites = prof_sites();
+    FILE           *fp;
+    int             i;
+
+    fp = fopen(filename, "w");
+    if (fp == NULL) {
+        free(sites);
+        return FALSE;
+    }
+
+    qsort(sites, prof_nsites, sizeof(PROF_SITE *), compare_cost);
+    fprintf(fp, "name\tdefined\tcalled\texpansions\tlines\tbytes\tseconds\n");
+    for (i = 0; i < prof_nsites; i++)
+        fprintf(fp, "%s\t%s\t%s\t%ld\t%ld\t%ld\t%.6f\n", sites[i]->name, sites[i]->defined, sites[i]->called,
+                sites[i]->expansions, sites[i]->lines, sites[i]->bytes, sites[i]->seconds);
+    fprintf(fp, "(outside)\t\t\t0\t0\t0\t%.6f\n", prof_outside);
+
+    free(sites);
+    return fclose(fp) == 0;
+}
@@ -0,0 +1,43 @@
+#ifndef PROFILE__H
+#define PROFILE__H
+
+/* The expansion profiler.  Every macro call, .REPT, .IRP and .IRPC
+   is a site: the name and where it's defined (a file and line, or a
+   macro library), and where it was called from.  Each site counts
+   its expansions, the lines its expansions feed back into assemble,
+   the object bytes stored by those lines, and the time spent
+   expanding and assembling them.  Time is counted in both passes,
+   everything else in the second, but for the expansions when the
+   second pass replays the first (see replay.h): it expands nothing,
+   and its lines are charged to the sites they came from then. */
+
+#include <stdio.h>
+
+#include "stream2.h"
+#include "util.h"
+
+struct PROF_SITE {
+    char     *name;       /* Macro name, or .REPT, .IRP, .IRPC */
+    char     *defined;    /* Where the definition comes from */
+    char     *called;     /* Where it was called from */
+    long      expansions; /* Times expanded */
+    long      lines;      /* Lines assembled from the expansions */
+    long      bytes;      /* Object bytes stored by those lines */
+    double    seconds;    /* Time expanding and assembling them */
+    PROF_SITE *next;      /* Hash chain */
+};
+
+#ifndef PROFILE__C
+extern THREAD_LOCAL int prof_enabled;          /* Whether to profile at all */
+#endif
+
+PROF_SITE *prof_begin(const char *name, const char *defined, STREAM *caller);
+void       prof_second_pass(int replayed);
+void       prof_charge(PROF_SITE *site);
+void       prof_line(STREAM *str);
+void       prof_lines(int count);
+void       prof_bytes(int count);
+void       prof_report(FILE *fp);
+int        prof_write(const char *filename);
+
+#endif
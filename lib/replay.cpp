@@ -0,0 +1,716 @@
+#define REPLAY__C
+
+/*
+        Recording the first pass, and replaying it in the second
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay.h"                    /* my own definitions */
+
+#include "util.h"
+#include "assemble_aux.h"
+#include "assemble_globals.h"
+#include "symbols.h"
+#include "listing.h"
+#include "profile.h"
+
+
+THREAD_LOCAL int             replay_recording = FALSE;       /* The first pass is recording */
+THREAD_LOCAL int             replaying = FALSE;     /* The second pass is replaying */
+THREAD_LOCAL int             replay_onepass = FALSE; /* The first pass's object code is kept */
+
+#define REPLAY_MAX (256L * 1024 * 1024)  /* Most memory a recording may take */
+
+enum {
+    REPLAY_ASSEMBLE,                   /* Assemble the line again */
+    REPLAY_SKIP,                       /* The first pass did all it needs */
+    REPLAY_REPT,                       /* Store a data-only .REPT again */
+    REPLAY_LIST,                       /* A line of a body, only to be listed */
+    REPLAY_SUPPRESSED                  /* A line a conditional passed over */
+};
+
+/* A recorded line.  The text of the lines and the stream names are
+   kept together in replay_text, so they're found by offset; a
+   recording is kept small enough for an int to do. */
+
+typedef struct replay_rec {
+    int             text;       /* Offset of the line */
+    int             name;       /* Offset of the name of its stream */
+    int             line;       /* Its line number in that stream */
+    int             stmtno;     /* stmtno before it */
+    short           cond;       /* last_cond before it */
+    char            kind;       /* What to do with it */
+    char            reported;   /* The first pass found an error in it */
+    int             value;      /* .NARG value, or index in replay_bodies */
+} REPLAY_REC;
+
+typedef struct replay_body {
+    BUFFER         *body;       /* A data-only .REPT's body */
+    int             count;      /* and count */
+    PROF_SITE      *prof;       /* Its profiler site, or NULL */
+} REPLAY_BODY;
+
+static THREAD_LOCAL char    *replay_text;           /* Lines and names */
+static THREAD_LOCAL int      replay_length,
+                replay_size;
+static THREAD_LOCAL REPLAY_REC *replay_recs;        /* The lines, in order */
+static THREAD_LOCAL PROF_SITE **replay_sites;       /* Their profiler sites, if profiling */
+static THREAD_LOCAL int      replay_nrecs,
+                replay_maxrecs,
+                replay_cur;            /* The line being recorded */
+/* A line to be assembled again in one-pass mode, and how things
+   stood when it began.  What it stored each time is found in the
+   journal of the object code, by offset. */
+
+typedef struct replay_fix {
+    int             rec;        /* Index of the line in replay_recs */
+    SECTION        *section;    /* current_pc->section */
+    unsigned        dot;        /* DOT */
+    SECTION        *dot_section; /* last_dot_section */
+    unsigned        dot_addr;   /* last_dot_addr */
+    int             code,       /* What the first pass stored */
+                    code_end;
+    int             redo,       /* What it stored when assembled again */
+                    redo_end;
+    int             radix;
+    int             lsb;
+    int             suppressed;
+    char            enabl_ama;
+    char            enabl_lsb;
+} REPLAY_FIX;
+
+/* A symbol a line to be assembled again used, and its value then */
+
+typedef struct replay_use {
+    SYMBOL         *sym;
+    unsigned        value;
+    SECTION        *section;
+} REPLAY_USE;
+
+static THREAD_LOCAL REPLAY_BODY *replay_bodies;     /* The data-only .REPTs */
+static THREAD_LOCAL int      replay_nbodies,
+                replay_maxbodies;
+static THREAD_LOCAL int     *replay_undef;          /* Names .IF DF/NDF found undefined */
+static THREAD_LOCAL int      replay_nundef,
+                replay_maxundef;
+static THREAD_LOCAL int      replay_final_cond;     /* last_cond when the first pass ended */
+static THREAD_LOCAL REPLAY_FIX *replay_fixes;       /* The lines to assemble again */
+static THREAD_LOCAL int      replay_nfixes,
+                replay_maxfixes;
+static THREAD_LOCAL REPLAY_USE *replay_uses;        /* The symbols they used */
+static THREAD_LOCAL int      replay_nuses,
+                replay_maxuses,
+                replay_line_uses;      /* Where the line being recorded's begin */
+static THREAD_LOCAL REPLAY_FIX replay_line;         /* How the line being recorded began */
+static THREAD_LOCAL BUFFER  *replay_code;           /* The journal of the object code, or NULL */
+static THREAD_LOCAL int      replay_code_end;       /* Where the first pass's ends */
+static THREAD_LOCAL REPLAY_REC *replay_current;     /* The line being replayed */
+
+/* replay_add_text adds a string to replay_text, returning its offset. */
+
+static int replay_add_text(const char *text, int len)
+{
+    int             offset = replay_length;
+
+    if (replay_length + len + 1 > replay_size) {
+        replay_size = replay_size ? replay_size * 2 : 65536;
+        while (replay_length + len + 1 > replay_size)
+            replay_size *= 2;
+        replay_text = (char *)memcheck(realloc(replay_text, replay_size));
+    }
+    memcpy(replay_text + replay_length, text, len);
+    replay_text[replay_length + len] = 0;
+    replay_length += len + 1;
+
+    return offset;
+}
+
+/* replay_start starts recording the first pass. */
+
+void replay_start(void)
+{
+    replay_free();
+    replay_recording = TRUE;
+}
+
+/* replay_keep_code sets one-pass mode, once recording has started:
+   the first pass's object code is kept.  code, if not NULL, is the
+   journal it and the lines assembled again are kept in. */
+
+void replay_keep_code(BUFFER *code)
+{
+    if (!replay_recording)
+        return;
+    replay_onepass = TRUE;
+    replay_code = code;
+}
+
+/* replay_check_fix gives up one-pass mode if the last line recorded
+   is to be assembled again, but didn't leave the conditionals as it
+   found them: it's assembled again outside of them. */
+
+static void replay_check_fix(void)
+{
+    if (replay_nfixes > 0 && replay_fixes[replay_nfixes - 1].rec == replay_cur &&
+        (last_cond != replay_recs[replay_cur].cond ||
+         suppressed != replay_fixes[replay_nfixes - 1].suppressed))
+        replay_no_onepass();
+}
+
+/* replay_end_line forgets the symbols the last line recorded used,
+   unless it's to be assembled again; then it notes where the code it
+   stored ends. */
+
+static void replay_end_line(void)
+{
+    if (replay_nfixes == 0 || replay_fixes[replay_nfixes - 1].rec != replay_cur)
+        replay_nuses = replay_line_uses;
+    else if (replay_code != NULL)
+        replay_fixes[replay_nfixes - 1].code_end = replay_code->length;
+    replay_line_uses = replay_nuses;
+}
+
+/* replay_add_rec adds a line to the recording, as str gave it, and
+   returns it, or NULL if the recording's been given up. */
+
+static REPLAY_REC *replay_add_rec(STREAM *str, const char *line, int kind)
+{
+    REPLAY_REC     *rec;
+    int             len;
+
+    if (replay_length + (long) replay_nrecs * sizeof(REPLAY_REC) > REPLAY_MAX) {
+        replay_spoil();                /* Too big to be worth it */
+        return NULL;
+    }
+
+    if (replay_nrecs == replay_maxrecs) {
+        replay_maxrecs = replay_maxrecs ? replay_maxrecs * 2 : 1024;
+        replay_recs = (REPLAY_REC *)memcheck(realloc(replay_recs, replay_maxrecs * sizeof(REPLAY_REC)));
+        if (prof_enabled)
+            replay_sites = (PROF_SITE **)memcheck(realloc(replay_sites, replay_maxrecs * sizeof(PROF_SITE *)));
+    }
+    if (prof_enabled)
+        replay_sites[replay_nrecs] = str->prof;
+    rec = &replay_recs[replay_nrecs++];
+
+    if (str->replay_name < 0)
+        str->replay_name = replay_add_text(str->name, strlen(str->name));
+    /* A buffer stream's line runs on into the next */
+    len = strcspn(line, "\n");
+    if (line[len] == '\n')
+        len++;
+    rec->text = replay_add_text(line, len);
+    rec->name = str->replay_name;
+    rec->line = str->line;
+    rec->stmtno = stmtno;
+    rec->cond = last_cond;
+    rec->kind = (char) kind;
+    rec->value = 0;
+    rec->reported = FALSE;
+
+    return rec;
+}
+
+/* replay_record records a line as assemble gets it, before it's
+   assembled; str is the stream it came from. */
+
+void replay_record(STREAM *str, const char *line)
+{
+    if (!replay_recording)
+        return;
+
+    if (replay_onepass) {
+        replay_check_fix();            /* The last line's done */
+        replay_end_line();
+    }
+
+    if (replay_add_rec(str, line, REPLAY_ASSEMBLE) == NULL)
+        return;
+    replay_cur = replay_nrecs - 1;
+
+    if (replay_onepass) {
+        replay_line.rec = replay_cur;
+        replay_line.section = current_pc->section;
+        replay_line.dot = current_pc->value;
+        replay_line.radix = radix;
+        replay_line.lsb = lsb;
+        replay_line.suppressed = suppressed;
+        replay_line.enabl_ama = enabl_ama;
+        replay_line.enabl_lsb = enabl_lsb;
+        replay_line.dot_section = last_dot_section;
+        replay_line.dot_addr = last_dot_addr;
+        replay_line.code = replay_line.code_end = replay_code != NULL ? replay_code->length : 0;
+        replay_line.redo = replay_line.redo_end = 0;
+    }
+}
+
+/* replay_record_listed records a line of a body that read_body
+   lists, when there's a listing: the replay lists it in its place. */
+
+void replay_record_listed(STREAM *str, const char *line)
+{
+    if (replay_recording && (lstfile != NULL || lstbuf != NULL))
+        replay_add_rec(str, line, REPLAY_LIST);
+}
+
+/* replay_skip marks the line being recorded as needing nothing more
+   in the replay. */
+
+void replay_skip(void)
+{
+    if (replay_recording && replay_nrecs > 0) {
+        replay_recs[replay_cur].kind = REPLAY_SKIP;
+        if (replay_recs[replay_cur].reported)
+            replay_spoil();
+    }
+}
+
+/* replay_suppressed marks the line being recorded as one an
+   unsatisfied conditional passed over, leaving it as it was.  The
+   conditionals go the same way in the replay, which needn't look at
+   the line again, but to list it. */
+
+void replay_suppressed(void)
+{
+    if (replay_recording && replay_nrecs > 0)
+        replay_recs[replay_cur].kind = REPLAY_SUPPRESSED;
+}
+
+/* replay_note_value keeps the value of the .NARG being recorded. */
+
+void replay_note_value(int value)
+{
+    if (replay_recording && replay_nrecs > 0)
+        replay_recs[replay_cur].value = value;
+}
+
+/* replay_note_rept keeps the body and count of the data-only .REPT
+   being recorded, which was stored without reading its lines, and
+   its profiler site. */
+
+void replay_note_rept(BUFFER *body, int count, PROF_SITE *prof)
+{
+    REPLAY_REC     *rec;
+
+    if (!replay_recording || replay_nrecs == 0)
+        return;
+
+    if (replay_nbodies == replay_maxbodies) {
+        replay_maxbodies = replay_maxbodies ? replay_maxbodies * 2 : 16;
+        replay_bodies = (REPLAY_BODY *)memcheck(realloc(replay_bodies, replay_maxbodies * sizeof(REPLAY_BODY)));
+    }
+    replay_bodies[replay_nbodies].body = buffer_clone(body);
+    replay_bodies[replay_nbodies].count = count;
+    replay_bodies[replay_nbodies].prof = prof;
+
+    rec = &replay_recs[replay_cur];
+    rec->kind = REPLAY_REPT;
+    rec->value = replay_nbodies++;
+}
+
+/* replay_add_undef notes a name the second pass must not find
+   defined. */
+
+static void replay_add_undef(const char *label)
+{
+    if (replay_nundef == replay_maxundef) {
+        replay_maxundef = replay_maxundef ? replay_maxundef * 2 : 16;
+        replay_undef = (int *)memcheck(realloc(replay_undef, replay_maxundef * sizeof(int)));
+    }
+    replay_undef[replay_nundef++] = replay_add_text(label, strlen(label));
+}
+
+/* replay_note_defined notes the symbols an .IF DF or NDF found
+   undefined, as the tests eval_defined and eval_undefined make. */
+
+void replay_note_defined(EX_TREE *value)
+{
+    if (!replay_recording)
+        return;
+
+    switch (value->type) {
+    case EX_UNDEFINED_SYM:
+        replay_add_undef(value->data.symbol->label);
+        break;
+    case EX_AND:
+    case EX_OR:
+        replay_note_defined(value->data.child.left);
+        replay_note_defined(value->data.child.right);
+        break;
+    default:
+        break;
+    }
+}
+
+/* replay_note_permanent notes an instruction or directive name used
+   as a value.  Defined later as a symbol, the second pass would see
+   that instead. */
+
+void replay_note_permanent(const char *label)
+{
+    if (replay_recording)
+        replay_add_undef(label);
+}
+
+/* replay_reported is told of each error the first pass finds.  One
+   in a line to be passed over would never be reported. */
+
+void replay_reported(void)
+{
+    if (replay_recording && replay_nrecs > 0) {
+        replay_recs[replay_cur].reported = TRUE;
+        if (replay_recs[replay_cur].kind == REPLAY_SKIP)
+            replay_spoil();
+        else
+            replay_fixup();            /* One pass reports it at the end */
+    }
+}
+
+/* replay_spoil gives up on the recording: something in the first
+   pass means the second may not go the same way. */
+
+void replay_spoil(void)
+{
+    if (replay_recording)
+        replay_free();
+}
+
+/* replay_fixup marks the line being recorded, in one-pass mode, to
+   be assembled again at the end. */
+
+void replay_fixup(void)
+{
+    if (!replay_recording || !replay_onepass || replay_nrecs == 0)
+        return;
+    if (replay_nfixes > 0 && replay_fixes[replay_nfixes - 1].rec == replay_cur)
+        return;                        /* Marked already */
+
+    if (replay_nfixes == replay_maxfixes) {
+        replay_maxfixes = replay_maxfixes ? replay_maxfixes * 2 : 256;
+        replay_fixes = (REPLAY_FIX *)memcheck(realloc(replay_fixes, replay_maxfixes * sizeof(REPLAY_FIX)));
+    }
+    replay_fixes[replay_nfixes++] = replay_line;
+}
+
+/* replay_no_onepass gives up one-pass mode: the second pass must be
+   a whole one, though it may still replay the recording. */
+
+void replay_no_onepass(void)
+{
+    replay_onepass = FALSE;
+}
+
+/* replay_note_use notes a symbol the line being recorded uses, with
+   its value then.  If the line is assembled again at the end, it
+   will see the symbol's last value, which must be the same. */
+
+void replay_note_use(SYMBOL *sym)
+{
+    REPLAY_USE     *use;
+
+    if (!replay_recording || !replay_onepass)
+        return;
+
+    if (replay_nuses == replay_maxuses) {
+        replay_maxuses = replay_maxuses ? replay_maxuses * 2 : 256;
+        replay_uses = (REPLAY_USE *)memcheck(realloc(replay_uses, replay_maxuses * sizeof(REPLAY_USE)));
+    }
+    use = &replay_uses[replay_nuses++];
+    use->sym = sym;
+    use->value = sym->value;
+    use->section = sym->section;
+}
+
+/* replay_stop ends the recording, after the first pass and
+   migrate_implicit.  It returns TRUE if the second pass can replay
+   it; if not, the recording is freed. */
+
+int replay_stop(void)
+{
+    int             i;
+
+    if (!replay_recording)
+        return FALSE;                  /* Never started, or spoiled */
+    if (replay_onepass) {
+        replay_check_fix();
+        replay_end_line();
+        if (replay_code != NULL)
+            replay_code_end = replay_code->length;
+
+        /* A line assembled again sees each symbol's last value */
+        for (i = 0; i < replay_nuses; i++)
+            if (replay_uses[i].sym->value != replay_uses[i].value ||
+                replay_uses[i].sym->section != replay_uses[i].section)
+                replay_no_onepass();
+    }
+    replay_recording = FALSE;
+
+    /* A symbol the first pass found undefined, but the second pass
+       will know, would make .IF DF or NDF go the other way, and a
+       defined instruction name would have another value */
+    for (i = 0; i < replay_nundef; i++) {
+        if (Glb_symbol_st.lookup_sym(replay_text + replay_undef[i]) != NULL) {
+            replay_free();
+            return FALSE;
+        }
+    }
+
+    replay_final_cond = last_cond;
+    return TRUE;
+}
+
+/* *** implement REPLAY_STREAM */
+
+/* The stream replays the recorded lines in order, each under the
+   name and line number of the stream it came from. */
+
+struct REPLAY_STREAM : STREAM {
+    REPLAY_STREAM(char *name) : STREAM(name), next_rec(0) { own_name = this->name; };
+    virtual ~REPLAY_STREAM() override;
+    char   *gets() override;
+    int     next_rec;   /* The next line to replay */
+    char   *own_name;   /* Its name, while name is each line's */
+};
+
+char *REPLAY_STREAM::gets()
+{
+    REPLAY_REC     *rec;
+
+    /* Lines a conditional passed over matter only to the listing and
+       the profiler */
+    do {
+        if (next_rec >= replay_nrecs) {
+            pop_cond(replay_final_cond);       /* As the streams left it */
+            replay_current = NULL;
+            return NULL;
+        }
+        rec = &replay_recs[next_rec++];
+    } while (rec->kind == REPLAY_SUPPRESSED && lstfile == NULL && lstbuf == NULL && !prof_enabled);
+
+    /* Unwind the conditionals the streams did when they ended */
+    pop_cond(rec->cond);
+
+    name = replay_text + rec->name;
+    line = rec->line;
+    stmtno = rec->stmtno;
+    if (replay_sites != NULL)
+        prof = replay_sites[rec - replay_recs];
+    replay_current = rec;
+
+    return replay_text + rec->text;
+}
+
+REPLAY_STREAM::~REPLAY_STREAM()
+{
+    name = own_name;
+    replaying = FALSE;
+    replay_current = NULL;
+}
+
+/* replay_stream returns a stream to replay the recording. */
+
+STREAM *replay_stream(void)
+{
+    replaying = TRUE;
+    return new REPLAY_STREAM((char *)"replay");
+}
+
+/* *** implement FIXUP_STREAM */
+
+/* The stream gives the lines to be assembled again in one-pass mode,
+   each as things stood when it began.  They're assembled outside of
+   the conditionals, which are kept for when the stream ends. */
+
+struct FIXUP_STREAM : STREAM {
+    FIXUP_STREAM(char *name) : STREAM(name), next_fix(0) {
+        own_name = this->name;
+        saved_cond = last_cond;
+        last_cond = -1;
+    };
+    virtual ~FIXUP_STREAM() override;
+    char   *gets() override;
+    int     next_fix;   /* The next line to assemble */
+    char   *own_name;   /* Its name, while name is each line's */
+    int     saved_cond; /* last_cond when the first pass ended */
+};
+
+char *FIXUP_STREAM::gets()
+{
+    REPLAY_FIX     *fix;
+    REPLAY_REC     *rec;
+
+    if (next_fix >= replay_nfixes) {
+        if (next_fix > 0 && replay_code != NULL)
+            replay_fixes[next_fix - 1].redo_end = replay_code->length;
+        replay_current = NULL;
+        return NULL;
+    }
+
+    fix = &replay_fixes[next_fix++];
+    rec = &replay_recs[fix->rec];
+
+    if (replay_code != NULL) {
+        if (next_fix > 1)
+            fix[-1].redo_end = replay_code->length;
+        fix->redo = fix->redo_end = replay_code->length;
+    }
+
+    current_pc->section = fix->section;
+    current_pc->value = fix->dot;
+    radix = fix->radix;
+    lsb = fix->lsb;
+    suppressed = 0;
+    enabl_ama = fix->enabl_ama;
+    enabl_lsb = fix->enabl_lsb;
+    last_dot_section = fix->dot_section;
+    last_dot_addr = fix->dot_addr;
+
+    name = replay_text + rec->name;
+    line = rec->line;
+    stmtno = rec->stmtno;
+    replay_current = rec;
+
+    return replay_text + rec->text;
+}
+
+FIXUP_STREAM::~FIXUP_STREAM()
+{
+    name = own_name;
+    last_cond = saved_cond;
+    replaying = FALSE;
+    replay_current = NULL;
+}
+
+/* replay_fixup_stream returns a stream of the lines to be assembled
+   again in one-pass mode. */
+
+STREAM *replay_fixup_stream(void)
+{
+    replaying = TRUE;
+    return new FIXUP_STREAM((char *)"fixup");
+}
+
+/* replay_write_code writes the object code one-pass mode kept: the
+   first pass's, with what each line assembled again stored in place
+   of what it stored the first time, so that the records come out as
+   the second pass would have made them.  Returns 0 if writing
+   failed. */
+
+int replay_write_code(TEXT_RLD *tr)
+{
+    REPLAY_FIX     *fix;
+    int             pos = 0;
+    int             i;
+
+    if (replay_code == NULL)
+        return 1;
+
+    for (i = 0; i < replay_nfixes; i++) {
+        fix = &replay_fixes[i];
+        if (!tr->text_play(replay_code->buffer + pos, fix->code - pos) ||
+            !tr->text_play(replay_code->buffer + fix->redo, fix->redo_end - fix->redo))
+            return 0;
+        pos = fix->code_end;
+    }
+
+    return tr->text_play(replay_code->buffer + pos, replay_code_end - pos);
+}
+
+/* replay_skipped tells whether the line being replayed needs nothing
+   more. */
+
+int replay_skipped(void)
+{
+    return replay_current != NULL && replay_current->kind == REPLAY_SKIP;
+}
+
+/* replay_listed tells whether the line being replayed is only to be
+   listed. */
+
+int replay_listed(void)
+{
+    return replay_current != NULL &&
+        (replay_current->kind == REPLAY_LIST || replay_current->kind == REPLAY_SUPPRESSED);
+}
+
+/* replay_body_line tells whether the line being replayed is a line
+   of a body, which read_body read rather than assemble. */
+
+int replay_body_line(void)
+{
+    return replay_current != NULL && replay_current->kind == REPLAY_LIST;
+}
+
+/* replay_list_body lists the lines of the body that follow the line
+   being replayed, as reading the body did, when that line doesn't
+   read it.  It's still the line being replayed afterwards. */
+
+void replay_list_body(STACK *stack)
+{
+    REPLAY_REC     *rec = replay_current;
+
+    while (replay_current != NULL && replay_current + 1 < replay_recs + replay_nrecs &&
+           replay_current[1].kind == REPLAY_LIST) {
+        list_flush();
+        list_source(stack->top, stack->gets());
+    }
+    replay_current = rec;
+}
+
+/* replay_value returns the .NARG value the first pass found. */
+
+int replay_value(void)
+{
+    return replay_current != NULL ? replay_current->value : 0;
+}
+
+/* replay_rept_body returns the body of a data-only .REPT, with its
+   count in *count and its profiler site in *prof, or NULL if the line
+   isn't one. */
+
+BUFFER *replay_rept_body(int *count, PROF_SITE **prof)
+{
+    if (replay_current == NULL || replay_current->kind != REPLAY_REPT)
+        return NULL;
+    *count = replay_bodies[replay_current->value].count;
+    *prof = replay_bodies[replay_current->value].prof;
+    return replay_bodies[replay_current->value].body;
+}
+
+/* replay_free frees the recording. */
+
+void replay_free(void)
+{
+    int             i;
+
+    for (i = 0; i < replay_nbodies; i++)
+        buffer_free(replay_bodies[i].body);
+    free(replay_bodies);
+    free(replay_recs);
+    free(replay_sites);
+    free(replay_text);
+    free(replay_undef);
+    free(replay_fixes);
+    free(replay_uses);
+
+    replay_recs = NULL;
+    replay_sites = NULL;
+    replay_nrecs = replay_maxrecs = replay_cur = 0;
+    replay_bodies = NULL;
+    replay_nbodies = replay_maxbodies = 0;
+    replay_text = NULL;
+    replay_length = replay_size = 0;
+    replay_undef = NULL;
+    replay_nundef = replay_maxundef = 0;
+    replay_fixes = NULL;
+    replay_nfixes = replay_maxfixes = 0;
+    replay_uses = NULL;
+    replay_nuses = replay_maxuses = replay_line_uses = 0;
+    replay_code = NULL;
+    replay_code_end = 0;
+    replay_recording = FALSE;
+    replay_onepass = FALSE;
+    replay_current = NULL;
+}
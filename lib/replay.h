@@ -0,0 +1,86 @@
+#ifndef REPLAY__H
+#define REPLAY__H
+
+/* The first pass records the text of every line it assembles, after
+   all macro, .REPT, .IRP, .IRPC and .INCLUDE processing, with where
+   it came from.  The second pass can then read the recording instead
+   of the source: the expansions are in it already, so a line that
+   expanded something, defined a macro, fetched one with .MCALL, or
+   otherwise only moved the input around is marked to be passed over.
+   The other lines are source text still, and are parsed and assembled
+   again as from the source; only the reading and expanding is saved.
+   A .NARG keeps its value, and a .REPT that stored its data all at
+   once keeps its body and count, to store it again.  Conditionals
+   are done over, as their lines are in the recording.  With a
+   listing, the lines of the bodies read_body lists are recorded as
+   well, to be listed in their place.  With the profiler, each line
+   keeps the site it's charged to (see profile.h).
+
+   The recording is only replayed if nothing could make the second
+   pass read its input differently, or move the location counter
+   differently: no .IF, .REPT count, \expression argument, .BLKW,
+   .BLKB or ORG needed a value the first pass didn't have; no .IF DF
+   or NDF asked about a symbol it didn't yet know and then defined,
+   nor was an instruction name used as a value and then defined; and
+   no line passed over had an error, which only assembling it again
+   would report.
+
+   In one-pass mode the first pass's object code is kept as well, and
+   only the lines it couldn't finish are assembled again, at the end
+   and as they stood: those with a forward reference or a complex
+   relocation stored in them, which store a zero meanwhile, and those
+   with an error, to report it.  No table of fixups is kept to patch
+   the code with; each such line is parsed and assembled again from
+   its recorded text.  A listing shows every line with its final
+   code, so with one there's no one-pass mode and the second pass is
+   a whole one, and so it is with the profiler.  A line assembled again sees the
+   symbols as they were left, so one-pass mode also needs that every
+   symbol such a line used still has the value it had then, that no
+   symbol is given a value too complex to assign, and that such lines
+   leave the conditionals alone.
+
+   The object code is then kept as a journal of what the first pass
+   stored (see TEXT_RLD), and what each such line stores at the end
+   takes the place of what it stored the first time, so the records
+   are written as a whole second pass would write them. */
+
+#include "stream2.h"
+#include "util.h"
+#include "extree.h"
+#include "object.h"
+
+
+#ifndef REPLAY__C
+extern THREAD_LOCAL int replay_recording;      /* The first pass is recording */
+extern THREAD_LOCAL int replaying;             /* The second pass is replaying */
+extern THREAD_LOCAL int replay_onepass;        /* The first pass's object code is kept */
+#endif
+
+void       replay_start(void);
+void       replay_keep_code(BUFFER *code);
+void       replay_record(STREAM *str, const char *line);
+void       replay_record_listed(STREAM *str, const char *line);
+void       replay_skip(void);
+void       replay_suppressed(void);
+void       replay_note_value(int value);
+void       replay_note_rept(BUFFER *body, int count, PROF_SITE *prof);
+void       replay_note_defined(EX_TREE *value);
+void       replay_note_permanent(const char *label);
+void       replay_reported(void);
+void       replay_spoil(void);
+void       replay_fixup(void);
+void       replay_no_onepass(void);
+void       replay_note_use(SYMBOL *sym);
+int        replay_stop(void);
+STREAM    *replay_stream(void);
+STREAM    *replay_fixup_stream(void);
+int        replay_write_code(TEXT_RLD *tr);
+int        replay_skipped(void);
+int        replay_listed(void);
+int        replay_body_line(void);
+void       replay_list_body(STACK *stack);
+int        replay_value(void);
+BUFFER    *replay_rept_body(int *count, PROF_SITE **prof);
+void       replay_free(void);
+
+#endif
@@ -11,10 +11,14 @@
 #include "rept_irpc.h"                 /* my own definitions */
 
 #include "util.h"
+#include "assemble.h"
 #include "assemble_aux.h"
 #include "parse.h"
 #include "listing.h"
 #include "macros.h"
+#include "profile.h"
+#include "replay.h"
+#include "symbols.h"
 #include "assemble_globals.h"
 
 
@@ -74,18 +78,22 @@ REPT_STREAM   *expand_rept(
     STACK *stack,
     char *cp)
 {
-    EX_TREE        *value;
+    EX_VALUE        value;
     BUFFER         *gb;
     REPT_STREAM    *rstr;
+    PROF_SITE      *site = NULL;
     int             levelmod;
 
-    value = parse_expr(cp, 0);
-    if (value->type != EX_LIT) {
+    parse_value(cp, 0, &value);
+    if (value.type != EXV_LIT) {
+        replay_spoil();                /* The second pass may repeat it */
         report(stack->top, ".REPT value must be constant\n");
-        delete (value);
         return NULL;
     }
 
+    if (prof_enabled)
+        site = prof_begin(".REPT", NULL, stack->top);
+
     gb = new BUFFER();
 
     levelmod = 0;
@@ -98,34 +106,246 @@ REPT_STREAM   *expand_rept(
 
     list_level += levelmod;
 
-    char           *name = (char *)memcheck(malloc(strlen(stack->top->name) + 32));
+    rstr = new_rept_stream(stack->top, gb, value.value, site);
+
+    buffer_free(gb);
+
+    return rstr;
+}
 
-    sprintf(name, "%s:%d->.REPT", stack->top->name, stack->top->line);
-    rstr = new REPT_STREAM(gb, name);
+/* new_rept_stream makes the stream to repeat a body count times, for
+   a .REPT read from refstr, charged to the profiler site prof. */
+
+REPT_STREAM    *new_rept_stream(
+    STREAM *refstr,
+    BUFFER *body,
+    int count,
+    PROF_SITE *prof)
+{
+    REPT_STREAM    *rstr;
+    char           *name = (char *)memcheck(malloc(strlen(refstr->name) + 32));
+
+    sprintf(name, "%s:%d->.REPT", refstr->name, refstr->line);
+    rstr = new REPT_STREAM(body, name);
     free(name);
-    
 
-    rstr->count = value->data.lit;
+    rstr->count = count;
     // rstr->bstr.stream.vtbl = &rept_stream_vtbl;
     rstr->savecond = last_cond;
-
-    buffer_free(gb);
-    delete (value);
+    rstr->prof = prof;
 
     return rstr;
 }
 
+/* A data-only repeat body is compiled to a list of items, each a
+   word or byte to store, or a block to skip. */
+
+typedef struct rept_item {
+    int             size;       /* 2 or 1 to store, 0 to skip */
+    unsigned        value;      /* What to store, or bytes to skip */
+} REPT_ITEM;
+
+#define REPT_RUN 1024                  /* Values stored per store_words */
+
+/* compile_rept_data compiles the body of a repeat block that only
+   stores constants: every statement is a .WORD or .BYTE of plain
+   numbers, a .BLKW or .BLKB of a plain number, or commentary.  It
+   returns the number of items, or -1 if the body is anything else or
+   its words wouldn't all fall on even addresses.  *nlines gets the
+   number of statements. */
+
+static int compile_rept_data(BUFFER *body, REPT_ITEM **itemsp, int *nlines)
+{
+    REPT_ITEM      *items = NULL;
+    int             nitems = 0,
+                    maxitems = 0;
+    unsigned        offset = 0;
+    int             haswords = FALSE;
+    char           *line = body->buffer,
+                   *end = body->buffer + body->length;
+
+    *nlines = 0;
+    while (line < end) {
+        char           *next = (char *) memchr(line, '\n', end - line);
+        char           *cp,
+                       *ncp,
+                       *label;
+        SYMBOL         *op;
+        int             local;
+
+        next = next ? next + 1 : end;
+        (*nlines)++;
+
+        cp = skipwhite(line);
+        if (EOL(*cp)) {
+            line = next;
+            continue;                  /* Commentary */
+        }
+
+        /* No labels, assignments or macro calls */
+        if ((label = get_symbol(cp, &ncp, &local)) == NULL)
+            goto fail;
+        if (*skipwhite(ncp) == ':' || *skipwhite(ncp) == '=' || Glb_macro_st.lookup_sym(label)) {
+            free(label);
+            goto fail;
+        }
+        if (!symbols_to_upper)
+            upcase(label);
+        op = Glb_system_st.lookup_sym(label);
+        free(label);
+        if (op == NULL || op->section->type != SECTION_PSEUDO)
+            goto fail;
+
+        cp = skipwhite(ncp);
+        switch (op->value) {
+        case P_WORD:
+        case P_BYTE:
+            {
+                int             size = op->value == P_WORD ? 2 : 1;
+
+                do {
+                    unsigned        value = 0;
+
+                    /* Nothing at all stores a 0, like do_word */
+                    if (!EOL(*cp)) {
+                        char           *endcp = parse_literal(cp, &value);
+
+                        if (endcp == NULL)
+                            goto fail;
+                        cp = skipdelim(endcp);
+                    }
+
+                    if (size == 2) {
+                        if (offset & 1)
+                            goto fail;  /* .WORD on odd boundary */
+                        haswords = TRUE;
+                    }
+                    if (nitems == maxitems) {
+                        maxitems = maxitems ? maxitems * 2 : 16;
+                        items = (REPT_ITEM *)memcheck(realloc(items, maxitems * sizeof(REPT_ITEM)));
+                    }
+                    items[nitems].size = size;
+                    items[nitems].value = value;
+                    nitems++;
+                    offset += size;
+                } while (!EOL(*cp));
+            }
+            break;
+
+        case P_BLKW:
+        case P_BLKB:
+            {
+                unsigned        value;
+                char           *endcp = parse_literal(cp, &value);
+
+                if (endcp == NULL || !EOL(*skipwhite(endcp)))
+                    goto fail;
+                value *= op->value == P_BLKW ? 2 : 1;
+
+                if (nitems == maxitems) {
+                    maxitems = maxitems ? maxitems * 2 : 16;
+                    items = (REPT_ITEM *)memcheck(realloc(items, maxitems * sizeof(REPT_ITEM)));
+                }
+                items[nitems].size = 0;
+                items[nitems].value = value;
+                nitems++;
+                offset += value;
+            }
+            break;
+
+        default:
+            goto fail;
+        }
+
+        line = next;
+    }
+
+    /* Each repetition must start on an even address too */
+    if (haswords && (offset & 1))
+        goto fail;
+
+    *itemsp = items;
+    return nitems;
+
+  fail:
+    free(items);
+    return -1;
+}
+
+/* store_rept_data stores a repeat block that only stores constants
+   all at once, instead of assembling its body over and over.  The
+   object file comes out the same; as the listing would show each
+   statement, it's not done while listing.  Returns TRUE, having
+   deleted the stream, if it did. */
+
+int store_rept_data(
+    REPT_STREAM *rstr,
+    TEXT_RLD *tr)
+{
+    REPT_ITEM      *items;
+    int             nitems,
+                    nlines;
+    unsigned        run[REPT_RUN];
+    int             nrun = 0,
+                    runsize = 0;
+    int             i,
+                    rep;
+
+    if (rstr->count <= 1 || (DOT & 1) || dolist())
+        return FALSE;
+    if ((nitems = compile_rept_data(rstr->buffer, &items, &nlines)) < 0)
+        return FALSE;
+    if (!count_expanded_lines((long) nlines * rstr->count)) {
+        free(items);                   /* Let the limit stop it, line by line */
+        return FALSE;
+    }
+
+    for (rep = 0; rep < rstr->count; rep++) {
+        for (i = 0; i < nitems; i++) {
+            if (nrun > 0 && (items[i].size != runsize || nrun == REPT_RUN)) {
+                store_words(rstr, tr, runsize, run, nrun);
+                nrun = 0;
+            }
+
+            if (items[i].size == 0) {
+                DOT += items[i].value;
+                change_dot(tr, 0);
+            } else {
+                runsize = items[i].size;
+                run[nrun++] = items[i].value;
+            }
+        }
+    }
+    if (nrun > 0)
+        store_words(rstr, tr, runsize, run, nrun);
+
+    stmtno += nlines * rstr->count;
+    if (prof_enabled)
+        prof_lines(nlines * rstr->count);
+    replay_note_rept(rstr->buffer, rstr->count, rstr->prof);
+
+    free(items);
+    delete rstr;
+    return TRUE;
+}
+
 /* *** implement IRP_STREAM */
 
+/* .IRP and .IRPC compile their body once, as a macro with the one
+   argument, and split the items into slices when the block is read.
+   Each iteration is then expanded into the stream's own buffer,
+   which is reused. */
+
 struct IRP_STREAM : public BUFFER_STREAM{
-    IRP_STREAM(BUFFER *buf, char *name) : BUFFER_STREAM(buf, name), offset(0), body(0), savecond(0) { str_type = TYPE_IRP_STREAM; };
+    IRP_STREAM(BUFFER *buf, char *name) : BUFFER_STREAM(buf, name), items(0), slices(0), nslices(0), next(0), body(0), savecond(0) { str_type = TYPE_IRP_STREAM; };
     virtual ~IRP_STREAM() override;
     // BUFFER_STREAM   bstr;
-    char           *label;      /* The substitution label */
     char           *items;      /* The substitution items (in source code
                                    format) */
-    int             offset;     /* Current offset into "items" */
-    BUFFER         *body;       /* Original body */
+    ARG_SLICE      *slices;     /* The items, split up */
+    int             nslices;
+    int             next;       /* The next item to substitute */
+    MACRO          *body;       /* Compiled body */
     int             savecond;   /* Saved conditional level */
 
     char           *gets() override;
@@ -134,6 +354,21 @@ struct IRP_STREAM : public BUFFER_STREAM{
 
 };
 
+/* compile_irp_body makes the body of an .IRP or .IRPC into a macro
+   with the one argument. */
+
+static MACRO   *compile_irp_body(char *label, BUFFER *gb)
+{
+    MACRO          *mac = new MACRO(label);
+
+    mac->args = new ARG();
+    mac->args->label = label;
+    mac->text = gb;
+    mac->index_args();
+    mac->compile_body();
+    return mac;
+}
+
 /* irp_stream_gets expands the IRP as the stream is read. */
 /* Each time an iteration is exhausted, the next iteration is
    generated. */
@@ -141,33 +376,19 @@ struct IRP_STREAM : public BUFFER_STREAM{
 char  *IRP_STREAM::gets()
 {
     char           *cp;
-    BUFFER         *buf;
-    ARG            *arg;
 
     for (;;) {
+        ARG_SLICE       val;
+
         if ((cp = BUFFER_STREAM::gets()) != NULL)
             return cp;
 
-        cp = items + offset;
-
-        if (!*cp)
+        if (next >= nslices)
             return NULL;               /* No more items.  EOF. */
 
-        arg = new ARG();
-        arg->next = NULL;
-        arg->locsym = 0;
-        arg->label = strdup(label);
-        arg->value = getstring(cp, &cp);
-        cp = skipdelim(cp);
-        offset = (int) (cp - items);
-
-        eval_arg(this, arg);
-        buf = subst_args(body, arg);
-
-        // free(arg->value);
-        delete (arg);
-        set_buffer(buf);
-        buffer_free(buf);
+        val = slices[next++];
+        fill_template(buffer, body, &val, this);
+        offset = 0;
     }
 }
 
@@ -179,9 +400,9 @@ IRP_STREAM::~IRP_STREAM()
 
     pop_cond(savecond);          /* complete unterminated conditionals */
 
-    buffer_free(body);
+    delete body;
+    free(slices);
     free(items);
-    free(label);
 }
 
 // STREAM_VTBL     irp_stream_vtbl = {
@@ -193,10 +414,14 @@ IRP_STREAM::~IRP_STREAM()
 IRP_STREAM  *expand_irp(STACK *stack, char *cp)
 {
     char           *label,
-                   *items;
-    BUFFER         *gb;
+                   *items,
+                   *end;
+    BUFFER         *gb,
+                   *scratch;
     int             levelmod = 0;
+    int             alloc = 0;
     IRP_STREAM     *str;
+    PROF_SITE      *site = NULL;
 
     label = get_symbol(cp, &cp, NULL);
     if (!label) {
@@ -213,6 +438,9 @@ IRP_STREAM  *expand_irp(STACK *stack, char *cp)
         return NULL;
     }
 
+    if (prof_enabled)
+        site = prof_begin(".IRP", NULL, stack->top);
+
     gb = new BUFFER();
 
     levelmod = 0;
@@ -228,17 +456,36 @@ IRP_STREAM  *expand_irp(STACK *stack, char *cp)
     char           *name = (char *)memcheck(malloc(strlen(stack->top->name) + 32));
 
     sprintf(name, "%s:%d->.IRP", stack->top->name, stack->top->line);
-    str = new IRP_STREAM(NULL, name);
+    scratch = new BUFFER();
+    str = new IRP_STREAM(scratch, name);
+    str->prof = site;
+    buffer_free(scratch);              /* The stream has it */
     free(name);
 
     // str->bstr.stream.vtbl = &irp_stream_vtbl;
 
-    str->body = gb;
+    str->body = compile_irp_body(label, gb);
     str->items = items;
-    str->offset = 0;
-    str->label = label;
     str->savecond = last_cond;
 
+    /* Split up the items, the way getstring would take them */
+    end = items + strlen(items);
+    for (cp = items; *cp; ) {
+        char           *ncp;
+
+        if (str->nslices >= alloc) {
+            alloc += 16;
+            str->slices = (ARG_SLICE *)memcheck(realloc(str->slices, alloc * sizeof(ARG_SLICE)));
+        }
+        ncp = get_arg_slice(cp, &str->slices[str->nslices++]);
+        if (ncp > end)
+            ncp = end;                 /* Unclosed bracket */
+        ncp = skipdelim(ncp);
+        if (ncp == cp)
+            break;                     /* Stuck on a ';' */
+        cp = ncp;
+    }
+
     return str;
 }
 
@@ -246,14 +493,13 @@ IRP_STREAM  *expand_irp(STACK *stack, char *cp)
 /* *** implement IRPC_STREAM */
 
 struct IRPC_STREAM : public BUFFER_STREAM {
-    IRPC_STREAM(BUFFER *buf, char *name) : BUFFER_STREAM(buf, name), offset(0), body(0), savecond(0) { str_type = TYPE_IRPC_STREAM; };
+    IRPC_STREAM(BUFFER *buf, char *name) : BUFFER_STREAM(buf, name), items(0), next(0), body(0), savecond(0) { str_type = TYPE_IRPC_STREAM; };
     virtual ~IRPC_STREAM() override;
 // BUFFER_STREAM   bstr;
-    char           *label;      /* The substitution label */
     char           *items;      /* The substitution items (in source code
                                    format) */
-    int             offset;     /* Current offset in "items" */
-    BUFFER         *body;       /* Original body */
+    int             next;       /* Offset of the next item in "items" */
+    MACRO          *body;       /* Compiled body */
     int             savecond;   /* conditional stack at invocation */
 
     char           *gets() override;
@@ -262,39 +508,32 @@ struct IRPC_STREAM : public BUFFER_STREAM {
 };
 
 /* irpc_stream_gets - same comments apply as with irp_stream_gets, but
-   the substitution is character-by-character */
+   the substitution is character-by-character, so each character of
+   the items is its own slice */
 
 char           *IRPC_STREAM::gets()
 {
     // IRPC_STREAM    *istr = (IRPC_STREAM *) str;
     char           *cp;
-    BUFFER         *buf;
-    ARG            *arg;
 
     for (;;) {
+        ARG_SLICE       val;
+
         if ((cp = BUFFER_STREAM::gets()) != NULL)
             return cp;
 
-        cp = items + offset;
+        cp = items + next;
 
         if (!*cp)
             return NULL;               /* No more items.  EOF. */
 
-        arg = new ARG();
-        arg->next = NULL;
-        arg->locsym = 0;
-        arg->label = strdup(label);
-        arg->value = (char *)memcheck(malloc(2));
-        arg->value[0] = *cp++;
-        arg->value[1] = 0;
-        offset = (int) (cp - items);
-
-        buf = subst_args(body, arg);
-
-        // free(arg->value);
-        delete (arg);
-        set_buffer(buf);
-        buffer_free(buf);
+        val.text = cp;
+        val.len = 1;
+        val.pending = 0;
+        next++;
+
+        fill_template(buffer, body, &val, this);
+        offset = 0;
     }
 }
 
@@ -305,9 +544,8 @@ IRPC_STREAM::~IRPC_STREAM()
     // IRPC_STREAM    *istr = (IRPC_STREAM *) str;
 
     pop_cond(savecond);          /* complete unterminated  conditionals */
-    buffer_free(body);
+    delete body;
     free(items);
-    free(label);
 }
 
 // STREAM_VTBL     irpc_stream_vtbl = {
@@ -320,9 +558,11 @@ IRPC_STREAM *expand_irpc(STACK *stack, char *cp)
 {
     char           *label,
                    *items;
-    BUFFER         *gb;
+    BUFFER         *gb,
+                   *scratch;
     int             levelmod = 0;
     IRPC_STREAM    *str;
+    PROF_SITE      *site = NULL;
 
     label = get_symbol(cp, &cp, NULL);
     if (!label) {
@@ -339,6 +579,9 @@ IRPC_STREAM *expand_irpc(STACK *stack, char *cp)
         return NULL;
     }
 
+    if (prof_enabled)
+        site = prof_begin(".IRPC", NULL, stack->top);
+
     gb = new BUFFER();
 
     levelmod = 0;
@@ -355,15 +598,16 @@ IRPC_STREAM *expand_irpc(STACK *stack, char *cp)
         char           *name = (char *)memcheck(malloc(strlen(stack->top->name) + 32));
 
         sprintf(name, "%s:%d->.IRPC", stack->top->name, stack->top->line);
-        str = new IRPC_STREAM(NULL, name);
+        scratch = new BUFFER();
+        str = new IRPC_STREAM(scratch, name);
+        str->prof = site;
+        buffer_free(scratch);          /* The stream has it */
         free(name);
     // }
 
     // str->bstr.stream.vtbl = &irpc_stream_vtbl;
-    str->body = gb;
+    str->body = compile_irp_body(label, gb);
     str->items = items;
-    str->offset = 0;
-    str->label = label;
     str->savecond = last_cond;
 
     return str;
@@ -3,6 +3,7 @@
 #define REPT_IRPC__H
 
 #include "stream2.h"
+#include "object.h"
 
 
 #ifndef REPT_IRPC__C
@@ -15,6 +16,8 @@ struct IRP_STREAM;
 struct IRPC_STREAM;
 
 REPT_STREAM    *expand_rept(STACK *stack, char *cp);
+REPT_STREAM    *new_rept_stream(STREAM *refstr, BUFFER *body, int count, PROF_SITE *prof);
+int             store_rept_data(REPT_STREAM *rstr, TEXT_RLD *tr);
 IRP_STREAM     *expand_irp(STACK *stack, char *cp);
 IRPC_STREAM    *expand_irpc(STACK *stack, char *cp);
 
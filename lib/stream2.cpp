@@ -58,6 +58,7 @@ BUFFER::BUFFER()
     length = 0;
     size = 0;
     use = 1;
+    borrowed = 0;
     buffer = NULL;
     // return buf;
 }
@@ -67,6 +68,7 @@ BUFFER::BUFFER(int _size)
     size = _size;
     length = _size;
     use = 1;
+    borrowed = 0;
 
     if (size == 0) {
         buffer = NULL;
@@ -76,12 +78,38 @@ BUFFER::BUFFER(int _size)
 
 }
 
+/* This one refers to text kept elsewhere, which must outlive it. */
+
+BUFFER::BUFFER(char *text, int len)
+{
+    size = len;
+    length = len;
+    use = 1;
+    borrowed = 1;
+    buffer = text;
+}
+
 BUFFER::~BUFFER()
 {
-    if(buffer)
+    if(buffer && !borrowed)
        free(buffer);
 }
 
+/* own_text gives a borrowed buffer its own copy of the text, before
+   it's changed. */
+
+void BUFFER::own_text()
+{
+    char           *text = buffer;
+
+    borrowed = 0;
+    if (text != NULL) {
+        buffer = (char *)memcheck(malloc(size + 1));
+        memcpy(buffer, text, size);
+        buffer[size] = 0;
+    }
+}
+
 
 /* buffer_resize makes the buffer at least the requested size. */
 /* If the buffer is already larger, then it will attempt */
@@ -89,6 +117,8 @@ BUFFER::~BUFFER()
 
 void BUFFER::buffer_resize(int _size)
 {
+    if (borrowed)
+        own_text();
     size = _size;
     length = _size;
 
@@ -133,6 +163,8 @@ void BUFFER::buffer_appendn(char *str, int len)
 {
     int needed = length + len + 1;
 
+    if (borrowed)
+        own_text();
     if (needed >= size) {
         size = needed + GROWBUF_INCR;
 
@@ -167,6 +199,8 @@ STREAM::STREAM(char *_name): str_type(TYPE_BASE_STREAM)
 {
     line = 0;
     name = (char *)memcheck(strdup(_name));
+    prof = NULL;
+    replay_name = -1;
     next = NULL;
 }
 
@@ -256,22 +290,34 @@ void BUFFER_STREAM::set_buffer(BUFFER *buf)
 
 /* *** FILE_STREAM implementation */
 
+/* next_char reads a character, from the file or the text */
+
+int FILE_STREAM::next_char()
+{
+    if (fp != NULL)
+        return fgetc(fp);
+    if (offset < length)
+        return (unsigned char) text[offset++];
+    ended = 1;
+    return EOF;
+}
+
 /* Implement STREAM::gets for a file stream */
 
 char    *FILE_STREAM::gets()
 {
     int             i,
                     c;
-    if (fp == NULL)
+    if (fp == NULL && text == NULL)
         return NULL;
 
-    if (feof(fp))
+    if (fp != NULL ? feof(fp) : ended)
         return NULL;
 
     /* Read single characters, end of line when '\n' or '\f' hit */
 
     i = 0;
-    while (c = fgetc(fp), c != '\n' && c != '\f' && c != EOF) {
+    while (c = next_char(), c != '\n' && c != '\f' && c != EOF) {
         if (c == 0)
             continue;                  /* Don't buffer zeros */
         if (c == '\r')
@@ -294,7 +340,9 @@ char    *FILE_STREAM::gets()
 
 FILE_STREAM::~FILE_STREAM()
 {
-    fclose(fp);
+    if (fp != NULL)
+        fclose(fp);
+    free(text);
     delete (buffer);
 }
 
@@ -302,7 +350,10 @@ FILE_STREAM::~FILE_STREAM()
 
 void FILE_STREAM::rewind()
 {
-    ::rewind(fp);
+    if (fp != NULL)
+        ::rewind(fp);
+    offset = 0;
+    ended = 0;
     line = 0;
 }
 
@@ -314,7 +365,12 @@ void FILE_STREAM::rewind()
 
 FILE_STREAM::FILE_STREAM() : STREAM("")
 {
-
+    fp = NULL;
+    buffer = NULL;
+    text = NULL;
+    length = 0;
+    offset = 0;
+    ended = 0;
 }
 
 bool FILE_STREAM::init(const char *filename)
@@ -335,6 +391,26 @@ bool FILE_STREAM::init(const char *filename)
     // return &str->stream;
 }
 
+/* Prepare a stream that reads the given text as if it were the named
+   file.  The text is copied. */
+
+bool FILE_STREAM::init_text(const char *filename, const char *_text, int _length)
+{
+    str_type = TYPE_FILE_STREAM;
+    text = (char *)memcheck(malloc(_length + 1));
+    if (_length > 0)
+        memcpy(text, _text, _length);
+    length = _length;
+    offset = 0;
+    ended = 0;
+
+    free(name);
+    name = (char *)memcheck(strdup(filename));
+    buffer = (char *)memcheck(malloc(STREAM_BUFFER_SIZE));
+    line = 0;
+    return true;
+}
+
 /* STACK functions */
 
 /* stack_init prepares a stack */
@@ -47,6 +47,8 @@ enum : int {
   TYPE_MACRO_STREAM
 };
 
+struct PROF_SITE;
+
 struct STREAM {
     STREAM(char *name);
     virtual ~STREAM();
@@ -57,6 +59,8 @@ struct STREAM {
     char           *name;       // Stream name
     int             line;       // Current line number in stream
     int str_type;
+    PROF_SITE *prof;     // Profiler site its lines are charged to
+    int      replay_name; // Where the first pass recorded its name, or -1
     STREAM  *next;       // Next stream in stack
 };
 
@@ -64,12 +68,18 @@ struct FILE_STREAM : public STREAM {
     // STREAM          stream;     // Base class
     FILE_STREAM();
     bool init(const char *filename);
+    bool init_text(const char *filename, const char *text, int length);
     virtual ~FILE_STREAM() override;
     // virtual void            _delete () override;    // Destructor
     virtual char           *gets() override;    // "gets" function
     virtual void            rewind() override;    // "rewind" function
     FILE           *fp;         // File pointer
     char           *buffer;     // Line buffer
+    char           *text;       // Or the file's text, if fp is NULL
+    int             length;     // Its length
+    int             offset;     // Current read offset
+    int             ended;      // Read past the end, as feof()
+    int             next_char();
 } ;
 
 struct BUFFER {
@@ -77,16 +87,20 @@ struct BUFFER {
 // BUFFER         *buffer_clone(BUFFER *from);
     BUFFER();
     BUFFER(int size);
+    BUFFER(char *text, int len);
     ~BUFFER();
 
     char           *buffer;     // Pointer to text
     int             size;       // Size of buffer
     int             length;     // Occupied size of buffer
     int             use;        // Number of users of buffer
+    int             borrowed;   // Text belongs to someone else (a mapped
+                                // macro library); copied before changing
     void            buffer_resize(int size);
     // void            buffer_free(BUFFER *buf);   
     void            buffer_appendn(char *str, int len);
     void            buffer_append_line(char *str);
+    void            own_text();
 
 };
 
@@ -118,6 +132,7 @@ struct STACK {
 
 #define STREAM_BUFFER_SIZE 1024        // This limits the max size of an input line.
 
+BUFFER *buffer_clone(BUFFER *from);
 void buffer_free(BUFFER *buf);
 
 /* Provide these so that macro11 can derive from a BUFFER_STREAM */
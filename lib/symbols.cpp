@@ -11,22 +11,24 @@
 #include "listing.h"
 
 /* GLOBALS */
-int             Glb_symbol_len = SYMMAX_DEFAULT;    /* max. len of symbols. default = 6 */
-int             Glb_symbol_allow_underscores = 0;   /* allow "_" in symbol names */
+THREAD_LOCAL int             Glb_symbol_len = SYMMAX_DEFAULT;    /* max. len of symbols. default = 6 */
+THREAD_LOCAL int             Glb_symbol_allow_underscores = 0;   /* allow "_" in symbol names */
 
-SYMBOL         *reg_sym[8];     /* Keep the register symbols in a handy array */
+THREAD_LOCAL SYMBOL         *reg_sym[8];     /* Keep the register symbols in a handy array */
 
 
-SYMBOL_TABLE    Glb_system_st;      /* System symbols (Instructions,
+THREAD_LOCAL SYMBOL_TABLE    Glb_system_st;      /* System symbols (Instructions,
                                    pseudo-ops, registers) */
 
-SYMBOL_TABLE    Glb_section_st;     /* Program sections */
+THREAD_LOCAL SYMBOL_TABLE    Glb_section_st;     /* Program sections */
 
-SYMBOL_TABLE    Glb_symbol_st;      /* User symbols */
+THREAD_LOCAL SYMBOL_TABLE    Glb_symbol_st;      /* User symbols */
 
-SYMBOL_TABLE    Glb_macro_st;       /* Macros */
+THREAD_LOCAL SYMBOL_TABLE    Glb_macro_st;       /* Macros */
 
-SYMBOL_TABLE    Glb_implicit_st;    /* The symbols which may be implicit globals */
+THREAD_LOCAL SYMBOL_TABLE    Glb_implicit_st;    /* The symbols which may be implicit globals */
+
+THREAD_LOCAL unsigned        symbol_generation = 0;      /* Changes with any symbol */
 
 
 
@@ -51,7 +53,7 @@ int hash_name(char *label)
 
 char *symflags( SYMBOL *sym)
 {
-    static char     temp[8];
+    static THREAD_LOCAL char     temp[8];
     char           *fp = temp;
 
     if (sym->flags & SYMBOLFLAG_GLOBAL)
@@ -100,6 +102,7 @@ void SYMBOL_TABLE::remove_sym(SYMBOL *sym)
 
     if (symp)
         *prevp = sym->next;
+    symbol_generation++;
 }
 
 /* lookup_sym finds a symbol in a table */
@@ -154,6 +157,24 @@ void SYMBOL_TABLE::add_table(SYMBOL *sym)
 
     sym->next = this->hash[hash];
     this->hash[hash] = sym;
+    symbol_generation++;
+}
+
+/* clear deletes all the symbols of a table.  Not for the tables of
+   MACROs, or anything else derived from SYMBOL. */
+
+void SYMBOL_TABLE::clear()
+{
+    int             i;
+
+    for (i = 0; i < HASH_SIZE; i++) {
+        while (hash[i] != NULL) {
+            SYMBOL         *sym = hash[i];
+
+            hash[i] = sym->next;
+            delete sym;
+        }
+    }
 }
 
 /* system_st.add_sym - used throughout to add or update symbols in a symbol
@@ -178,12 +199,15 @@ SYMBOL * SYMBOL_TABLE::add_sym(const char *labelraw, unsigned value, unsigned fl
 
         /* Check for compatible definition */
         else if (sym->section == section && sym->value == value) {
+            if ((sym->flags | flags) != sym->flags)
+                symbol_generation++;
             sym->flags |= flags;       /* Merge flags quietly */
             return sym;                /* 's okay */
         }
 
         if (!(sym->flags & SYMBOLFLAG_PERMANENT)) {
             /* permit redefinition */
+            symbol_generation++;
             sym->value = value;
             sym->flags |= flags;
             sym->section = section;
@@ -2,6 +2,8 @@
 #ifndef SYMBOLS__H
 #define SYMBOLS__H
 
+#include "util.h"
+
 /* max symbol_len can be adjusted between SYMMAX_DEFAULT and SYMMAX_MAX*/
 #define SYMMAX_DEFAULT 6               /* I will honor this many character symbols */
 
@@ -307,21 +309,24 @@ struct SYMBOL_TABLE {
     SYMBOL         *next_sym(SYMBOL_ITER *iter);
     void            remove_sym(SYMBOL *sym);
     void            add_table(SYMBOL *sym);
+    void            clear();  /* Delete all the symbols */
     void            dump();   /* Domp symbol table */
 };
 
 
 #ifndef SYMBOLS__C
 
-extern int      Glb_symbol_len;     /* max. len of symbols. default = 6 */
-extern int      Glb_symbol_allow_underscores;       /* allow "_" in symbol names */
-extern SYMBOL  *reg_sym[8];     /* Keep the register symbols in a handy array */
-extern SYMBOL_TABLE Glb_system_st;  /* System symbols (Instructions,
+extern THREAD_LOCAL int      Glb_symbol_len;     /* max. len of symbols. default = 6 */
+extern THREAD_LOCAL int      Glb_symbol_allow_underscores;       /* allow "_" in symbol names */
+extern THREAD_LOCAL SYMBOL  *reg_sym[8];     /* Keep the register symbols in a handy array */
+extern THREAD_LOCAL SYMBOL_TABLE Glb_system_st;  /* System symbols (Instructions,
                                    pseudo-ops, registers) */
-extern SYMBOL_TABLE Glb_section_st; /* Program sections */
-extern SYMBOL_TABLE Glb_symbol_st;  /* User symbols */
-extern SYMBOL_TABLE Glb_macro_st;   /* Macros */
-extern SYMBOL_TABLE Glb_implicit_st;        /* The symbols which may be implicit globals */
+extern THREAD_LOCAL SYMBOL_TABLE Glb_section_st; /* Program sections */
+extern THREAD_LOCAL SYMBOL_TABLE Glb_symbol_st;  /* User symbols */
+extern THREAD_LOCAL SYMBOL_TABLE Glb_macro_st;   /* Macros */
+extern THREAD_LOCAL SYMBOL_TABLE Glb_implicit_st;        /* The symbols which may be implicit globals */
+extern THREAD_LOCAL unsigned symbol_generation;  /* Changes with any symbol, so an
+                                   expression over them may have changed */
 
 #endif
 
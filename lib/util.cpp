@@ -106,21 +106,41 @@ char  *my_ltoa(long val, char *buf, unsigned int base)
     return my_ultoa(uval, buf, base);
 }
 
+/* path_next returns the next directory of a search path, cutting it
+   off the rest of the path, which it steps *pathp past.  Empty
+   directories are passed over.  Returns NULL at the end of the path.
+   Unlike strtok, it keeps no state of its own, so threads can each
+   split a path at once. */
+
+char *path_next(char **pathp)
+{
+    char           *cp = *pathp;
+    char           *end;
+
+    cp += strspn(cp, PATHSEP);
+    if (*cp == 0)
+        return NULL;
+
+    end = cp + strcspn(cp, PATHSEP);
+    if (*end != 0)
+        *end++ = 0;
+    *pathp = end;
+    return cp;
+}
+
 /*
   _searchenv is a function provided by the MSVC library that finds
   files which may be anywhere along a path which appears in an
-  environment variable.  I duplicate that function for portability.
-  Note also that mine avoids destination buffer overruns.
-
-  Note: uses strtok.  This means it'll screw you up if you
-  expect your strtok context to remain intact when you use
-  this function.
+  environment variable.  I duplicate that function for portability,
+  though mine is given the path itself, which needn't come from the
+  environment.  Note also that mine avoids destination buffer
+  overruns.
 */
 
-void my_searchenv(const char *name, const char *envname, char *hitfile, int hitlen)
+void my_searchpath(const char *name, const char *path, char *hitfile, int hitlen)
 {
-    char           *env;
     char           *envcopy;
+    char           *rest;
     char           *cp;
 
     *hitfile = 0;                      /* Default failure indication */
@@ -138,15 +158,15 @@ void my_searchenv(const char *name, const char *envname, char *hitfile, int hitl
         return;
     }
 
-    env = getenv(envname);
-    if (env == NULL)
-        return;                        /* Variable not defined, no search. */
+    if (path == NULL)
+        return;                        /* No path, no search. */
 
-    envcopy = strdup(env);             /* strtok destroys it's text
-                                          argument.  I don't want the return
-                                          value from getenv destroyed. */
+    envcopy = strdup(path);            /* path_next cuts it up */
+    if (envcopy == NULL)
+        return;
 
-    while ((cp = strtok(envcopy, PATHSEP)) != NULL) {
+    rest = envcopy;
+    while ((cp = path_next(&rest)) != NULL) {
         struct stat     info;
         char           *concat = (char *)malloc(strlen(cp) + strlen(name) + 2);
 
@@ -163,11 +183,15 @@ void my_searchenv(const char *name, const char *envname, char *hitfile, int hitl
                zero-delimited. */
             strncpy(hitfile, concat, hitlen - 1);
             hitfile[hitlen - 1] = 0;
+            free(concat);
             free(envcopy);
             return;
         }
+        free(concat);
     }
 
+    free(envcopy);
+
     /* If I fall out of that loop, then hitfile indicates no match,
        and return. */
 }
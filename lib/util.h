@@ -40,7 +40,8 @@ DAMAGE.
 
 char           *my_ultoa(unsigned long val, char *buf, unsigned int base);
 char           *my_ltoa(long val,  char *buf, unsigned int base);
-void            my_searchenv(const char *name, const char *envname, char *hitfile, int hitlen);
+char           *path_next(char **pathp);
+void            my_searchpath(const char *name, const char *path, char *hitfile, int hitlen);
 
 /* Cover a few platform-dependencies */
 
@@ -56,6 +57,18 @@ typedef unsigned long long ulong64;
 #define PATHSEP ":"
 #endif
 
+/* THREAD_LOCAL marks the globals that are the assembler's state:
+   each thread has its own, so assemblies on different threads can't
+   meet, but two on the same thread can't interleave.  __thread can't be
+   initialized at run time, so unlike thread_local it needs no check
+   that it has been when reached from another file. */
+
+#if defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL thread_local
+#endif
+
 
 #define FALSE 0                        /* Everybody needs FALSE and TRUE */
 #define TRUE 1
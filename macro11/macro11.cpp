@@ -49,9 +49,15 @@ DAMAGE.
 #include "assemble_globals.h"
 #include "assemble.h"
 #include "assemble_aux.h"
+#include "assemble_module.h"
 #include "listing.h"
+#include "macros.h"
+#include "mcall.h"
 #include "object.h"
 #include "symbols.h"
+#include "parse.h"
+#include "profile.h"
+#include "replay.h"
 
 #define stricmp strcasecmp
 
@@ -101,7 +107,10 @@ static void print_help(
     printf("  macro11 [-o <file>] [-l [<file>]] \n");
     printf("          [-h] [-v][-e <option>] [-d <option>]\n");
     printf("          [-ysl <num>] [-yus] \n");
-    printf("          [-m <file>] [-p <directory>] [-x]\n");
+    printf("          [-m <file>] [-p <directory>] [-mlist] [-mcache <directory>]\n");
+    printf("          [-x] [-stats] [-prof <file>] [-profdata <file>] [-noreplay]\n");
+    printf("          [-onepass]\n");
+    printf("          [-maxdepth <num>] [-maxlines <num>] [-maxbytes <num>]\n");
     printf("          <inputfile> [<inputfile> ...]\n");
     printf("\n");
     printf("Arguments:\n");
@@ -116,10 +125,35 @@ static void print_help(
     printf("-m  load RT-11 compatible macro library from which\n");
     printf("    .MCALLed macros can be found.\n");
     printf("    Multiple allowed.\n");
+    printf("-mcache gives an existing directory in which to keep .MCALLed macro\n");
+    printf("    definitions, parsed, for later runs.  It may be shared.\n");
+    printf("-maxdepth most macros, .REPTs, .IRPs and .IRPCs that may be nested\n");
+    printf("    in each other (default %d, 0 for no limit).\n", max_expand_depth);
+    printf("-maxlines most lines they may produce in all, in a pass\n");
+    printf("    (default %ld, 0 for no limit).\n", max_expand_lines);
+    printf("-maxbytes most bytes of expanded text they may hold at once\n");
+    printf("    (default %ld, 0 for no limit).\n", max_expand_bytes);
+    printf("    Going past a limit is an error, and abandons the expansions.\n");
+    printf("-mlist tell which library or file each .MCALLed macro comes from.\n");
+    printf("-noreplay read the source again in the second pass, instead of\n");
+    printf("    replaying the lines the first pass assembled.\n");
     printf("-o  gives the object file name (.OBJ)\n");
+    printf("-onepass keep the object code of the first pass, and at the end\n");
+    printf("    assemble again, from their text, only the lines it couldn't\n");
+    printf("    finish; what they store replaces what they stored.  No table\n");
+    printf("    of fixups is kept.  The second pass is a whole one if a forward\n");
+    printf("    reference could change what the first did, and always with -l,\n");
+    printf("    since every line is listed with its final code, and with -prof\n");
+    printf("    or -profdata.  Either way the object file is the same.\n");
     printf("-p  gives the name of a directory in which .MCALLed macros may be found.\n");
-    printf("    Sets environment variable \"MCALL\".\n");
-
+    printf("    Adds to the directories in environment variable \"MCALL\".\n");
+
+    printf("-prof profile macro, .REPT, .IRP and .IRPC expansions, and write\n");
+    printf("    a report of where the time and object code went to <file>.\n");
+    printf("    -prof - writes it to standard output.\n");
+    printf("-profdata profile as -prof, and write the figures for each call\n");
+    printf("    site to <file> as tab-separated fields.\n");
+    printf("-stats print macro expansion statistics at the end\n");
     printf("-v  print version\n");
     printf("    Violates DEC standard, but sometimes needed\n");
     printf("-x  invokes macro11 to expand the contents of the registered macro \n");
@@ -149,6 +183,65 @@ void usage(const char *message) {
     exit(EXIT_FAILURE);
 }
 
+/* open_libraries opens the -m macro libraries, all at once.  If any
+   can't be, it says which, the first on the command line, and exits. */
+
+static void open_libraries(char **names)
+{
+    int             i;
+
+    mlb_open_all(nr_mlbs, names, mlbs);
+    for (i = 0; i < nr_mlbs; i++) {
+        if (mlbs[i] == NULL) {
+            fprintf(stderr, "Unable to register macro library %s\n", names[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* get_limit returns the number following option argv[arg] */
+
+static long get_limit(int argc, char *argv[], int arg, const char *message)
+{
+    char           *endp;
+    long            limit;
+
+    if (arg >= argc-1)
+        usage(message);
+    limit = strtol(argv[arg+1], &endp, 10);
+    if (*endp || endp == argv[arg+1] || limit < 0)
+        usage(message);
+    return limit;
+}
+
+/* The input files, for push_files */
+
+struct INPUT_FILES {
+    char          **names;
+    int             count;
+};
+
+/* push_files pushes the input files onto the input stream in reverse
+   order, so the first is read first.  If one can't be opened, it says
+   so and exits. */
+
+static void push_files(
+    STACK *stack,
+    void *arg)
+{
+    INPUT_FILES    *files = (INPUT_FILES *) arg;
+    int             i;
+
+    for (i = files->count - 1; i >= 0; --i) {
+        FILE_STREAM         *str = new FILE_STREAM;
+        if (!str->init(files->names[i])) {
+            report(NULL, "Unable to open file %s\n", files->names[i]);
+            exit(EXIT_FAILURE);
+        }
+        stack->push(str);
+    }
+}
+
 int main(
     int argc,
     char *argv[])
@@ -156,13 +249,17 @@ int main(
     char           *fnames[32];
     int             nr_files = 0;
     FILE           *obj = NULL;
-    TEXT_RLD        tr;
     char           *objname = NULL;
     char           *lstname = NULL;
+    char           *mlbnames[MAX_MLBS];
+    char           *profname = NULL;
+    char           *profdataname = NULL;
     int             arg;
     int             i;
-    STACK           stack;
+    INPUT_FILES     files;
     int             errcount;
+    int             replay = 1;
+    int             onepass = 0;
 
     if (argc <= 1) {
         print_help();
@@ -202,35 +299,37 @@ int main(
                 if(arg >= argc-1 || *argv[arg+1] == '-') {
                     usage("-m must be followed by a macro library file name\n");
                 }
-                arg++;
-                mlbs[nr_mlbs] = mlb_open(argv[arg]);
-                if (mlbs[nr_mlbs] == NULL) {
-                    fprintf(stderr, "Unable to register macro library %s\n", argv[arg]);
-                    exit(EXIT_FAILURE);
+                if (nr_mlbs >= MAX_MLBS) {
+                    usage("Too many macro libraries\n");
                 }
-                nr_mlbs++;
+                /* They're all opened together, below */
+                mlbnames[nr_mlbs++] = argv[++arg];
+            } else if (!stricmp(cp, "maxdepth")) {
+                /* Limit expansion nesting */
+                max_expand_depth = get_limit(argc, argv, arg++, "-maxdepth must be followed by a number\n");
+            } else if (!stricmp(cp, "maxlines")) {
+                /* Limit lines from expansions */
+                max_expand_lines = get_limit(argc, argv, arg++, "-maxlines must be followed by a number\n");
+            } else if (!stricmp(cp, "maxbytes")) {
+                /* Limit expanded text held */
+                max_expand_bytes = get_limit(argc, argv, arg++, "-maxbytes must be followed by a number\n");
+            } else if (!stricmp(cp, "mcache")) {
+                /* Directory for the .MCALL cache */
+                if(arg >= argc-1 || *argv[arg+1] == '-') {
+                    usage("-mcache must be followed by a directory name\n");
+                }
+                mcall_cache_dir = argv[++arg];
+            } else if (!stricmp(cp, "mlist")) {
+                /* Trace .MCALL resolution */
+                show_mcall = 1;
             } else if (!stricmp(cp, "p")) {
                 /* P for search path */
                 /* The -p option gives the name of a directory in
-                   which .MCALLed macros may be found.  */  {
-                    const char     *env = getenv("MCALL");
-                    char           *temp;
-
-                    if(arg >= argc-1 || *argv[arg+1] == '-') {
-                        usage("-p must be followed by a macro search directory\n");
-                    }
-
-                    if (env == NULL)
-                        env = "";
-
-                    temp = static_cast<char *>(memcheck(malloc(strlen(env) + strlen(argv[arg + 1]) + 8)));
-                    strcpy(temp, "MCALL=");
-                    strcat(temp, env);
-                    strcat(temp, PATHSEP);
-                    strcat(temp, argv[arg + 1]);
-                    putenv(temp);
-                    arg++;
+                   which .MCALLed macros may be found.  */
+                if(arg >= argc-1 || *argv[arg+1] == '-') {
+                    usage("-p must be followed by a macro search directory\n");
                 }
+                mcall_add_path(argv[++arg]);
             } else if (!stricmp(cp, "o")) {
                 /* The -o option gives the object file name (.OBJ) */
                 if(arg >= argc-1 || *argv[arg+1] == '-') {
@@ -260,6 +359,7 @@ int main(
                 if(arg != argc-1) {
                     usage("-x must be the last option\n");
                 }
+                open_libraries(mlbnames);
                 for (i = 0; i < nr_mlbs; i++)
                     mlb_extract(mlbs[i]);
                 return EXIT_SUCCESS;
@@ -277,6 +377,29 @@ int main(
                     }
                     Glb_symbol_len = sl;
                 }
+            } else if (!stricmp(cp, "prof")) {
+                /* Write a profile report */
+                if(arg >= argc-1 || (*argv[arg+1] == '-' && argv[arg+1][1] != 0)) {
+                    usage("-prof must be followed by the report file name (- for standard output)\n");
+                }
+                profname = argv[++arg];
+                prof_enabled = 1;
+            } else if (!stricmp(cp, "profdata")) {
+                /* Write the profile figures */
+                if(arg >= argc-1 || *argv[arg+1] == '-') {
+                    usage("-profdata must be followed by a file name\n");
+                }
+                profdataname = argv[++arg];
+                prof_enabled = 1;
+            } else if (!stricmp(cp, "noreplay")) {
+                /* Assemble the source in both passes */
+                replay = 0;
+            } else if (!stricmp(cp, "onepass")) {
+                /* Keep the first pass's object code */
+                onepass = 1;
+            } else if (!stricmp(cp, "stats")) {
+                /* Report statistics at the end */
+                show_stats = 1;
             } else if (!stricmp(cp, "yus")) {
                 /* allow underscores */
                 Glb_symbol_allow_underscores = 1;
@@ -289,103 +412,43 @@ int main(
             fnames[nr_files++] = argv[arg];
         }
 
+    open_libraries(mlbnames);
+
     if (objname) {
         obj = fopen(objname, "wb");
         if (obj == NULL)
             return EXIT_FAILURE;
     }
 
-    add_symbols(&blank_section);
-
-    tr.text_init(NULL, 0);
-
-    module_name = static_cast<char *>(memcheck(strdup("")));
+    files.names = fnames;
+    files.count = nr_files;
+    errcount = assemble_module(push_files, &files, obj, NULL, replay, onepass);
 
-    xfer_address = new EX_TREE(1);      /* The undefined transfer address */
-
-    stack.stack_init();
-    /* Push the files onto the input stream in reverse order */
-    for (i = nr_files - 1; i >= 0; --i) {
-        FILE_STREAM         *str = new FILE_STREAM;
-        if (!str->init(fnames[i])) {
-            report(NULL, "Unable to open file %s\n", fnames[i]);
-            exit(EXIT_FAILURE);
-        }
-        stack.push(str);
-    }
-
-    DOT = 0;
-    current_pc->section = &blank_section;
-    last_dot_section = NULL;
-    pass = 0;
-    stmtno = 0;
-    lsb = 0;
-    last_lsb = -1;
-    last_locsym = 32767;
-    last_cond = -1;
-    sect_sp = -1;
-    suppressed = 0;
-
-    assemble_stack(&stack, &tr);
-
-#if 0
-    if (enabl_debug)
-        dump_all_macros();
-#endif
-
-    assert(stack.top == NULL);
-
-    migrate_implicit();                /* Migrate the implicit globals */
-    write_globals(obj);                /* Write the global symbol dictionary */
+    for (i = 0; i < nr_mlbs; i++)
+        mlb_close(mlbs[i]);
 
-#if 0
-    sym_hist(&symbol_st, "symbol_st"); /* Draw a symbol table histogram */
-#endif
+    if (obj != NULL)
+        fclose(obj);
 
+    if (show_stats)
+        macro_cache_stats(stderr);
 
-    tr.text_init(obj, 0);
+    if (profname) {
+        FILE           *fp = stdout;
 
-    stack.stack_init();                /* Superfluous... */
-    /* Re-push the files onto the input stream in reverse order */
-    for (i = nr_files - 1; i >= 0; --i) {
-        FILE_STREAM         *str = new FILE_STREAM;
-        if (!str->init(fnames[i])) {
-            report(NULL, "Unable to open file %s\n", fnames[i]);
-            exit(EXIT_FAILURE);
+        if (strcmp(profname, "-") != 0)
+            fp = fopen(profname, "w");
+        if (fp == NULL)
+            fprintf(stderr, "Unable to write profile %s\n", profname);
+        else {
+            prof_report(fp);
+            if (fp != stdout)
+                fclose(fp);
         }
-        stack.push(str);
-    }
-
-    DOT = 0;
-    current_pc->section = &blank_section;
-    last_dot_section = NULL;
-
-    pass = 1;
-    stmtno = 0;
-    lsb = 0;
-    last_lsb = -1;
-    last_locsym = 32767;
-    pop_cond(-1);
-    sect_sp = -1;
-    suppressed = 0;
-
-    errcount = assemble_stack(&stack, &tr);
-
-    tr.text_flush();
-
-    while (last_cond >= 0) {
-        report(NULL, "%s:%d: Unterminated conditional\n", conds[last_cond].file, conds[last_cond].line);
-        pop_cond(last_cond - 1);
-        errcount++;
     }
 
-    for (i = 0; i < nr_mlbs; i++)
-        mlb_close(mlbs[i]);
-
-    write_endmod(obj);
-
-    if (obj != NULL)
-        fclose(obj);
+    if (profdataname && !prof_write(profdataname))
+        fprintf(stderr, "Unable to write profile %s\n", profdataname);
 
     if (errcount > 0)
         fprintf(stderr, "%d Error(s)\n", error_count);
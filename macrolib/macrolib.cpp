@@ -0,0 +1,377 @@
+/* Build a MACRO-11 macro library from .MAC source files. */
+
+/*
+Copyright (c) 2001, Richard Krehbiel
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+o Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+o Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+o Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifndef WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "mlb.h"
+#include "mcall.h"
+#include "macros.h"
+#include "parse.h"
+#include "stream2.h"
+#include "symbols.h"
+#include "assemble_globals.h"
+#include "util.h"
+
+#define MAX_MEMBERS 4096
+
+static char    *names[MAX_MEMBERS];
+static BUFFER  *texts[MAX_MEMBERS];
+static BUFFER  *defs[MAX_MEMBERS];     /* Native: the parsed macros */
+static BUFFER  *bodies[MAX_MEMBERS];
+static BUFFER  *tmpls[MAX_MEMBERS];
+static int      nmembers;
+static int      native;
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: macrolib [-e | -n [-ysl n] [-yus]] -o out {file.mac | file.mlb | directory} ...\n"
+            "  Each .MAC file becomes the library entry named after it, less\n"
+            "  the .MAC extension; a directory contributes its .MAC files, and\n"
+            "  a macro library all its entries.\n"
+            "  -e  Add the extended index, which macro11 reads instead of\n"
+            "      decoding and sorting the RT-11 directory.\n"
+            "  -n  Write a native library instead, with long names and the\n"
+            "      macros already parsed and compiled.  -ysl and -yus are as\n"
+            "      for macro11; the parsed macros are used when macro11 has the\n"
+            "      same options.\n");
+    exit(EXIT_FAILURE);
+}
+
+/* valid_name says whether a name can be an entry name: any RAD50
+   name for an RT-11 library; a native one can have any symbol that
+   .MCALL could ask for. */
+
+static int valid_name(const char *name)
+{
+    static const char symchars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ$.0123456789_";
+    int             len = strlen(name);
+
+    if (!native)
+        return mlb_valid_name(name);
+    return len >= 1 && len <= Glb_symbol_len && (int) strspn(name, symchars) == len &&
+        (Glb_symbol_allow_underscores || strchr(name, '_') == NULL);
+}
+
+/* add_member enters a member into the list, taking over name and
+   text.  Returns FALSE if the list is full. */
+
+static int add_member(const char *from, char *name, BUFFER *text)
+{
+    int             i;
+
+    if (!valid_name(name)) {
+        fprintf(stderr, "%s: %s is not a valid macro name, skipped\n", from, name);
+        free(name);
+        buffer_free(text);
+        return 1;
+    }
+
+    for (i = 0; i < nmembers; i++) {
+        if (strcmp(names[i], name) == 0) {
+            fprintf(stderr, "%s: duplicate entry %s, skipped\n", from, name);
+            free(name);
+            buffer_free(text);
+            return 1;
+        }
+    }
+
+    if (nmembers >= MAX_MEMBERS) {
+        fprintf(stderr, "%s: too many entries\n", from);
+        free(name);
+        buffer_free(text);
+        return 0;
+    }
+
+    names[nmembers] = name;
+    texts[nmembers] = text;
+    defs[nmembers] = NULL;
+    bodies[nmembers] = NULL;
+    tmpls[nmembers] = NULL;
+    nmembers++;
+    return 1;
+}
+
+/* member_name turns a file name into an entry name: the last path
+   component, less a .MAC extension, in upper case. */
+
+static char    *member_name(const char *path)
+{
+    const char     *base = strrchr(path, '/');
+    char           *name,
+                   *cp;
+    int             len;
+
+#ifdef WIN32
+    if (strrchr(path, '\\') > base)
+        base = strrchr(path, '\\');
+#endif
+    base = base ? base + 1 : path;
+    len = strlen(base);
+    if (len > 4 && strcasecmp(base + len - 4, ".MAC") == 0)
+        len -= 4;
+
+    name = (char *)memcheck(malloc(len + 1));
+    memcpy(name, base, len);
+    name[len] = 0;
+    for (cp = name; *cp; cp++)
+        *cp = toupper((unsigned char) *cp);
+
+    return name;
+}
+
+/* add_file reads one source file into the member list, leaving out
+   carriage returns and NULs, as mlb_entry would. */
+
+static int add_file(const char *path)
+{
+    FILE           *fp;
+    BUFFER         *buf;
+    int             c;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    buf = new BUFFER();
+    while ((c = getc(fp)) != EOF) {
+        char            ch = c;
+
+        if (ch != '\r' && ch != 0)
+            buf->buffer_appendn(&ch, 1);
+    }
+    if (ferror(fp)) {
+        perror(path);
+        fclose(fp);
+        buffer_free(buf);
+        return 0;
+    }
+    fclose(fp);
+
+    return add_member(path, member_name(path), buf);
+}
+
+/* add_library takes every entry of a macro library. */
+
+static int add_library(const char *path)
+{
+    MLB            *mlb = mlb_open((char *) path);
+    int             ok = 1;
+    int             i;
+
+    if (mlb == NULL) {
+        fprintf(stderr, "%s: not a macro library\n", path);
+        return 0;
+    }
+
+    for (i = 0; i < mlb->nentries; i++) {
+        char           *label = mlb->directory[i].label;
+        BUFFER         *buf = mlb_entry(mlb, label);
+
+        /* Lose the trailing NUL mlb_entry adds */
+        if (buf->length > 0 && buf->buffer[buf->length - 1] == 0)
+            buf->length--;
+        if (buf->borrowed)
+            buf->own_text();           /* Outlive the library */
+        ok &= add_member(path, (char *)memcheck(strdup(label)), buf);
+    }
+
+    mlb_close(mlb);
+    return ok;
+}
+
+/* add_directory adds every .MAC file in a directory. */
+
+#ifndef WIN32
+static int add_directory(const char *path)
+{
+    DIR            *dir = opendir(path);
+    struct dirent  *de;
+    int             ok = 1;
+
+    if (dir == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    while ((de = readdir(dir)) != NULL) {
+        int             len = strlen(de->d_name);
+        char           *file;
+
+        if (len <= 4 || strcasecmp(de->d_name + len - 4, ".MAC") != 0)
+            continue;
+        file = (char *)memcheck(malloc(strlen(path) + len + 2));
+        sprintf(file, "%s/%s", path, de->d_name);
+        ok &= add_file(file);
+        free(file);
+    }
+
+    closedir(dir);
+    return ok;
+}
+#endif
+
+/* compile parses the member's macro, the way .MCALL would: the
+   first .MACRO in it is defined, and the rest ignored. */
+
+static void compile(int i)
+{
+    BUFFER_STREAM  *str = new BUFFER_STREAM(texts[i], names[i]);
+    STACK           macstack;
+    MACRO          *mac;
+    char           *cp;
+
+    for (;;) {
+        char           *label;
+        SYMBOL         *op;
+
+        cp = str->gets();
+        if (cp == NULL)
+            break;
+        label = get_symbol(cp, &cp, NULL);
+        if (label == NULL)
+            continue;
+        op = Glb_system_st.lookup_sym(label);
+        free(label);
+        if (op != NULL && op->value == P_MACRO)
+            break;
+    }
+
+    if (cp == NULL) {
+        fprintf(stderr, "%s: no macro definition\n", names[i]);
+        delete str;
+        return;
+    }
+
+    macstack.stack_init(str);
+    mac = defmacro(cp, &macstack, TRUE);
+    if (mac != NULL) {
+        defs[i] = new BUFFER();
+        mcall_put_definition(defs[i], mac);
+        bodies[i] = buffer_clone(mac->text);
+        tmpls[i] = new BUFFER();
+        mcall_put_template(tmpls[i], mac);
+    }
+
+    if (macstack.top != NULL)          /* Unless it ran out */
+        delete str;
+}
+
+int main(int argc, char *argv[])
+{
+    char           *outname = NULL;
+    int             extended = 0;
+    int             ok = 1;
+    int             arg;
+    int             i;
+
+    for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-e") == 0)
+            extended = 1;
+        else if (strcmp(argv[arg], "-n") == 0)
+            native = 1;
+        else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc)
+            outname = argv[++arg];
+        else if (strcmp(argv[arg], "-ysl") == 0 && arg + 1 < argc) {
+            char           *endp;
+            int             sl = strtol(argv[++arg], &endp, 10);
+
+            if (*endp || sl < SYMMAX_DEFAULT || sl > SYMMAX_MAX)
+                usage();
+            Glb_symbol_len = sl;
+        } else if (strcmp(argv[arg], "-yus") == 0)
+            Glb_symbol_allow_underscores = 1;
+        else
+            usage();
+    }
+
+    if (outname == NULL || arg >= argc || (extended && native))
+        usage();
+
+    for (; arg < argc; arg++) {
+        int             len = strlen(argv[arg]);
+
+#ifndef WIN32
+        struct stat     st;
+
+        if (stat(argv[arg], &st) == 0 && S_ISDIR(st.st_mode)) {
+            ok &= add_directory(argv[arg]);
+            continue;
+        }
+#endif
+        if (len > 4 && strcasecmp(argv[arg] + len - 4, ".MLB") == 0)
+            ok &= add_library(argv[arg]);
+        else
+            ok &= add_file(argv[arg]);
+    }
+
+    if (!ok)
+        return EXIT_FAILURE;
+
+    if (native) {
+        init_char_class();
+        add_symbols(&blank_section);
+        for (i = 0; i < nmembers; i++)
+            compile(i);
+        ok = mlb_write_native(outname, nmembers, names, texts, defs, bodies, tmpls, mcall_options());
+    } else
+        ok = mlb_write(outname, nmembers, names, texts, extended);
+
+    if (!ok) {
+        perror(outname);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < nmembers; i++) {
+        free(names[i]);
+        buffer_free(texts[i]);
+        buffer_free(defs[i]);
+        buffer_free(bodies[i]);
+        buffer_free(tmpls[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
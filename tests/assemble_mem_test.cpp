@@ -0,0 +1,245 @@
+/*
+        Test of assemble_mem: the same sources assembled over and over,
+        on several threads at once, must come out the same each time,
+        and as they did the first time, on this thread alone.  So must
+        one assembled from a source hook, in the middle of another.
+
+        assemble_mem_test <directory>
+
+        The sources are in the directory, and the macros they .MCALL in
+        its maclib directory.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "assemble_mem.h"
+#include "util.h"
+
+
+#define NTHREADS 4                     /* Threads assembling at once */
+#define NREPEAT 10                     /* Times each assembles each source */
+
+typedef struct test_file {
+    const char     *name;
+    char           *text;
+    int             length;
+    ASSEMBLE_RESULT ref[2];     /* The first results, without and with a listing */
+} TEST_FILE;
+
+static TEST_FILE sources[] = {
+    { "replay.mac", NULL, 0, {} },
+    { "onepass.mac", NULL, 0, {} },
+    { "mcall.mac", NULL, 0, {} },
+    { "test.mac", NULL, 0, {} }
+};
+
+static TEST_FILE macros[] = {
+    { "PUSH", NULL, 0, {} },
+    { "POP", NULL, 0, {} },
+    { "TABLE", NULL, 0, {} },
+    { "STRING", NULL, 0, {} }
+};
+
+#define NSOURCES (int) (sizeof(sources) / sizeof(sources[0]))
+#define NMACROS (int) (sizeof(macros) / sizeof(macros[0]))
+
+static std::atomic<int> failures;
+static int nested;                     /* Times find_nested was called */
+
+/* read_file reads a file into memory, or exits */
+
+static char *read_file(
+    const char *dir,
+    const char *name,
+    int *length)
+{
+    char            path[FILENAME_MAX];
+    FILE           *fp;
+    char           *text;
+    long            size;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    text = (char *) memcheck(malloc(size + 1));
+    if (fread(text, 1, size, fp) < (size_t) size) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+    text[size] = 0;
+    *length = (int) size;
+    return text;
+}
+
+/* find_macro is the source hook: it gives the macros from maclib,
+   and no .INCLUDE files */
+
+static const char *find_macro(
+    void *arg,
+    int kind,
+    const char *name,
+    int *length)
+{
+    int             i;
+
+    (void) arg;
+    if (kind != SOURCE_MCALL)
+        return NULL;
+    for (i = 0; i < NMACROS; i++) {
+        if (strcmp(macros[i].name, name) == 0) {
+            *length = macros[i].length;
+            return macros[i].text;
+        }
+    }
+    return NULL;
+}
+
+/* same_result says whether two results are the same */
+
+static int same_result(
+    ASSEMBLE_RESULT *a,
+    ASSEMBLE_RESULT *b)
+{
+    int             i;
+
+    if (a->errors != b->errors || a->nr_diags != b->nr_diags ||
+        a->object_length != b->object_length ||
+        memcmp(a->object, b->object, a->object_length) != 0)
+        return FALSE;
+    if ((a->listing == NULL) != (b->listing == NULL) ||
+        (a->listing != NULL && strcmp(a->listing, b->listing) != 0))
+        return FALSE;
+    for (i = 0; i < a->nr_diags; i++) {
+        if (strcmp(a->diags[i].name, b->diags[i].name) != 0 ||
+            a->diags[i].line != b->diags[i].line ||
+            strcmp(a->diags[i].message, b->diags[i].message) != 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* assemble assembles a source, with or without a listing, and checks
+   the result against the first one, unless it's the first one */
+
+static void assemble(
+    TEST_FILE *src,
+    int list,
+    ASSEMBLE_RESULT *result)
+{
+    assemble_mem(src->name, src->text, src->length, list, find_macro, NULL, result);
+    if (result->errors != result->nr_diags || result->object_length == 0) {
+        fprintf(stderr, "%s: %d errors, %d reported, %d bytes of object code\n",
+                src->name, result->errors, result->nr_diags, result->object_length);
+        failures++;
+    }
+    if (result != &src->ref[list] && !same_result(result, &src->ref[list])) {
+        fprintf(stderr, "%s: different the next time%s\n", src->name, list ? ", listed" : "");
+        failures++;
+    }
+}
+
+/* find_nested is a source hook that, before it gives a macro,
+   assembles another source, which must come out as it did before */
+
+static const char *find_nested(
+    void *arg,
+    int kind,
+    const char *name,
+    int *length)
+{
+    ASSEMBLE_RESULT result;
+
+    nested++;
+    assemble((TEST_FILE *) arg, 0, &result);
+    assemble_mem_free(&result);
+    return find_macro(NULL, kind, name, length);
+}
+
+/* worker assembles each source NREPEAT times, with and without a
+   listing, starting with a different one on each thread */
+
+static void worker(
+    int start)
+{
+    ASSEMBLE_RESULT result;
+    int             i,
+                    j;
+
+    for (i = 0; i < NREPEAT * NSOURCES * 2; i++) {
+        j = (start + i) % (NSOURCES * 2);
+        assemble(&sources[j / 2], j & 1, &result);
+        assemble_mem_free(&result);
+    }
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    std::vector<std::thread> threads;
+    ASSEMBLE_RESULT result;
+    char            name[32];
+    int             i;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: assemble_mem_test <directory>\n");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < NMACROS; i++) {
+        snprintf(name, sizeof(name), "maclib/%s.MAC", macros[i].name);
+        macros[i].text = read_file(argv[1], name, &macros[i].length);
+    }
+
+    for (i = 0; i < NSOURCES; i++) {
+        sources[i].text = read_file(argv[1], sources[i].name, &sources[i].length);
+        assemble(&sources[i], 0, &sources[i].ref[0]);
+        assemble(&sources[i], 1, &sources[i].ref[1]);
+        if (sources[i].ref[1].listing == NULL ||
+            sources[i].ref[0].object_length != sources[i].ref[1].object_length ||
+            memcmp(sources[i].ref[0].object, sources[i].ref[1].object,
+                   sources[i].ref[0].object_length) != 0) {
+            fprintf(stderr, "%s: different when listed\n", sources[i].name);
+            failures++;
+        }
+    }
+
+    /* mcall.mac, with replay.mac assembled for each macro it calls */
+    assemble_mem(sources[2].name, sources[2].text, sources[2].length, 0,
+                 find_nested, &sources[0], &result);
+    if (nested == 0 || !same_result(&result, &sources[2].ref[0])) {
+        fprintf(stderr, "%s: different with a hook that assembles\n", sources[2].name);
+        failures++;
+    }
+    assemble_mem_free(&result);
+
+    /* Once more on this thread, then on all of them at once */
+    worker(0);
+    for (i = 0; i < NTHREADS; i++)
+        threads.emplace_back(worker, i * 2 + 1);
+    for (i = 0; i < NTHREADS; i++)
+        threads[i].join();
+
+    for (i = 0; i < NSOURCES; i++) {
+        assemble_mem_free(&sources[i].ref[0]);
+        assemble_mem_free(&sources[i].ref[1]);
+        free(sources[i].text);
+    }
+    for (i = 0; i < NMACROS; i++)
+        free(macros[i].text);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
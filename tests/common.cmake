@@ -0,0 +1,25 @@
+# What the test scripts share.  run() runs a program and leaves its
+# exit status in <var>_result and its messages, stdout and stderr
+# together, in <var>_output.  same_files() fails the test unless two
+# files are the same.
+
+file(REMOVE_RECURSE ${WORKDIR})
+file(MAKE_DIRECTORY ${WORKDIR})
+
+function(run var)
+  execute_process(COMMAND ${ARGN}
+                  WORKING_DIRECTORY ${WORKDIR}
+                  RESULT_VARIABLE result
+                  OUTPUT_VARIABLE output
+                  ERROR_VARIABLE output)
+  set(${var}_result "${result}" PARENT_SCOPE)
+  set(${var}_output "${output}" PARENT_SCOPE)
+endfunction()
+
+function(same_files a b)
+  execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${WORKDIR}/${a} ${WORKDIR}/${b}
+                  RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${a} and ${b} differ")
+  endif()
+endfunction()
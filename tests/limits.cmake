@@ -0,0 +1,36 @@
+# Assembles SOURCE, limits.mac, under the default expansion limits and
+# under each of -maxdepth, -maxlines and -maxbytes.  Each runaway must
+# be reported once, at the line that started it, with the expansions
+# in progress.
+
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+configure_file(${SOURCE} ${WORKDIR}/limits.mac COPYONLY)
+
+function(expect options)
+  string(CONCAT expected ${ARGN})
+  string(REPLACE "|" "\n" expected "${expected}")
+  separate_arguments(args UNIX_COMMAND "${options}")
+  run(asm ${MACRO11} ${args} -o limits.obj limits.mac)
+  if(asm_result EQUAL 0 OR NOT asm_output STREQUAL "${expected}\n")
+    message(FATAL_ERROR "with ${options}:\n${asm_output}\ninstead of:\n${expected}")
+  endif()
+endfunction()
+
+expect(""
+  "limits.mac:20: ***ERROR Expansions nested more than 1000 deep, in DEEP x1001|"
+  "limits.mac:22: ***ERROR Expansions hold more than 67108864 bytes of text, in BIG x21|"
+  "2 Error(s)")
+expect("-maxdepth 10"
+  "limits.mac:20: ***ERROR Expansions nested more than 10 deep, in DEEP x11|"
+  "limits.mac:22: ***ERROR Expansions nested more than 10 deep, in BIG x11|"
+  "2 Error(s)")
+expect("-maxlines 50"
+  "limits.mac:20: ***ERROR Expansions produced more than 50 lines, in DEEP x26|"
+  "limits.mac:21: ***ERROR Expansions produced more than 50 lines, in LONG|"
+  "limits.mac:22: ***ERROR Expansions produced more than 50 lines, in BIG|"
+  "3 Error(s)")
+expect("-maxbytes 4000"
+  "limits.mac:20: ***ERROR Expansions hold more than 4000 bytes of text, in DEEP x37|"
+  "limits.mac:22: ***ERROR Expansions hold more than 4000 bytes of text, in BIG x7|"
+  "2 Error(s)")
@@ -0,0 +1,83 @@
+# Assembles SOURCE with its macros taken from the .MAC files in
+# LIBDIR, then from the libraries macrolib makes of them: RT-11, with
+# and without the extended index, native, and native made from the
+# RT-11 one.  The object files and messages must be the same, and the
+# native libraries' macros must be used as they were compiled.
+
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+run(ref ${MACRO11} -p ${LIBDIR} -o ref.obj ${SOURCE})
+if(NOT EXISTS ${WORKDIR}/ref.obj)
+  message(FATAL_ERROR "no object file from the .MAC files:\n${ref_output}")
+endif()
+
+foreach(lib rt11 extended native native2)
+  if(lib STREQUAL "rt11")
+    run(build ${MACROLIB} -o ${lib}.mlb ${LIBDIR})
+  elseif(lib STREQUAL "extended")
+    run(build ${MACROLIB} -e -o ${lib}.mlb ${LIBDIR})
+  elseif(lib STREQUAL "native")
+    run(build ${MACROLIB} -n -o ${lib}.mlb ${LIBDIR})
+  else()
+    run(build ${MACROLIB} -n -o ${lib}.mlb rt11.mlb)
+  endif()
+  if(NOT build_result EQUAL 0)
+    message(FATAL_ERROR "macrolib couldn't make ${lib}.mlb:\n${build_output}")
+  endif()
+
+  run(asm ${MACRO11} -m ${lib}.mlb -o ${lib}.obj ${SOURCE})
+  same_files(ref.obj ${lib}.obj)
+  if(NOT asm_output STREQUAL ref_output)
+    message(FATAL_ERROR "with ${lib}.mlb:\n${asm_output}\ninstead of:\n${ref_output}")
+  endif()
+endforeach()
+
+run(mlist ${MACRO11} -mlist -m native.mlb -o mlist.obj ${SOURCE})
+if(mlist_output MATCHES "\\.MCALL [^\n]* from native\\.mlb\n")
+  message(FATAL_ERROR "macros from native.mlb weren't precompiled:\n${mlist_output}")
+endif()
+
+# The RT-11 library's header is the one LIBR/M writes: the ID, version
+# V05, the date and time it was made, here 1-Jan-2000 at midnight from
+# SOURCE_DATE_EPOCH, and one block of directory, 64 entries of 8 bytes
+# from block 1.  Made again at that time, it's the same file.
+foreach(copy dated dated2)
+  run(build ${CMAKE_COMMAND} -E env SOURCE_DATE_EPOCH=946684800
+      ${MACROLIB} -o ${copy}.mlb ${LIBDIR})
+  if(NOT build_result EQUAL 0)
+    message(FATAL_ERROR "macrolib couldn't make ${copy}.mlb:\n${build_output}")
+  endif()
+endforeach()
+same_files(dated.mlb dated2.mlb)
+
+file(READ ${WORKDIR}/dated.mlb header LIMIT 32 HEX)
+set(expect "010240010000")                       # 0: 01001 0500 0
+string(APPEND expect "3c0400000000")             # 6: date, time
+string(APPEND expect "0000000000000000000000000000")   # 14: reserved
+string(APPEND expect "080001004000")             # 32: entry size, block, entries
+if(NOT header STREQUAL expect)
+  message(FATAL_ERROR "dated.mlb's header is\n${header}\ninstead of\n${expect}")
+endif()
+
+# Two native libraries made under -ysl 8, opened together, which is
+# done on several threads.  Under -ysl 8 every macro must be used as
+# it was compiled, from both; under the default length, none may be.
+run(build ${MACROLIB} -n -ysl 8 -o ysl_a.mlb ${LIBDIR}/PUSH.MAC ${LIBDIR}/POP.MAC)
+run(build2 ${MACROLIB} -n -ysl 8 -o ysl_b.mlb ${LIBDIR}/TABLE.MAC ${LIBDIR}/STRING.MAC)
+if(NOT build_result EQUAL 0 OR NOT build2_result EQUAL 0)
+  message(FATAL_ERROR "macrolib couldn't make the -ysl 8 libraries:\n${build_output}${build2_output}")
+endif()
+
+run(ysl_ref ${MACRO11} -ysl 8 -p ${LIBDIR} -o ysl_ref.obj ${SOURCE})
+run(ysl ${MACRO11} -ysl 8 -mlist -m ysl_a.mlb -m ysl_b.mlb -o ysl.obj ${SOURCE})
+same_files(ysl_ref.obj ysl.obj)
+string(REGEX MATCHALL "from ysl_[ab]\\.mlb \\(precompiled\\)\n" compiled "${ysl_output}")
+list(LENGTH compiled ncompiled)
+if(NOT ncompiled EQUAL 4 OR NOT ysl_output MATCHES "ysl_a" OR NOT ysl_output MATCHES "ysl_b")
+  message(FATAL_ERROR "with -ysl 8, not all precompiled:\n${ysl_output}")
+endif()
+
+run(ysl6 ${MACRO11} -mlist -m ysl_a.mlb -m ysl_b.mlb -o ysl6.obj ${SOURCE})
+if(ysl6_output MATCHES "precompiled")
+  message(FATAL_ERROR "without -ysl 8, precompiled:\n${ysl6_output}")
+endif()
@@ -0,0 +1,77 @@
+# Assembles SOURCE with the second pass read again from the source
+# (-noreplay), replayed from what the first pass recorded, and with
+# -onepass; each with and without a listing.  The object files,
+# listings and messages must be the same, and so must the profiles
+# but for the times.  With CLEAN, there must be no errors; with
+# REPLAY and ONEPASS, -stats must say how the second pass went
+# without and with -onepass, and with -profdata, which replays but
+# never does -onepass.
+
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+get_filename_component(name ${SOURCE} NAME)
+configure_file(${SOURCE} ${WORKDIR}/${name} COPYONLY)
+
+run(reread ${MACRO11} -noreplay -o reread.obj ${name})
+run(reread_lst ${MACRO11} -noreplay -l reread.lst -o reread_lst.obj ${name})
+if(CLEAN AND NOT reread_result EQUAL 0)
+  message(FATAL_ERROR "errors in ${name}:\n${reread_output}")
+endif()
+
+run(replay ${MACRO11} -o replay.obj ${name})
+run(replay_lst ${MACRO11} -l replay.lst -o replay_lst.obj ${name})
+same_files(reread.obj replay.obj)
+same_files(reread.obj replay_lst.obj)
+same_files(reread.obj reread_lst.obj)
+same_files(reread.lst replay.lst)
+if(NOT replay_output STREQUAL reread_output OR
+   NOT replay_lst_output STREQUAL reread_lst_output)
+  message(FATAL_ERROR "replayed:\n${replay_output}\ninstead of:\n${reread_output}")
+endif()
+
+run(onepass ${MACRO11} -onepass -o onepass.obj ${name})
+run(onepass_lst ${MACRO11} -onepass -l onepass.lst -o onepass_lst.obj ${name})
+same_files(reread.obj onepass.obj)
+same_files(reread.obj onepass_lst.obj)
+same_files(reread.lst onepass.lst)
+if(NOT onepass_output STREQUAL reread_output OR
+   NOT onepass_lst_output STREQUAL reread_lst_output)
+  message(FATAL_ERROR "with -onepass:\n${onepass_output}\ninstead of:\n${reread_output}")
+endif()
+
+# read_profile reads a -profdata file, less the times, in order
+function(read_profile var file)
+  file(STRINGS ${WORKDIR}/${file} all)
+  set(lines)
+  foreach(line IN LISTS all)
+    string(REGEX REPLACE "\t[^\t]*$" "" line "${line}")
+    list(APPEND lines "${line}")
+  endforeach()
+  list(SORT lines)
+  set(${var} "${lines}" PARENT_SCOPE)
+endfunction()
+
+run(prof_reread ${MACRO11} -noreplay -profdata reread.prof -o prof_reread.obj ${name})
+run(prof_replay ${MACRO11} -profdata replay.prof -o prof_replay.obj ${name})
+same_files(reread.obj prof_reread.obj)
+same_files(reread.obj prof_replay.obj)
+read_profile(reread_prof reread.prof)
+read_profile(replay_prof replay.prof)
+if(NOT replay_prof STREQUAL reread_prof)
+  message(FATAL_ERROR "replayed, the profile is:\n${replay_prof}\ninstead of:\n${reread_prof}")
+endif()
+
+function(second_pass how)
+  run(stats ${MACRO11} ${ARGN} -stats -o stats.obj ${name})
+  if(NOT stats_output MATCHES "Second pass: ${how}\n")
+    message(FATAL_ERROR "second pass not ${how} with ${ARGN}:\n${stats_output}")
+  endif()
+endfunction()
+
+if(REPLAY)
+  second_pass(${REPLAY})
+  second_pass(${REPLAY} -onepass -profdata stats.prof)
+endif()
+if(ONEPASS)
+  second_pass(${ONEPASS} -onepass)
+endif()
@@ -0,0 +1,18 @@
+# Assembles SOURCE, suppressed.mac, with a listing.  There must be no
+# errors, and the lines after the .ENDC in the .REM must be assembled.
+
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+configure_file(${SOURCE} ${WORKDIR}/suppressed.mac COPYONLY)
+
+run(asm ${MACRO11} -l suppressed.lst -o suppressed.obj suppressed.mac)
+if(NOT asm_result EQUAL 0)
+  message(FATAL_ERROR "errors in suppressed.mac:\n${asm_output}")
+endif()
+
+file(READ ${WORKDIR}/suppressed.lst listing)
+if(NOT listing MATCHES "\n +12 000000 000003 +\\.WORD +3\n" OR
+   NOT listing MATCHES "\n +14 000002 000004 +\\.WORD +4\n" OR
+   listing MATCHES "00000[12] +\\.WORD")
+  message(FATAL_ERROR "suppressed.lst is:\n${listing}")
+endif()
@@ -0,0 +1,33 @@
+# Assembles SOURCE, values.mac, with a listing.  Each macro call must
+# expand to the value its \expression argument has at the call, and
+# the two that aren't constants must both be reported.
+
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+configure_file(${SOURCE} ${WORKDIR}/values.mac COPYONLY)
+
+run(asm ${MACRO11} -l values.lst -o values.obj values.mac)
+set(expected "values.mac:27: ***ERROR Constant value required\n"
+             "values.mac:28: ***ERROR Constant value required\n")
+string(CONCAT expected ${expected})
+if(NOT asm_output STREQUAL expected)
+  message(FATAL_ERROR "values.mac gave:\n${asm_output}\ninstead of:\n${expected}")
+endif()
+
+file(READ ${WORKDIR}/values.lst listing)
+
+# The call on the given line must expand to a .WORD of value
+function(expect_word line value)
+  if(NOT listing MATCHES "\n +${line} [^\n]*VAL[^\n]*\n +1 [0-7]+ ${value} ")
+    message(FATAL_ERROR "line ${line} isn't ${value} in values.lst:\n${listing}")
+  endif()
+endfunction()
+
+expect_word(14 000001)
+expect_word(15 000001)
+expect_word(17 000002)
+expect_word(19 000012)
+expect_word(21 000011)
+expect_word(22 001012)
+expect_word(23 001014)
+expect_word(26 000002)